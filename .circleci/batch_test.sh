@@ -0,0 +1,66 @@
+#!/usr/bin/env bash
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# All rights reserved.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+#
+
+# usage: batch_test.sh <train-data>
+#
+# cbow and skipgram trained in minibatches of 8 examples learn as with an
+# update after every example: the loss decreases during training, ends close
+# to the loss of updates after every example, and the nearest neighbours of
+# frequent words are mostly the same.
+
+set -e
+
+RESULTDIR=result
+TRAIN="${RESULTDIR}/batch.train"
+QUERIES="${RESULTDIR}/batch.queries"
+
+# Prints the average losses shown during the training of model $1 in
+# minibatches of $2 examples, the last one at the end of the training.
+train() {
+  ./fasttext "$1" -input "${TRAIN}" -output "${RESULTDIR}/batch$2" -dim 50 \
+    -epoch 2 -minCount 5 -thread 4 -batchSize "$2" -verbose 2 2>&1 \
+    | tr '\r' '\n' | sed -n -e 's/.*avg\.loss: *\([^ ]*\).*/\1/p'
+}
+
+# Neighbours of the queries in the model trained in minibatches of $1.
+nn() {
+  ./fasttext nn "${RESULTDIR}/batch$1.bin" 10 < "${QUERIES}" \
+    | sed -e 's/^Query word? //' | grep -v '^$'
+}
+
+head -n 50000 "$1" > "${TRAIN}"
+
+for model in cbow skipgram
+do
+  train "${model}" 1 > "${RESULTDIR}/batch1.loss"
+  train "${model}" 8 > "${RESULTDIR}/batch8.loss"
+  tail -n +2 "${RESULTDIR}/batch1.vec" | head -n 500 | cut -d ' ' -f 1 \
+    > "${QUERIES}"
+  nn 1 > "${RESULTDIR}/batch1.nn"
+  nn 8 > "${RESULTDIR}/batch8.nn"
+
+  awk -v model="${model}" '
+    FILENAME ~ /batch1.loss$/ { hogwild = $1; next }
+    FNR == 1 { first = $1 }
+    { last = $1 }
+    END {
+      printf "%s avg.loss %s -> %s, %s with batchSize 1\n",
+        model, first, last, hogwild
+      exit !(last < first && last < 1.1 * hogwild)
+    }' "${RESULTDIR}/batch1.loss" "${RESULTDIR}/batch8.loss"
+
+  awk -v model="${model}" '
+    FNR == NR { hogwild[int((FNR - 1) / 10), $1] = 1; next }
+    $2 != $2 + 0 || $2 < -1.001 || $2 > 1.001 { nan++ }
+    { found += (int((FNR - 1) / 10), $1) in hogwild; n++ }
+    END {
+      printf "%s neighbours shared with batchSize 1 %.3f\n", model, found / n
+      exit !(n > 0 && !nan && found >= 0.5 * n)
+    }' "${RESULTDIR}/batch1.nn" "${RESULTDIR}/batch8.nn"
+done
@@ -16,3 +16,13 @@ cp buildc/fasttext .
 ./fasttext supervised -input "${DATADIR}/dbpedia.train" -output "${RESULTDIR}/dbpedia" -dim 10 -lr 0.1 -wordNgrams 2 -minCount 1 -bucket 10000000 -epoch 5 -thread 4 -verbose 0
 ./fasttext test "${RESULTDIR}/dbpedia.bin" "${DATADIR}/dbpedia.test"
 ./fasttext predict "${RESULTDIR}/dbpedia.bin" "${DATADIR}/dbpedia.test" > "${RESULTDIR}/dbpedia.test.predict"
+./.circleci/predict_test.sh "${RESULTDIR}/dbpedia.bin" "${DATADIR}/dbpedia.test"
+./.circleci/stream_test.sh "${DATADIR}/dbpedia.train" "${DATADIR}/dbpedia.test"
+./.circleci/nn_test.sh "${DATADIR}/dbpedia.train"
+./.circleci/batch_test.sh "${DATADIR}/dbpedia.train"
+# Quantized models, product quantized and 8-bit, saved then loaded again.
+./fasttext quantize -input "${DATADIR}/dbpedia.train" -output "${RESULTDIR}/dbpedia" -qnorm -qout -cutoff 100000 -retrain -epoch 1 -thread 4
+./fasttext test "${RESULTDIR}/dbpedia.ftz" "${DATADIR}/dbpedia.test"
+./fasttext quantize -input "${DATADIR}/dbpedia.train" -output "${RESULTDIR}/dbpedia" -int8 -qout
+./fasttext test "${RESULTDIR}/dbpedia.ftz" "${DATADIR}/dbpedia.test"
+./fasttext predict "${RESULTDIR}/dbpedia.ftz" "${DATADIR}/dbpedia.test" > "${RESULTDIR}/dbpedia.test.predict"
@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# All rights reserved.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+#
+
+# usage: nn_test.sh <train-data>
+#
+# The nearest neighbours found in the indexes built by nn-index and pq-index
+# are, for the most part, the exact ones, as found without an index, also
+# once the model has the other index too.
+
+set -e
+
+RESULTDIR=result
+MODEL="${RESULTDIR}/nn"
+QUERIES="${RESULTDIR}/nn.queries"
+
+# Neighbours of the queries, k lines per query without the prompts.
+nn() {
+  ./fasttext nn "${MODEL}.bin" 10 "$@" < "${QUERIES}" \
+    | sed -e 's/^Query word? //' | grep -v '^$'
+}
+
+# Fails when less than a fraction $2 of the neighbours in $1 are exact.
+check_recall() {
+  awk -v min="$2" '
+    FNR == NR { exact[int((FNR - 1) / 10), $1] = 1; next }
+    { found += (int((FNR - 1) / 10), $1) in exact; n++ }
+    END {
+      printf "recall@10 %.3f\n", found / n
+      exit !(n > 0 && found >= min * n)
+    }' "${RESULTDIR}/nn.exact" "$1"
+}
+
+head -n 100000 "$1" > "${MODEL}.train"
+./fasttext skipgram -input "${MODEL}.train" -output "${MODEL}" -dim 50 \
+  -epoch 1 -minCount 5 -thread 4 -verbose 0
+tail -n +2 "${MODEL}.vec" | awk 'NR % 20 == 0 { print $1 }' \
+  | head -n 500 > "${QUERIES}"
+
+rm -f "${MODEL}.bin.hnsw" "${MODEL}.bin.ivfpq"
+nn > "${RESULTDIR}/nn.exact"
+
+./fasttext pq-index "${MODEL}.bin"
+nn 16 > "${RESULTDIR}/nn.ivfpq"
+check_recall "${RESULTDIR}/nn.ivfpq" 0.8
+
+./fasttext nn-index "${MODEL}.bin"
+nn 64 > "${RESULTDIR}/nn.hnsw"
+check_recall "${RESULTDIR}/nn.hnsw" 0.9
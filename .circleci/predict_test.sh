@@ -0,0 +1,48 @@
+#!/usr/bin/env bash
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# All rights reserved.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+#
+
+# usage: predict_test.sh <model> <test-data>
+#
+# predict and predict-prob print the same bytes whether the lines are read
+# from a file or from stdin, in blocks or as they arrive, on one thread or
+# more, as when each line is predicted on its own. The input ends with an
+# empty line, a blank line and a last line without a newline.
+
+set -e
+
+RESULTDIR=result
+MODEL="$1"
+TESTDATA="$2"
+INPUT="${RESULTDIR}/predict.in"
+LINES="${RESULTDIR}/predict.lines"
+
+head -n 200 "${TESTDATA}" > "${INPUT}"
+printf '\n  \t \n' >> "${INPUT}"
+head -n 1 "${TESTDATA}" | tr -d '\n' >> "${INPUT}"
+
+rm -rf "${LINES}" && mkdir "${LINES}"
+split -l 1 -a 4 "${INPUT}" "${LINES}/"
+
+for command in predict predict-prob
+do
+  for line in "${LINES}"/*
+  do
+    ./fasttext "${command}" "${MODEL}" "${line}" 3
+  done > "${RESULTDIR}/predict.expected"
+
+  ./fasttext "${command}" "${MODEL}" "${INPUT}" 3 \
+    | cmp - "${RESULTDIR}/predict.expected"
+  ./fasttext "${command}" "${MODEL}" "${INPUT}" 3 0.0 4 \
+    | cmp - "${RESULTDIR}/predict.expected"
+  cat "${INPUT}" | ./fasttext "${command}" "${MODEL}" - 3 \
+    | cmp - "${RESULTDIR}/predict.expected"
+  (head -n 100 "${INPUT}"; sleep 1; tail -n +101 "${INPUT}") \
+    | ./fasttext "${command}" "${MODEL}" - 3 \
+    | cmp - "${RESULTDIR}/predict.expected"
+done
@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+#
+# Copyright (c) 2016-present, Facebook, Inc.
+# All rights reserved.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+#
+
+# usage: stream_test.sh <train-data> <test-data>
+#
+# Training on the lines of a pipe ends with the pipe, and on one thread it
+# gives the same model as training on the file. The training loop checks the
+# token budget every lrUpdateRate tokens, so that a file is read a little
+# past its end unless lrUpdateRate is 1.
+
+set -e
+
+RESULTDIR=result
+TRAIN="${RESULTDIR}/stream.train"
+
+head -n 20000 "$1" > "${TRAIN}"
+
+./fasttext supervised -input "${TRAIN}" -output "${RESULTDIR}/file" \
+  -dim 10 -wordNgrams 2 -epoch 2 -lrUpdateRate 1 -thread 1 -verbose 0
+(cat "${TRAIN}"; cat "${TRAIN}") | timeout 600 ./fasttext supervised \
+  -input - -vocabInput "${TRAIN}" -output "${RESULTDIR}/stream" \
+  -dim 10 -wordNgrams 2 -epoch 2 -lrUpdateRate 1 -thread 1 -verbose 0
+./fasttext predict-prob "${RESULTDIR}/file.bin" "$2" 3 \
+  > "${RESULTDIR}/file.predict"
+./fasttext predict-prob "${RESULTDIR}/stream.bin" "$2" 3 \
+  | cmp - "${RESULTDIR}/file.predict"
+
+./fasttext skipgram -input "${TRAIN}" -output "${RESULTDIR}/file" \
+  -dim 10 -epoch 1 -lrUpdateRate 1 -thread 1 -verbose 0
+cat "${TRAIN}" | timeout 600 ./fasttext skipgram \
+  -input - -vocabInput "${TRAIN}" -output "${RESULTDIR}/stream" \
+  -dim 10 -epoch 1 -lrUpdateRate 1 -thread 1 -verbose 0
+cmp "${RESULTDIR}/stream.vec" "${RESULTDIR}/file.vec"
@@ -88,10 +88,10 @@ class _FastText(object):
     strings are then encoded as UTF-8 and fed to the fastText C++ API.
     """
 
-    def __init__(self, model_path=None, args=None):
+    def __init__(self, model_path=None, args=None, mmap=False):
         self.f = fasttext.fasttext()
         if model_path is not None:
-            self.f.loadModel(model_path)
+            self.f.loadModel(model_path, mmap)
         self._words = None
         self._labels = None
         self.set_args(args)
@@ -180,7 +180,8 @@ class _FastText(object):
         self.f.getInputVector(b, ind)
         return np.array(b)
 
-    def predict(self, text, k=1, threshold=0.0, on_unicode_error='strict'):
+    def predict(self, text, k=1, threshold=0.0, on_unicode_error='strict',
+                thread=None):
         """
         Given a string, get a list of labels and a list of
         corresponding probabilities. k controls the number
@@ -200,7 +201,8 @@ class _FastText(object):
         If the model is not supervised, this function will throw a ValueError.
 
         If given a list of strings, it will return a list of results as usually
-        received for a single line of text.
+        received for a single line of text. The lines are then predicted on
+        thread threads, the number of threads of the model by default.
         """
 
         def check(entry):
@@ -213,8 +215,10 @@ class _FastText(object):
 
         if type(text) == list:
             text = [check(entry) for entry in text]
+            if not thread:
+                thread = self.f.getArgs().thread
             all_labels, all_probs = self.f.multilinePredict(
-                text, k, threshold, on_unicode_error)
+                text, k, threshold, on_unicode_error, thread)
 
             return all_labels, all_probs
         else:
@@ -332,7 +336,9 @@ class _FastText(object):
         thread=None,
         verbose=None,
         dsub=2,
-        qnorm=False
+        qnorm=False,
+        opq=False,
+        int8=False
     ):
         """
         Quantize the model reducing the size of the model and
@@ -353,9 +359,27 @@ class _FastText(object):
             input = ""
         self.f.quantize(
             input, qout, cutoff, retrain, epoch, lr, thread, verbose, dsub,
-            qnorm
+            qnorm, opq, int8
         )
 
+    def build_label_index(self, nlist=0, thread=None):
+        """
+        Build an index of the labels of a softmax or one-vs-all model, with
+        nlist lists, about sqrt(nlabels) if 0. predict then searches it for
+        the exact top k labels instead of scoring every label.
+        """
+        if not thread:
+            thread = self.f.getArgs().thread
+        self.f.buildLabelIndex(nlist, thread)
+
+    def save_label_index(self, path):
+        """Save the label index to the given path"""
+        self.f.saveLabelIndex(path)
+
+    def load_label_index(self, path):
+        """Load a label index built for this model from the given path"""
+        self.f.loadLabelIndex(path)
+
     def set_matrices(self, input_matrix, output_matrix):
         """
         Set input and output matrices. This function assumes you know what you
@@ -431,9 +455,13 @@ def tokenize(text):
     return f.tokenize(text)
 
 
-def load_model(path):
-    """Load a model given a filepath and return a model object."""
-    return _FastText(model_path=path)
+def load_model(path, mmap=False):
+    """
+    Load a model given a filepath and return a model object. With mmap, the
+    dense matrices of the model are memory-mapped rather than read, and
+    cannot be exported with get_input_matrix or get_output_matrix.
+    """
+    return _FastText(model_path=path, mmap=mmap)
 
 
 unsupervised_default = {
@@ -452,6 +480,8 @@ unsupervised_default = {
     'bucket': 2000000,
     'thread': multiprocessing.cpu_count() - 1,
     'lrUpdateRate': 100,
+    'batchSize': 1,
+    'subwordCache': 1 << 16,
     't': 1e-4,
     'label': "__label__",
     'verbose': 2,
@@ -470,6 +500,7 @@ def read_args(arg_list, arg_dict, arg_names, default_values):
         'min_count': 'minCount',
         'word_ngrams': 'wordNgrams',
         'lr_update_rate': 'lrUpdateRate',
+        'batch_size': 'batchSize',
         'label_prefix': 'label',
         'pretrained_vectors': 'pretrainedVectors'
     }
@@ -518,8 +549,9 @@ def train_supervised(*kargs, **kwargs):
 
     arg_names = ['input', 'lr', 'dim', 'ws', 'epoch', 'minCount',
                  'minCountLabel', 'minn', 'maxn', 'neg', 'wordNgrams', 'loss', 'bucket',
-                 'thread', 'lrUpdateRate', 't', 'label', 'verbose', 'pretrainedVectors',
-                 'seed', 'autotuneValidationFile', 'autotuneMetric',
+                 'thread', 'lrUpdateRate', 'batchSize', 't', 'label', 'verbose',
+                 'pretrainedVectors', 'subwordCache', 'seed',
+                 'autotuneValidationFile', 'autotuneMetric',
                  'autotunePredictions', 'autotuneDuration', 'autotuneModelSize']
     args, manually_set_args = read_args(kargs, kwargs, arg_names,
                                         supervised_default)
@@ -546,7 +578,8 @@ def train_unsupervised(*kargs, **kwargs):
     """
     arg_names = ['input', 'model', 'lr', 'dim', 'ws', 'epoch', 'minCount',
                  'minCountLabel', 'minn', 'maxn', 'neg', 'wordNgrams', 'loss', 'bucket',
-                 'thread', 'lrUpdateRate', 't', 'label', 'verbose', 'pretrainedVectors']
+                 'thread', 'lrUpdateRate', 'batchSize', 't', 'label', 'verbose',
+                 'pretrainedVectors', 'subwordCache']
     args, manually_set_args = read_args(kargs, kwargs, arg_names,
                                         unsupervised_default)
     a = _build_args(args, manually_set_args)
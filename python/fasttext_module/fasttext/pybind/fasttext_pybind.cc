@@ -91,6 +91,7 @@ PYBIND11_MODULE(fasttext_pybind, m) {
       .def_readwrite("output", &fasttext::Args::output)
       .def_readwrite("lr", &fasttext::Args::lr)
       .def_readwrite("lrUpdateRate", &fasttext::Args::lrUpdateRate)
+      .def_readwrite("batchSize", &fasttext::Args::batchSize)
       .def_readwrite("dim", &fasttext::Args::dim)
       .def_readwrite("ws", &fasttext::Args::ws)
       .def_readwrite("epoch", &fasttext::Args::epoch)
@@ -108,12 +109,18 @@ PYBIND11_MODULE(fasttext_pybind, m) {
       .def_readwrite("label", &fasttext::Args::label)
       .def_readwrite("verbose", &fasttext::Args::verbose)
       .def_readwrite("pretrainedVectors", &fasttext::Args::pretrainedVectors)
+      .def_readwrite("vocabFile", &fasttext::Args::vocabFile)
+      .def_readwrite("vocabInput", &fasttext::Args::vocabInput)
+      .def_readwrite("subwordCache", &fasttext::Args::subwordCache)
+      .def_readwrite("lineIndexCache", &fasttext::Args::lineIndexCache)
       .def_readwrite("saveOutput", &fasttext::Args::saveOutput)
       .def_readwrite("seed", &fasttext::Args::seed)
 
       .def_readwrite("qout", &fasttext::Args::qout)
       .def_readwrite("retrain", &fasttext::Args::retrain)
       .def_readwrite("qnorm", &fasttext::Args::qnorm)
+      .def_readwrite("opq", &fasttext::Args::opq)
+      .def_readwrite("int8", &fasttext::Args::int8)
       .def_readwrite("cutoff", &fasttext::Args::cutoff)
       .def_readwrite("dsub", &fasttext::Args::dsub)
 
@@ -262,7 +269,9 @@ PYBIND11_MODULE(fasttext_pybind, m) {
           })
       .def(
           "loadModel",
-          [](fasttext::FastText& m, std::string s) { m.loadModel(s); })
+          [](fasttext::FastText& m, std::string s, bool mmap) {
+            m.loadModel(s, mmap);
+          })
       .def(
           "saveModel",
           [](fasttext::FastText& m, std::string s) { m.saveModel(s); })
@@ -376,7 +385,9 @@ PYBIND11_MODULE(fasttext_pybind, m) {
              int thread,
              int verbose,
              int32_t dsub,
-             bool qnorm) {
+             bool qnorm,
+             bool opq,
+             bool int8) {
             fasttext::Args qa = fasttext::Args();
             qa.input = input;
             qa.qout = qout;
@@ -388,8 +399,25 @@ PYBIND11_MODULE(fasttext_pybind, m) {
             qa.verbose = verbose;
             qa.dsub = dsub;
             qa.qnorm = qnorm;
+            qa.opq = opq;
+            qa.int8 = int8;
             m.quantize(qa);
           })
+      .def(
+          "buildLabelIndex",
+          [](fasttext::FastText& m, int32_t nlist, int32_t thread) {
+            m.buildLabelIndex(nlist, thread);
+          })
+      .def(
+          "saveLabelIndex",
+          [](fasttext::FastText& m, const std::string& filename) {
+            m.saveLabelIndex(filename);
+          })
+      .def(
+          "loadLabelIndex",
+          [](fasttext::FastText& m, const std::string& filename) {
+            m.loadLabelIndex(filename);
+          })
       .def(
           "predict",
           // NOTE: text needs to end in a newline
@@ -413,14 +441,18 @@ PYBIND11_MODULE(fasttext_pybind, m) {
              const std::vector<std::string>& lines,
              int32_t k,
              fasttext::real threshold,
-             const char* onUnicodeError) {
+             const char* onUnicodeError,
+             int32_t thread) {
             std::vector<py::array_t<fasttext::real>> allProbabilities;
             std::vector<std::vector<py::str>> allLabels;
-            std::vector<std::pair<fasttext::real, std::string>> predictions;
+            std::vector<std::vector<std::pair<fasttext::real, std::string>>>
+                allPredictions;
+            {
+              py::gil_scoped_release release;
+              m.predictBatch(lines, allPredictions, k, threshold, thread);
+            }
 
-            for (const std::string& text : lines) {
-              std::stringstream ioss(text);
-              m.predictLine(ioss, predictions, k, threshold);
+            for (const auto& predictions : allPredictions) {
               std::vector<fasttext::real> probabilities;
               std::vector<py::str> labels;
 
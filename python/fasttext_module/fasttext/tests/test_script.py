@@ -14,6 +14,7 @@ from fasttext import train_unsupervised
 from fasttext import util
 import fasttext
 import os
+import struct
 import subprocess
 import unittest
 import tempfile
@@ -130,6 +131,130 @@ def build_supervised_model(data, kwargs):
     return model
 
 
+def save_v12_model(f, path):
+    # Writes the supervised model f as version 12 of the format did, before
+    # the matrices were aligned and the dictionary index was saved with them.
+    a = f.f.getArgs()
+    words, word_counts = f.get_words(include_freq=True)
+    labels, label_counts = f.get_labels(include_freq=True)
+    with open(path, "wb") as out:
+        out.write(struct.pack("<ii", 793712314, 12))
+        out.write(
+            struct.pack(
+                "<12id", a.dim, a.ws, a.epoch, a.minCount, a.neg,
+                a.wordNgrams, int(a.loss), int(a.model), a.bucket, a.minn,
+                a.maxn, a.lrUpdateRate, a.t
+            )
+        )
+        out.write(
+            struct.pack(
+                "<iiiqq",
+                len(words) + len(labels), len(words), len(labels),
+                int(word_counts.sum() + label_counts.sum()), -1
+            )
+        )
+        for entries, counts, entry_type in [
+            (words, word_counts, 0), (labels, label_counts, 1)
+        ]:
+            for entry, count in zip(entries, counts):
+                out.write(entry.encode("UTF-8") + b"\0")
+                out.write(struct.pack("<qb", count, entry_type))
+        for matrix in [f.get_input_matrix(), f.get_output_matrix()]:
+            out.write(struct.pack("<?qq", False, *matrix.shape))
+            out.write(matrix.astype(np.float32).tobytes())
+
+
+TOKEN_SEPARATORS = [" ", "\t", "\r", "\v", "\f", "\0"]
+
+
+def get_tokenizer_data():
+    # Lines of random UTF-8 words split by every separator of the tokenizer,
+    # then a line of more than MAX_LINE_SIZE tokens, and a word longer than a
+    # block of the tokenizer
+    words = get_random_words(200)
+    lines = []
+    for _ in range(100):
+        line = ""
+        for _ in range(random.randint(0, 20)):
+            line += random.choice(TOKEN_SEPARATORS) * random.randint(1, 3)
+            line += random.choice(words)
+        lines.append(line)
+    lines.append(" ".join(random.choice(words) for _ in range(8000)))
+    lines.append(" ".join([words[0], get_random_unicode(3000), words[1]]))
+    return lines
+
+
+def old_tokens(text):
+    # Splits text as Dictionary::readWord did, one byte at a time, with the
+    # end of sentence token for each newline
+    separators = bytearray(b" \n\r\t\v\f\0")
+    tokens = []
+    token = bytearray()
+    for c in bytearray(text.encode("UTF-8")):
+        if c not in separators:
+            token.append(c)
+            continue
+        if token:
+            tokens.append(token.decode("UTF-8"))
+            token = bytearray()
+        if c == ord("\n"):
+            tokens.append("</s>")
+    if token:
+        tokens.append(token.decode("UTF-8"))
+    return tokens
+
+
+def old_hash(data):
+    # FNV-1a of the bytes of data, sign extended as Dictionary::hash did
+    h = 2166136261
+    for c in bytearray(data):
+        if c >= 0x80:
+            c |= 0xFFFFFF00
+        h = ((h ^ c) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def old_subwords(f, word):
+    # The character n-grams of word and their ids, each n-gram hashed on its
+    # own as Dictionary::computeSubwords did
+    nwords = len(f.get_words())
+    data = bytearray(("<" + word + ">").encode("UTF-8"))
+    subwords = []
+    ids = []
+    for i in range(len(data)):
+        if data[i] & 0xC0 == 0x80:
+            continue
+        j = i
+        n = 1
+        while j < len(data) and n <= f.maxn:
+            j += 1
+            while j < len(data) and data[j] & 0xC0 == 0x80:
+                j += 1
+            if n >= f.minn and not (n == 1 and (i == 0 or j == len(data))):
+                subwords.append(data[i:j].decode("UTF-8"))
+                ids.append(nwords + old_hash(data[i:j]) % f.bucket)
+            n += 1
+    return subwords, ids
+
+
+def old_word_ids(f, word):
+    # The ids of the input rows averaged into the vector of word
+    wid = f.get_word_id(word)
+    if word == "</s>" or (wid >= 0 and f.maxn <= 0):
+        return [wid] if wid >= 0 else []
+    return ([wid] if wid >= 0 else []) + old_subwords(f, word)[1]
+
+
+def old_line_ids(f, line):
+    # The ids of the input rows averaged into the vector of line by a
+    # supervised model, labels left out
+    ids = []
+    for token in old_tokens(line + "\n"):
+        if not token.startswith(f.label):
+            ids += old_word_ids(f, token)
+    return ids
+
+
 def read_labels(data_file):
     labels = []
     lines = []
@@ -185,6 +310,127 @@ class TestFastTextUnitPy(unittest.TestCase):
         for labels in all_labels2:
             self.assertEqual(len(labels), 0)
 
+    def gen_test_vocabulary_ids(self, kwargs):
+        # Each token of the training file is counted under an id of its own,
+        # whatever its bytes and its length, and other words have none
+        data = get_tokenizer_data()
+        for build, lines in [
+            (build_unsupervised_model, data),
+            (
+                build_supervised_model,
+                ["__label__" + line.strip() for line in data]
+            ),
+        ]:
+            f = build(data, copy.deepcopy(kwargs))
+            counts = {}
+            for line in lines:
+                for token in old_tokens(line + "\n"):
+                    counts[token] = counts.get(token, 0) + 1
+            words, word_counts = f.get_words(include_freq=True)
+            self.assertEqual(
+                dict(zip(words, word_counts)), {
+                    token: count
+                    for token, count in counts.items()
+                    if not token.startswith(f.label)
+                }
+            )
+            for i, word in enumerate(words):
+                self.assertEqual(f.get_word_id(word), i)
+            for word in get_random_words(100):
+                if word not in counts:
+                    self.assertEqual(f.get_word_id(word), -1)
+            if build is build_supervised_model:
+                labels, label_counts = f.get_labels(include_freq=True)
+                self.assertEqual(
+                    dict(zip(labels, label_counts)), {
+                        token: count
+                        for token, count in counts.items()
+                        if token.startswith(f.label)
+                    }
+                )
+                for i, label in enumerate(labels):
+                    self.assertEqual(f.get_label_id(label), i)
+
+    def gen_test_tokenize(self, kwargs):
+        # Lines read by the block tokenizer, however long, are split as one
+        # byte at a time, so that their vectors average the same rows
+        data = get_tokenizer_data()
+        text = "".join(line + "\n" for line in data)
+        self.assertEqual(fasttext.tokenize(text), old_tokens(text))
+        f = build_supervised_model(data, copy.deepcopy(kwargs))
+        rows = f.get_input_matrix().astype(np.float64)
+        for line in data + [" ".join(get_random_words(100))]:
+            ids = old_line_ids(f, line)
+            expected = np.zeros(f.get_dimension())
+            if ids:
+                expected = rows[ids].mean(axis=0)
+            self.assertTrue(
+                np.allclose(
+                    f.get_sentence_vector(line), expected, rtol=1e-3,
+                    atol=1e-5
+                )
+            )
+
+    def gen_test_subwords(self, kwargs):
+        # The n-grams of words in and out of the vocabulary have the ids they
+        # had when each was hashed on its own, and their rows are averaged
+        # into the word vectors
+        data = get_tokenizer_data()
+        for build in [build_unsupervised_model, build_supervised_model]:
+            f = build(data, copy.deepcopy(kwargs))
+            rows = f.get_input_matrix().astype(np.float64)
+            for word in f.get_words() + get_random_words(100):
+                expected_subwords, expected_ids = old_subwords(f, word)
+                if word == "</s>":
+                    expected_subwords, expected_ids = [], []
+                wid = f.get_word_id(word)
+                if wid >= 0:
+                    expected_subwords = [word] + expected_subwords
+                    expected_ids = [wid] + expected_ids
+                subwords, ids = f.get_subwords(word)
+                self.assertEqual(list(subwords), expected_subwords)
+                self.assertEqual(list(ids), expected_ids)
+                ids = old_word_ids(f, word)
+                expected = np.zeros(f.get_dimension())
+                if ids:
+                    expected = rows[ids].mean(axis=0)
+                self.assertTrue(
+                    np.allclose(
+                        f.get_word_vector(word), expected, rtol=1e-3,
+                        atol=1e-5
+                    )
+                )
+
+    def gen_test_subword_cache(self, kwargs):
+        # Models give the same vectors with the subwords of words out of the
+        # vocabulary cached or not, and with a cache too small to keep them
+        data = get_tokenizer_data()
+        oov = get_random_words(500) + [get_random_unicode(200)]
+        for build in [build_unsupervised_model, build_supervised_model]:
+            models = []
+            for size in [0, 1, 1 << 16]:
+                kwargs["subwordCache"] = size
+                models.append(build(data, copy.deepcopy(kwargs)))
+            f0 = models[0]
+            for f in models[1:]:
+                self.assertTrue(
+                    np.array_equal(f.get_input_matrix(), f0.get_input_matrix())
+                )
+                for word in oov + oov:
+                    self.assertTrue(
+                        np.array_equal(
+                            f.get_word_vector(word), f0.get_word_vector(word)
+                        )
+                    )
+                if build is build_supervised_model:
+                    for line in data + [" ".join(oov)] * 2:
+                        self.assertTrue(
+                            np.array_equal(
+                                f.get_sentence_vector(line),
+                                f0.get_sentence_vector(line)
+                            )
+                        )
+
     def gen_test_supervised_util_test(self, kwargs):
         def check(data):
             third = int(len(data) / 3)
@@ -275,6 +521,55 @@ class TestFastTextUnitPy(unittest.TestCase):
             )
         )
 
+    def gen_test_supervised_label_index_predict(self, kwargs):
+        # The labels found in the index are the exact top k, up to labels of
+        # equal scores, and one-vs-all probabilities are exact too
+        data = get_random_data(1000, max_vocab_size=1000)
+        for loss in ["softmax", "ova"]:
+            kwargs["loss"] = loss
+            f = build_supervised_model(data, copy.deepcopy(kwargs))
+            path = os.path.join(tempfile.mkdtemp(), "model.bin")
+            f.save_model(path)
+            f.build_label_index()
+            f.save_label_index(path + ".mips")
+            f2 = fasttext.load_model(path)
+            f2.load_label_index(path + ".mips")
+            exact = fasttext.load_model(path)
+            nlabels = len(exact.get_labels())
+            for line in data:
+                labels, probs = exact.predict(line, nlabels)
+                exact_probs = dict(zip(labels, probs))
+                for k in [1, 2, 5]:
+                    for model in [f, f2]:
+                        index_labels, index_probs = model.predict(line, k)
+                        self.assertEqual(len(index_labels), min(k, nlabels))
+                        found = [exact_probs[l] for l in index_labels]
+                        self.assertTrue(
+                            np.isclose(found, probs[:k], rtol=1e-5).all()
+                        )
+                        if loss == "ova":
+                            self.assertTrue(
+                                np.isclose(index_probs, probs[:k],
+                                           rtol=1e-5).all()
+                            )
+
+    def gen_test_supervised_label_index_other_model(self, kwargs):
+        kwargs["loss"] = "softmax"
+        data = get_random_data(100)
+        f1 = build_supervised_model(data, copy.deepcopy(kwargs))
+        path = os.path.join(tempfile.mkdtemp(), "model.mips")
+        f1.build_label_index()
+        f1.save_label_index(path)
+        # Same labels, other output matrix
+        kwargs["epoch"] = 2
+        f2 = build_supervised_model(data, copy.deepcopy(kwargs))
+        gotError = False
+        try:
+            f2.load_label_index(path)
+        except ValueError:
+            gotError = True
+        self.assertTrue(gotError)
+
     def gen_test_vocab(self, kwargs):
         # Confirm empty dataset, confirm all label dataset
 
@@ -429,6 +724,154 @@ class TestFastTextUnitPy(unittest.TestCase):
         f.quantize()
         self.assertTrue(f.is_quantized())
 
+    def assertSameModel(self, f1, f2):
+        self.assertEqual(f1.get_words(), f2.get_words())
+        self.assertEqual(f1.get_labels(), f2.get_labels())
+        for w in f1.get_words() + get_random_words(10):
+            self.assertEqual(
+                list(f1.get_word_vector(w)), list(f2.get_word_vector(w))
+            )
+        for line in get_random_data(20) + [" ".join(f1.get_words()[:20])]:
+            labels1, probs1 = f1.predict(line, k=5)
+            labels2, probs2 = f2.predict(line, k=5)
+            self.assertEqual(list(labels1), list(labels2))
+            self.assertEqual(list(probs1), list(probs2))
+
+    def gen_test_supervised_load_v12_model(self, kwargs):
+        f = build_supervised_model(get_random_data(100), kwargs)
+        path = os.path.join(tempfile.mkdtemp(), "v12.bin")
+        save_v12_model(f, path)
+        for mmap in [False, True]:
+            # Version 12 models are not aligned, and are read even with mmap.
+            f2 = fasttext.load_model(path, mmap=mmap)
+            self.assertSameModel(f, f2)
+            self.assertTrue(
+                np.array_equal(f.get_input_matrix(), f2.get_input_matrix())
+            )
+            self.assertTrue(
+                np.array_equal(f.get_output_matrix(), f2.get_output_matrix())
+            )
+
+    def gen_test_supervised_save_load(self, kwargs):
+        f = build_supervised_model(get_random_data(100), kwargs)
+        path = os.path.join(tempfile.mkdtemp(), "model.bin")
+        f.save_model(path)
+        f2 = fasttext.load_model(path)
+        self.assertSameModel(f, f2)
+        self.assertTrue(
+            np.array_equal(f.get_input_matrix(), f2.get_input_matrix())
+        )
+        self.assertTrue(
+            np.array_equal(f.get_output_matrix(), f2.get_output_matrix())
+        )
+        f3 = fasttext.load_model(path, mmap=True)
+        self.assertSameModel(f, f3)
+        gotError = False
+        try:
+            f3.get_input_matrix()
+        except RuntimeError:
+            gotError = True
+        self.assertTrue(gotError)
+        # A model saved from a memory-mapped one is the same file.
+        path2 = os.path.join(tempfile.mkdtemp(), "model.bin")
+        f3.save_model(path2)
+        with open(path, "rb") as in1, open(path2, "rb") as in2:
+            self.assertEqual(in1.read(), in2.read())
+
+    def gen_test_supervised_quantized_save_load(self, kwargs):
+        data = get_random_data(1000, max_vocab_size=1000)
+        for quant_kwargs in [
+            {}, {"qout": True}, {"opq": True}, {"opq": True, "qout": True},
+            {"int8": True}, {"int8": True, "qout": True}
+        ]:
+            f = build_supervised_model(data, copy.deepcopy(kwargs))
+            f.quantize(**quant_kwargs)
+            path = os.path.join(tempfile.mkdtemp(), "model.ftz")
+            f.save_model(path)
+            for mmap in [False, True]:
+                f2 = fasttext.load_model(path, mmap=mmap)
+                self.assertTrue(f2.is_quantized())
+                self.assertSameModel(f, f2)
+
+    def quantized_predict_error(self, data, kwargs, quant_kwargs):
+        # Quantizes a copy of a float model, saves it and loads it again, and
+        # returns both with the largest relative error of the probabilities
+        # of every label over the lines of data
+        f = build_supervised_model(data, kwargs)
+        path = os.path.join(tempfile.mkdtemp(), "model.bin")
+        f.save_model(path)
+        q = fasttext.load_model(path)
+        q.quantize(**quant_kwargs)
+        q.save_model(path[:-len(".bin")] + ".ftz")
+        q = fasttext.load_model(path[:-len(".bin")] + ".ftz")
+        nlabels = len(f.get_labels())
+        error = 0.0
+        for line in data:
+            labels, probs = f.predict(line, nlabels)
+            exact_probs = dict(zip(labels, probs))
+            qlabels, qprobs = q.predict(line, nlabels)
+            self.assertEqual(sorted(qlabels), sorted(labels))
+            exact = np.array([exact_probs[l] for l in qlabels])
+            error = max(error, np.max(np.abs(qprobs - exact) / exact))
+        return f, q, error
+
+    def gen_test_supervised_int8_predict(self, kwargs):
+        # Each row of an 8-bit matrix is within half a step of the float row,
+        # and the probabilities stay close to those of the float model
+        data = get_random_data(1000, max_vocab_size=1000)
+        for qout in [False, True]:
+            f, q, error = self.quantized_predict_error(
+                data, copy.deepcopy(kwargs), {"int8": True, "qout": qout}
+            )
+            self.assertLess(error, 0.02)
+            rows = f.get_input_matrix()
+            for i in range(rows.shape[0]):
+                step = np.max(np.abs(rows[i])) / 127
+                self.assertTrue(
+                    np.all(
+                        np.abs(q.get_input_vector(i) - rows[i]) <=
+                        step / 2 * 1.001 + 1e-7
+                    )
+                )
+
+    def gen_test_supervised_opq_predict(self, kwargs):
+        # Rotated product quantization keeps the probabilities about as close
+        # to those of the float model as product quantization without it
+        data = get_random_data(1000, max_vocab_size=1000)
+        for qout in [False, True]:
+            _, _, error = self.quantized_predict_error(
+                data, copy.deepcopy(kwargs), {"opq": True, "qout": qout}
+            )
+            self.assertLess(error, 0.2)
+
+    def gen_test_supervised_subword_cache_prune(self, kwargs):
+        # Pruning the vocabulary drops the subwords cached before it, whose
+        # ids are those of rows that were moved or dropped
+        if "maxn" not in kwargs:
+            kwargs.update({"minn": 2, "maxn": 4})
+        data = get_random_data(1000, max_vocab_size=1000)
+        oov = get_random_words(100)
+        f = build_supervised_model(data, kwargs)
+        for word in oov:
+            f.get_word_vector(word)
+        f.get_sentence_vector(" ".join(oov))
+        f.quantize(cutoff=500)
+        path = os.path.join(tempfile.mkdtemp(), "model.ftz")
+        f.save_model(path)
+        f2 = fasttext.load_model(path)
+        for word in oov:
+            self.assertTrue(
+                np.array_equal(
+                    f.get_word_vector(word), f2.get_word_vector(word)
+                )
+            )
+        self.assertTrue(
+            np.array_equal(
+                f.get_sentence_vector(" ".join(oov)),
+                f2.get_sentence_vector(" ".join(oov))
+            )
+        )
+
     def gen_test_newline_predict_sentence(self, kwargs):
         f = build_supervised_model(get_random_data(100), kwargs)
         sentence = " ".join(get_random_words(20))
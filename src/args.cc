@@ -33,16 +33,23 @@ Args::Args() {
   maxn = 6;
   thread = 12;
   lrUpdateRate = 100;
+  batchSize = 1;
   t = 1e-4;
   label = "__label__";
   verbose = 2;
   pretrainedVectors = "";
+  vocabFile = "";
+  vocabInput = "";
+  subwordCache = 1 << 16;
+  lineIndexCache = true;
   saveOutput = false;
   seed = 0;
 
   qout = false;
   retrain = false;
   qnorm = false;
+  opq = false;
+  int8 = false;
   cutoff = 0;
   dsub = 2;
 
@@ -138,6 +145,8 @@ void Args::parseArgs(const std::vector<std::string>& args) {
         lr = std::stof(args.at(ai + 1));
       } else if (args[ai] == "-lrUpdateRate") {
         lrUpdateRate = std::stoi(args.at(ai + 1));
+      } else if (args[ai] == "-batchSize") {
+        batchSize = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-dim") {
         dim = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-ws") {
@@ -183,6 +192,15 @@ void Args::parseArgs(const std::vector<std::string>& args) {
         verbose = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-pretrainedVectors") {
         pretrainedVectors = std::string(args.at(ai + 1));
+      } else if (args[ai] == "-vocabFile") {
+        vocabFile = std::string(args.at(ai + 1));
+      } else if (args[ai] == "-vocabInput") {
+        vocabInput = std::string(args.at(ai + 1));
+      } else if (args[ai] == "-noLineIndexCache") {
+        lineIndexCache = false;
+        ai--;
+      } else if (args[ai] == "-subwordCache") {
+        subwordCache = std::stoi(args.at(ai + 1));
       } else if (args[ai] == "-saveOutput") {
         saveOutput = true;
         ai--;
@@ -191,6 +209,12 @@ void Args::parseArgs(const std::vector<std::string>& args) {
       } else if (args[ai] == "-qnorm") {
         qnorm = true;
         ai--;
+      } else if (args[ai] == "-opq") {
+        opq = true;
+        ai--;
+      } else if (args[ai] == "-int8") {
+        int8 = true;
+        ai--;
       } else if (args[ai] == "-retrain") {
         retrain = true;
         ai--;
@@ -244,7 +268,8 @@ void Args::printHelp() {
 
 void Args::printBasicHelp() {
   std::cerr << "\nThe following arguments are mandatory:\n"
-            << "  -input              training file path\n"
+            << "  -input              training file path (text, zstd or "
+               "gzip), or - to stream from stdin\n"
             << "  -output             output file path\n"
             << "\nThe following arguments are optional:\n"
             << "  -verbose            verbosity level [" << verbose << "]\n";
@@ -264,7 +289,16 @@ void Args::printDictionaryHelp() {
             << "  -maxn               max length of char ngram [" << maxn
             << "]\n"
             << "  -t                  sampling threshold [" << t << "]\n"
-            << "  -label              labels prefix [" << label << "]\n";
+            << "  -label              labels prefix [" << label << "]\n"
+            << "  -vocabFile          vocabulary in the format of `dump dict`, "
+               "instead of a pass over the input ["
+            << vocabFile << "]\n"
+            << "  -vocabInput         corpus to build the vocabulary from, "
+               "instead of the input, e.g. a pipe ["
+            << vocabInput << "]\n"
+            << "  -subwordCache       out-of-vocabulary words whose subwords "
+               "are cached, 0 to disable ["
+            << subwordCache << "]\n";
 }
 
 void Args::printTrainingHelp() {
@@ -283,6 +317,12 @@ void Args::printTrainingHelp() {
       << "  -thread             number of threads (set to 1 to ensure "
          "reproducible results) ["
       << thread << "]\n"
+      << "  -noLineIndexCache   do not cache the line starts of the input "
+         "in <input>.ftidx ["
+      << boolToString(!lineIndexCache) << "]\n"
+      << "  -batchSize          examples per minibatch update, 1 updates the "
+         "model after every example ["
+      << batchSize << "]\n"
       << "  -pretrainedVectors  pretrained word vectors for supervised "
          "learning ["
       << pretrainedVectors << "]\n"
@@ -317,6 +357,12 @@ void Args::printQuantizationHelp() {
       << boolToString(retrain) << "]\n"
       << "  -qnorm              whether the norm is quantized separately ["
       << boolToString(qnorm) << "]\n"
+      << "  -opq                whether the vectors are rotated before they "
+         "are quantized ["
+      << boolToString(opq) << "]\n"
+      << "  -int8               whether rows are stored as 8-bit integers "
+         "instead of codes ["
+      << boolToString(int8) << "]\n"
       << "  -qout               whether the classifier is quantized ["
       << boolToString(qout) << "]\n"
       << "  -dsub               size of each sub-vector [" << dsub << "]\n";
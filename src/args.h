@@ -40,6 +40,7 @@ class Args {
   std::string output;
   double lr;
   int lrUpdateRate;
+  int batchSize;
   int dim;
   int ws;
   int epoch;
@@ -57,12 +58,18 @@ class Args {
   std::string label;
   int verbose;
   std::string pretrainedVectors;
+  std::string vocabFile;
+  std::string vocabInput;
+  int subwordCache;
+  bool lineIndexCache;
   bool saveOutput;
   int seed;
 
   bool qout;
   bool retrain;
   bool qnorm;
+  bool opq;
+  bool int8;
   size_t cutoff;
   size_t dsub;
 
@@ -0,0 +1,537 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "compressedfile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+#ifdef FASTTEXT_USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef FASTTEXT_USE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace fasttext {
+
+namespace {
+
+constexpr uint32_t ZSTD_FRAME_MAGIC = 0xFD2FB528;
+constexpr uint32_t SKIPPABLE_FRAME_MAGIC = 0x184D2A50;
+constexpr uint32_t SKIPPABLE_FRAME_MASK = 0xFFFFFFF0;
+constexpr uint32_t SEEKABLE_MAGIC = 0x8F92EAB1;
+constexpr int64_t SKIPPABLE_HEADER_SIZE = 8;
+constexpr int64_t SEEK_TABLE_FOOTER_SIZE = 9;
+
+constexpr int64_t GZIP_WINDOW_SIZE = 1 << 15;
+// A gzip file gets at most about GZIP_MAX_POINTS access points, so that the
+// index of a large corpus stays small, spaced by at least GZIP_MIN_SPAN
+// compressed bytes.
+constexpr int64_t GZIP_MAX_POINTS = 256;
+constexpr int64_t GZIP_MIN_SPAN = 1 << 16;
+// zlib counts input bytes with 32 bit integers.
+constexpr int64_t ZLIB_CHUNK_SIZE = 1 << 30;
+
+constexpr int64_t DECODE_BUFFER_SIZE = 1 << 20;
+
+uint32_t readU32(const char* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(uint32_t));
+  return v;
+}
+
+bool isGzip(const char* p, int64_t size) {
+  return size >= 2 && static_cast<unsigned char>(p[0]) == 0x1f &&
+      static_cast<unsigned char>(p[1]) == 0x8b;
+}
+
+bool isZstd(const char* p, int64_t size) {
+  if (size < 4) {
+    return false;
+  }
+  uint32_t magic = readU32(p);
+  return magic == ZSTD_FRAME_MAGIC ||
+      (magic & SKIPPABLE_FRAME_MASK) == SKIPPABLE_FRAME_MAGIC;
+}
+
+} // namespace
+
+class CompressedBuffer::Decoder {
+ public:
+  virtual ~Decoder() = default;
+  // Restarts decoding at block begin, up to the start of block end.
+  virtual void start(int64_t begin, int64_t end) = 0;
+  // Decodes up to n bytes into out. Returns 0 at the end of the range.
+  virtual size_t read(char* out, size_t n) = 0;
+  // Extends the range to the end of the file. Returns false if it already
+  // ends there.
+  virtual bool extend() = 0;
+};
+
+#ifdef FASTTEXT_USE_ZSTD
+
+namespace {
+
+class ZstdDecoder : public CompressedBuffer::Decoder {
+ public:
+  explicit ZstdDecoder(const CompressedFile& file)
+      : file_(file),
+        dctx_(ZSTD_createDCtx()),
+        pending_(0),
+        begin_(0),
+        end_(0) {
+    if (dctx_ == nullptr) {
+      throw std::bad_alloc();
+    }
+  }
+
+  ~ZstdDecoder() {
+    ZSTD_freeDCtx(dctx_);
+  }
+
+  void start(int64_t begin, int64_t end) override {
+    ZSTD_DCtx_reset(dctx_, ZSTD_reset_session_only);
+    input_.src = file_.data() + file_.offset(begin);
+    input_.size = file_.offset(end) - file_.offset(begin);
+    input_.pos = 0;
+    pending_ = 0;
+    begin_ = begin;
+    end_ = end;
+  }
+
+  size_t read(char* out, size_t n) override {
+    ZSTD_outBuffer output = {out, n, 0};
+    // pending_ is 0 when the last frame was completely decoded and flushed
+    while (output.pos < output.size &&
+           (input_.pos < input_.size || pending_ != 0)) {
+      size_t in = input_.pos;
+      size_t produced = output.pos;
+      pending_ = ZSTD_decompressStream(dctx_, &output, &input_);
+      if (ZSTD_isError(pending_)) {
+        throw std::runtime_error(
+            std::string("Cannot decode zstd corpus: ") +
+            ZSTD_getErrorName(pending_));
+      }
+      if (input_.pos == in && output.pos == produced) {
+        throw std::runtime_error("Cannot decode zstd corpus: truncated.");
+      }
+    }
+    return output.pos;
+  }
+
+  bool extend() override {
+    if (end_ == file_.nblocks()) {
+      return false;
+    }
+    input_.size = file_.size() - file_.offset(begin_);
+    end_ = file_.nblocks();
+    return true;
+  }
+
+ private:
+  const CompressedFile& file_;
+  ZSTD_DCtx* dctx_;
+  ZSTD_inBuffer input_;
+  size_t pending_;
+  int64_t begin_;
+  int64_t end_;
+};
+
+} // namespace
+
+#endif
+
+#ifdef FASTTEXT_USE_ZLIB
+
+namespace {
+
+class GzipDecoder : public CompressedBuffer::Decoder {
+ public:
+  explicit GzipDecoder(const CompressedFile& file)
+      : file_(file), raw_(false), remaining_(-1), end_(0), done_(false) {
+    std::memset(&strm_, 0, sizeof(strm_));
+    if (inflateInit2(&strm_, 15 + 16) != Z_OK) {
+      throw std::bad_alloc();
+    }
+  }
+
+  ~GzipDecoder() {
+    inflateEnd(&strm_);
+  }
+
+  void start(int64_t begin, int64_t end) override {
+    const CompressedFile::access_point& point = file_.point(begin);
+    const unsigned char* data = bytes();
+    if (point.window.empty()) {
+      inflateReset2(&strm_, 15 + 16);
+      raw_ = false;
+    } else {
+      inflateReset2(&strm_, -15);
+      raw_ = true;
+      if (point.bits > 0) {
+        int c = data[point.in - 1];
+        inflatePrime(&strm_, point.bits, c >> (8 - point.bits));
+      }
+      inflateSetDictionary(&strm_, point.window.data(), point.window.size());
+    }
+    setInput(data + point.in);
+    remaining_ =
+        end < file_.nblocks() ? file_.point(end).out - point.out : -1;
+    end_ = end;
+    done_ = false;
+  }
+
+  size_t read(char* out, size_t n) override {
+    if (remaining_ >= 0) {
+      n = std::min(n, static_cast<size_t>(remaining_));
+    }
+    strm_.next_out = reinterpret_cast<unsigned char*>(out);
+    strm_.avail_out = n;
+    while (strm_.avail_out > 0 && !done_) {
+      if (strm_.avail_in == 0) {
+        setInput(strm_.next_in);
+        if (strm_.avail_in == 0) {
+          throw std::runtime_error("Cannot decode gzip corpus: truncated.");
+        }
+      }
+      int ret = inflate(&strm_, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END) {
+        nextMember();
+      } else if (ret != Z_OK) {
+        throw std::runtime_error(
+            std::string("Cannot decode gzip corpus: ") +
+            (strm_.msg ? strm_.msg : "corrupted data."));
+      }
+    }
+    size_t produced = n - strm_.avail_out;
+    if (remaining_ >= 0) {
+      remaining_ -= produced;
+    }
+    return produced;
+  }
+
+  bool extend() override {
+    if (end_ == file_.nblocks()) {
+      return false;
+    }
+    remaining_ = -1;
+    end_ = file_.nblocks();
+    return true;
+  }
+
+ private:
+  const CompressedFile& file_;
+  z_stream strm_;
+  bool raw_;
+  int64_t remaining_;
+  int64_t end_;
+  bool done_;
+
+  const unsigned char* bytes() const {
+    return reinterpret_cast<const unsigned char*>(file_.data());
+  }
+
+  void setInput(const unsigned char* next) {
+    int64_t left = bytes() + file_.size() - next;
+    strm_.next_in = const_cast<unsigned char*>(next);
+    strm_.avail_in = std::max(int64_t(0), std::min(left, ZLIB_CHUNK_SIZE));
+  }
+
+  // Continues with the next member of a multi-member file, if any.
+  void nextMember() {
+    const unsigned char* next = strm_.next_in;
+    if (raw_) {
+      // skip the CRC32 and ISIZE trailer that inflate only reads in gzip mode
+      next += 8;
+    }
+    const unsigned char* end = bytes() + file_.size();
+    if (next >= end ||
+        !isGzip(reinterpret_cast<const char*>(next), end - next)) {
+      done_ = true;
+      return;
+    }
+    inflateReset2(&strm_, 15 + 16);
+    raw_ = false;
+    setInput(next);
+  }
+};
+
+} // namespace
+
+#endif
+
+CompressedFile::CompressedFile(const std::string& filename)
+    : file_(std::make_shared<MappedFile>(filename)) {
+  if (isZstd(data(), size())) {
+    format_ = format::zstd;
+#ifdef FASTTEXT_USE_ZSTD
+    if (!readSeekTable()) {
+      findFrames();
+    }
+#else
+    throw std::invalid_argument(
+        filename + " is zstd compressed, but fastText was built without zstd.");
+#endif
+  } else if (isGzip(data(), size())) {
+    format_ = format::gzip;
+#ifdef FASTTEXT_USE_ZLIB
+    buildIndex();
+#else
+    throw std::invalid_argument(
+        filename + " is gzip compressed, but fastText was built without zlib.");
+#endif
+  } else {
+    throw std::invalid_argument(filename + " is not a zstd or gzip file!");
+  }
+}
+
+bool CompressedFile::isCompressed(const std::string& filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  char magic[4];
+  ifs.read(magic, sizeof(magic));
+  return isZstd(magic, ifs.gcount()) || isGzip(magic, ifs.gcount());
+}
+
+int64_t CompressedFile::findBlock(int64_t pos) const {
+  int64_t i = std::lower_bound(offsets_.begin(), offsets_.end(), pos) -
+      offsets_.begin();
+  return std::min(i, nblocks());
+}
+
+std::vector<int64_t> CompressedFile::shards(int32_t n) const {
+  std::vector<int64_t> shards(1, 0);
+  for (int32_t i = 1; i < n; i++) {
+    int64_t block = findBlock(i * size() / n);
+    if (block > shards.back() && block < nblocks()) {
+      shards.push_back(block);
+    }
+  }
+  shards.push_back(nblocks());
+  return shards;
+}
+
+// Reads the frame sizes from the seek table that the zstd seekable format
+// appends to the file in a skippable frame, without touching the frames.
+bool CompressedFile::readSeekTable() {
+  if (size() < SKIPPABLE_HEADER_SIZE + SEEK_TABLE_FOOTER_SIZE ||
+      readU32(data() + size() - 4) != SEEKABLE_MAGIC) {
+    return false;
+  }
+  int64_t nframes = readU32(data() + size() - SEEK_TABLE_FOOTER_SIZE);
+  bool checksums = data()[size() - 5] & 0x80;
+  int64_t entrySize = checksums ? 12 : 8;
+  int64_t tableSize =
+      SKIPPABLE_HEADER_SIZE + nframes * entrySize + SEEK_TABLE_FOOTER_SIZE;
+  if (nframes == 0 || tableSize > size()) {
+    return false;
+  }
+  const char* table = data() + size() - tableSize;
+  if ((readU32(table) & SKIPPABLE_FRAME_MASK) != SKIPPABLE_FRAME_MAGIC ||
+      readU32(table + 4) != tableSize - SKIPPABLE_HEADER_SIZE) {
+    return false;
+  }
+  offsets_.assign(1, 0);
+  for (int64_t i = 0; i < nframes; i++) {
+    const char* entry = table + SKIPPABLE_HEADER_SIZE + i * entrySize;
+    offsets_.push_back(offsets_.back() + readU32(entry));
+  }
+  if (offsets_.back() != size() - tableSize) {
+    offsets_.clear();
+    return false;
+  }
+  // the last frame is decoded together with the seek table
+  offsets_.back() = size();
+  return true;
+}
+
+#ifdef FASTTEXT_USE_ZSTD
+
+void CompressedFile::findFrames() {
+  offsets_.assign(1, 0);
+  while (offsets_.back() < size()) {
+    int64_t pos = offsets_.back();
+    size_t n = ZSTD_findFrameCompressedSize(data() + pos, size() - pos);
+    if (ZSTD_isError(n)) {
+      throw std::invalid_argument(
+          std::string("Invalid zstd file: ") + ZSTD_getErrorName(n));
+    }
+    offsets_.push_back(pos + n);
+  }
+}
+
+#endif
+
+#ifdef FASTTEXT_USE_ZLIB
+
+// Decodes the whole file once and records an access point at the end of a
+// deflate block every span compressed bytes, with the 32KB of output that the
+// following blocks may refer to.
+void CompressedFile::buildIndex() {
+  const unsigned char* begin = reinterpret_cast<const unsigned char*>(data());
+  const unsigned char* end = begin + size();
+  std::vector<unsigned char> window(GZIP_WINDOW_SIZE);
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, 15 + 16) != Z_OK) {
+    throw std::bad_alloc();
+  }
+  points_.push_back(access_point{0, 0, 0, {}});
+  offsets_.assign(1, 0);
+  strm.next_in = const_cast<unsigned char*>(begin);
+  const int64_t span = std::max(GZIP_MIN_SPAN, size() / GZIP_MAX_POINTS);
+  int64_t out = 0;
+  while (true) {
+    if (strm.avail_in == 0) {
+      strm.avail_in = std::min(int64_t(end - strm.next_in), ZLIB_CHUNK_SIZE);
+    }
+    if (strm.avail_out == 0) {
+      strm.next_out = window.data();
+      strm.avail_out = window.size();
+    }
+    uInt avail = strm.avail_out;
+    int ret = inflate(&strm, Z_BLOCK);
+    out += avail - strm.avail_out;
+    if (ret == Z_STREAM_END) {
+      const unsigned char* next = strm.next_in;
+      if (!isGzip(reinterpret_cast<const char*>(next), end - next)) {
+        break;
+      }
+      inflateReset(&strm);
+      strm.avail_in = 0;
+      points_.push_back(access_point{next - begin, out, 0, {}});
+      offsets_.push_back(next - begin);
+      continue;
+    }
+    if (ret != Z_OK || (strm.avail_in == 0 && strm.next_in == end)) {
+      std::string msg = strm.msg ? strm.msg : "truncated.";
+      inflateEnd(&strm);
+      throw std::invalid_argument("Invalid gzip file: " + msg);
+    }
+    bool blockEnd = (strm.data_type & 128) && !(strm.data_type & 64);
+    if (blockEnd && strm.next_in - begin - offsets_.back() > span) {
+      access_point point{strm.next_in - begin, out, strm.data_type & 7, {}};
+      // the window is a circular buffer whose oldest byte is at next_out
+      size_t left = strm.avail_out;
+      point.window.insert(
+          point.window.end(), window.end() - left, window.end());
+      point.window.insert(
+          point.window.end(), window.begin(), window.end() - left);
+      points_.push_back(std::move(point));
+      offsets_.push_back(points_.back().in);
+    }
+  }
+  inflateEnd(&strm);
+  offsets_.push_back(size());
+}
+
+#endif
+
+CompressedBuffer::CompressedBuffer(
+    std::shared_ptr<const CompressedFile> file,
+    int64_t begin,
+    int64_t end)
+    : file_(file), buffer_(DECODE_BUFFER_SIZE), begin_(begin), end_(end) {
+#ifdef FASTTEXT_USE_ZSTD
+  if (file_->getFormat() == CompressedFile::format::zstd) {
+    decoder_.reset(new ZstdDecoder(*file_));
+  }
+#endif
+#ifdef FASTTEXT_USE_ZLIB
+  if (file_->getFormat() == CompressedFile::format::gzip) {
+    decoder_.reset(new GzipDecoder(*file_));
+  }
+#endif
+  if (!decoder_) {
+    throw std::invalid_argument("Unsupported compressed file.");
+  }
+  start();
+}
+
+CompressedBuffer::~CompressedBuffer() {}
+
+void CompressedBuffer::start() {
+  decoder_->start(begin_, end_);
+  skipLine_ = begin_ > 0;
+  tail_ = false;
+  done_ = false;
+  setg(buffer_.data(), buffer_.data(), buffer_.data());
+}
+
+size_t CompressedBuffer::fill() {
+  while (!done_) {
+    size_t n = decoder_->read(buffer_.data(), buffer_.size());
+    if (n == 0) {
+      // A range without a newline owns no line.
+      if (tail_ || skipLine_ || !decoder_->extend()) {
+        done_ = true;
+        break;
+      }
+      tail_ = true;
+      continue;
+    }
+    char* begin = buffer_.data();
+    char* end = begin + n;
+    if (skipLine_) {
+      char* newline = static_cast<char*>(std::memchr(begin, '\n', n));
+      if (newline == nullptr) {
+        continue;
+      }
+      skipLine_ = false;
+      begin = newline + 1;
+    }
+    if (tail_) {
+      char* newline =
+          static_cast<char*>(std::memchr(begin, '\n', end - begin));
+      if (newline != nullptr) {
+        end = newline + 1;
+        done_ = true;
+      }
+    }
+    if (begin < end) {
+      setg(begin, begin, end);
+      return end - begin;
+    }
+  }
+  return 0;
+}
+
+CompressedBuffer::int_type CompressedBuffer::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+  if (fill() == 0) {
+    return traits_type::eof();
+  }
+  return traits_type::to_int_type(*gptr());
+}
+
+CompressedBuffer::pos_type CompressedBuffer::seekoff(
+    off_type off,
+    std::ios_base::seekdir dir,
+    std::ios_base::openmode which) {
+  if (dir == std::ios_base::beg) {
+    return seekpos(pos_type(off), which);
+  }
+  return pos_type(off_type(-1));
+}
+
+CompressedBuffer::pos_type CompressedBuffer::seekpos(
+    pos_type pos,
+    std::ios_base::openmode which) {
+  if (pos != pos_type(0) || !(which & std::ios_base::in)) {
+    return pos_type(off_type(-1));
+  }
+  start();
+  return pos;
+}
+
+} // namespace fasttext
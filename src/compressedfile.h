@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "mappedfile.h"
+
+namespace fasttext {
+
+// A zstd or gzip compressed corpus, read in place through a memory mapping.
+//
+// The file is cut into blocks at which decoding can start: the frames of a
+// zstd file, as listed by the seek table of the seekable format or found by
+// walking the frame headers, and the access points of an index built over a
+// gzip file in one decoding pass, as in zlib's zran example. A file made of a
+// single zstd frame has a single block and is read by a single thread.
+class CompressedFile {
+ public:
+  enum class format { zstd, gzip };
+
+  // A point of a gzip file where decoding can start. The first point of
+  // each gzip member has an empty window; the others are in the middle of
+  // a deflate stream, `bits` bits before the byte at offset `in`.
+  struct access_point {
+    int64_t in;
+    int64_t out;
+    int32_t bits;
+    std::vector<unsigned char> window;
+  };
+
+  explicit CompressedFile(const std::string& filename);
+
+  // Whether the file starts with the magic number of a zstd or gzip stream.
+  static bool isCompressed(const std::string& filename);
+
+  format getFormat() const {
+    return format_;
+  }
+
+  int64_t size() const {
+    return file_->size();
+  }
+
+  const char* data() const {
+    return file_->data();
+  }
+
+  int64_t nblocks() const {
+    return offsets_.size() - 1;
+  }
+
+  // Compressed offset of block i; offset(nblocks()) is the file size.
+  int64_t offset(int64_t i) const {
+    return offsets_[i];
+  }
+
+  const access_point& point(int64_t i) const {
+    return points_[i];
+  }
+
+  // First block that starts at or after the compressed offset pos.
+  int64_t findBlock(int64_t pos) const;
+
+  // Splits the blocks into at most n ranges of similar compressed size.
+  // Returns the boundaries, from 0 to nblocks().
+  std::vector<int64_t> shards(int32_t n) const;
+
+ private:
+  std::shared_ptr<const MappedFile> file_;
+  format format_;
+  std::vector<int64_t> offsets_;
+  std::vector<access_point> points_;
+
+  bool readSeekTable();
+  void findFrames();
+  void buildIndex();
+};
+
+// Read-only stream buffer over the lines that start in blocks [begin, end)
+// of a compressed file, so that several threads can each decode their own
+// part of a corpus through an std::istream. A line belongs to the range in
+// which the newline before it is found: a range that does not start the file
+// skips its first, partial line, and the last line of a range is read past
+// its end. Seeking to 0 restarts the range, so that a training thread rewound
+// by Dictionary::reset loops over its own shard.
+class CompressedBuffer : public std::streambuf {
+ public:
+  class Decoder;
+
+  CompressedBuffer(
+      std::shared_ptr<const CompressedFile> file,
+      int64_t begin,
+      int64_t end);
+  ~CompressedBuffer();
+
+ protected:
+  int_type underflow() override;
+  pos_type seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode)
+      override;
+  pos_type seekpos(pos_type, std::ios_base::openmode) override;
+
+ private:
+  std::shared_ptr<const CompressedFile> file_;
+  std::unique_ptr<Decoder> decoder_;
+  std::vector<char> buffer_;
+  int64_t begin_;
+  int64_t end_;
+  bool skipLine_;
+  bool tail_;
+  bool done_;
+
+  void start();
+  size_t fill();
+};
+
+} // namespace fasttext
@@ -8,10 +8,12 @@
 
 #include "densematrix.h"
 
+#include <algorithm>
 #include <random>
 #include <stdexcept>
 #include <thread>
 #include <utility>
+#include "kernels.h"
 #include "utils.h"
 #include "vector.h"
 
@@ -88,10 +90,8 @@ void DenseMatrix::divideRow(const Vector& denoms, int64_t ib, int64_t ie) {
 }
 
 real DenseMatrix::l2NormRow(int64_t i) const {
-  auto norm = 0.0;
-  for (auto j = 0; j < n_; j++) {
-    norm += at(i, j) * at(i, j);
-  }
+  const real* row = data_.data() + i * n_;
+  double norm = kernels::sumSquares(row, n_);
   if (std::isnan(norm)) {
     throw EncounteredNaNError();
   }
@@ -109,10 +109,7 @@ real DenseMatrix::dotRow(const Vector& vec, int64_t i) const {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  real d = 0.0;
-  for (int64_t j = 0; j < n_; j++) {
-    d += at(i, j) * vec[j];
-  }
+  real d = kernels::dot(data_.data() + i * n_, vec.data(), n_);
   if (std::isnan(d)) {
     throw EncounteredNaNError();
   }
@@ -123,26 +120,55 @@ void DenseMatrix::addVectorToRow(const Vector& vec, int64_t i, real a) {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  for (int64_t j = 0; j < n_; j++) {
-    data_[i * n_ + j] += a * vec[j];
-  }
+  kernels::axpy(a, vec.data(), data_.data() + i * n_, n_);
 }
 
 void DenseMatrix::addRowToVector(Vector& x, int32_t i) const {
   assert(i >= 0);
   assert(i < this->size(0));
   assert(x.size() == this->size(1));
-  for (int64_t j = 0; j < n_; j++) {
-    x[j] += at(i, j);
-  }
+  kernels::axpy(1.0, data_.data() + i * n_, x.data(), n_);
 }
 
 void DenseMatrix::addRowToVector(Vector& x, int32_t i, real a) const {
   assert(i >= 0);
   assert(i < this->size(0));
   assert(x.size() == this->size(1));
-  for (int64_t j = 0; j < n_; j++) {
-    x[j] += a * at(i, j);
+  kernels::axpy(a, data_.data() + i * n_, x.data(), n_);
+}
+
+void DenseMatrix::dotRows(const DenseMatrix& x, DenseMatrix& out, int64_t n)
+    const {
+  assert(x.cols() == n_);
+  assert(out.cols() == m_);
+  assert(n <= x.rows() && n <= out.rows());
+  if (!kernels::dotRows(data_.data(), m_, n_, x.data(), n, out.data())) {
+    throw EncounteredNaNError();
+  }
+}
+
+void DenseMatrix::addRowsToMatrix(
+    const DenseMatrix& coeffs,
+    DenseMatrix& x,
+    int64_t n) const {
+  assert(x.cols() == n_);
+  assert(coeffs.cols() == m_);
+  assert(n <= x.rows() && n <= coeffs.rows());
+  kernels::addRows(data_.data(), m_, n_, coeffs.data(), n, x.data());
+}
+
+void DenseMatrix::addMatrixToRows(
+    const DenseMatrix& coeffs,
+    const DenseMatrix& x,
+    int64_t n) {
+  assert(x.cols() == n_);
+  assert(coeffs.cols() == m_);
+  assert(n <= x.rows() && n <= coeffs.rows());
+  for (int64_t i = 0; i < m_; i++) {
+    real* row = data_.data() + i * n_;
+    for (int64_t b = 0; b < n; b++) {
+      kernels::axpy(coeffs.at(b, i), x.data() + b * n_, row, n_);
+    }
   }
 }
 
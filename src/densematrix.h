@@ -71,6 +71,14 @@ class DenseMatrix : public Matrix {
   void addVectorToRow(const Vector&, int64_t, real) override;
   void addRowToVector(Vector& x, int32_t i) const override;
   void addRowToVector(Vector& x, int32_t i, real a) const override;
+  void dotRows(const DenseMatrix& x, DenseMatrix& out, int64_t n)
+      const override;
+  void addRowsToMatrix(const DenseMatrix& coeffs, DenseMatrix& x, int64_t n)
+      const override;
+  void addMatrixToRows(
+      const DenseMatrix& coeffs,
+      const DenseMatrix& x,
+      int64_t n) override;
   void save(std::ostream&) const override;
   void load(std::istream&) override;
   void dump(std::ostream&) const override;
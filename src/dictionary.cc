@@ -12,62 +12,195 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <numeric>
 #include <stdexcept>
+#include <thread>
+
+#include "utils.h"
 
 namespace fasttext {
 
+namespace {
+
+// Shards smaller than this are not worth a thread of their own.
+constexpr int64_t MIN_SHARD_SIZE = 1 << 20;
+
+// Token counts of one shard of the corpus, with the words in the order of
+// their first occurrence so that merging the shards in file order gives the
+// same vocabulary order as a serial pass. Each thread fills its own shard,
+// so that counting takes no lock, and the hashes of the words are kept for
+// the merge.
+struct ShardCounts {
+  std::vector<std::string> words;
+  std::vector<uint32_t> hashes;
+  std::vector<int64_t> counts;
+  WordTable table;
+  int64_t ntokens = 0;
+  // Sparse line starts, relative to the start of the shard, with the tokens
+  // before them, when the lines are indexed.
+  std::vector<int64_t> lineOffsets;
+  std::vector<int64_t> lineTokens;
+
+  void add(string_view w, uint32_t h) {
+    ntokens++;
+    int32_t i = table.find(h, [&](int32_t j) { return words[j] == w; });
+    if (i < 0) {
+      table.insert(h, words.size());
+      words.push_back(w.str());
+      hashes.push_back(h);
+      counts.push_back(1);
+    } else {
+      counts[i]++;
+    }
+  }
+};
+
+std::unique_ptr<SubwordCache> makeSubwordCache(const Args& args) {
+  if (args.subwordCache <= 0 || args.maxn <= 0) {
+    return nullptr;
+  }
+  return std::unique_ptr<SubwordCache>(new SubwordCache(args.subwordCache));
+}
+
+// Offsets of the subwords of n words, read from a model file.
+void checkOffsets(const int64_t* offsets, int32_t n) {
+  bool valid = offsets[0] == 0;
+  for (int32_t i = 0; valid && i < n; i++) {
+    valid = offsets[i] <= offsets[i + 1];
+  }
+  if (!valid) {
+    throw std::invalid_argument("Invalid model file: corrupt subword index.");
+  }
+}
+
+// Subword ids of n words read from a model file: rows of a matrix of nrows
+// rows, or the id of the word itself, which labels also have.
+void checkIds(
+    const int64_t* offsets,
+    const int32_t* ids,
+    int32_t n,
+    int64_t nrows) {
+  for (int32_t i = 0; i < n; i++) {
+    for (int64_t j = offsets[i]; j < offsets[i + 1]; j++) {
+      if ((ids[j] < 0 || ids[j] >= nrows) && ids[j] != i) {
+        throw std::invalid_argument(
+            "Invalid model file: corrupt subword index.");
+      }
+    }
+  }
+}
+
+} // namespace
+
 const std::string Dictionary::EOS = "</s>";
 const std::string Dictionary::BOW = "<";
 const std::string Dictionary::EOW = ">";
 
 Dictionary::Dictionary(std::shared_ptr<Args> args)
     : args_(args),
-      word2int_(MAX_VOCAB_SIZE, -1),
+      wordOffsets_(1, 0),
+      offsets_(nullptr),
+      subwords_(nullptr),
+      subwordCache_(makeSubwordCache(*args)),
       size_(0),
       nwords_(0),
       nlabels_(0),
       ntokens_(0),
       pruneidx_size_(-1) {}
 
-Dictionary::Dictionary(std::shared_ptr<Args> args, std::istream& in)
+Dictionary::Dictionary(
+    std::shared_ptr<Args> args,
+    std::istream& in,
+    index_layout layout,
+    std::shared_ptr<const MappedFile> file)
     : args_(args),
+      wordOffsets_(1, 0),
+      offsets_(nullptr),
+      subwords_(nullptr),
+      subwordCache_(makeSubwordCache(*args)),
       size_(0),
       nwords_(0),
       nlabels_(0),
       ntokens_(0),
       pruneidx_size_(-1) {
-  load(in);
+  load(in, layout, file);
+}
+
+string_view Dictionary::wordView(int32_t i) const {
+  int64_t begin = wordOffsets_[i];
+  return string_view(wordArena_.data() + begin, wordOffsets_[i + 1] - begin);
+}
+
+bool Dictionary::wordEquals(int32_t i, string_view w) const {
+  return wordView(i) == w;
 }
 
-int32_t Dictionary::find(const std::string& w) const {
-  return find(w, hash(w));
+void Dictionary::pushWord(string_view w, int64_t count, entry_type type) {
+  wordArena_.insert(wordArena_.end(), w.begin(), w.end());
+  wordOffsets_.push_back(wordArena_.size());
+  counts_.push_back(count);
+  types_.push_back(type);
 }
 
-int32_t Dictionary::find(const std::string& w, uint32_t h) const {
-  int32_t word2intsize = word2int_.size();
-  int32_t id = h % word2intsize;
-  while (word2int_[id] != -1 && words_[word2int_[id]].word != w) {
-    id = (id + 1) % word2intsize;
+// Adds count occurrences of the word w of hash h.
+void Dictionary::addWord(string_view w, uint32_t h, int64_t count) {
+  int32_t id = getId(w, h);
+  if (id < 0) {
+    pushWord(w, count, getType(w));
+    word2int_.insert(h, size_++);
+  } else {
+    counts_[id] += count;
+  }
+}
+
+// Indexes the words of the vocabulary, which are unique, so that they are
+// inserted without comparing strings.
+void Dictionary::indexWords() {
+  if (subwordCache_) {
+    // The subword ids depend on the vocabulary, and on its pruning.
+    subwordCache_->clear();
+  }
+  word2int_.clear(counts_.size());
+  for (int32_t i = 0; i < counts_.size(); i++) {
+    const char* word = wordArena_.data() + wordOffsets_[i];
+    word2int_.insert(hash(word, wordOffsets_[i + 1] - wordOffsets_[i]), i);
   }
-  return id;
+}
+
+// Keeps the entries listed in order, in that order, and drops the others.
+void Dictionary::reorder(const std::vector<int32_t>& order) {
+  std::vector<char> arena;
+  std::vector<int64_t> offsets(1, 0);
+  std::vector<int64_t> counts;
+  std::vector<entry_type> types;
+  arena.reserve(wordArena_.size());
+  offsets.reserve(order.size() + 1);
+  counts.reserve(order.size());
+  types.reserve(order.size());
+  for (int32_t i : order) {
+    arena.insert(
+        arena.end(),
+        wordArena_.begin() + wordOffsets_[i],
+        wordArena_.begin() + wordOffsets_[i + 1]);
+    offsets.push_back(arena.size());
+    counts.push_back(counts_[i]);
+    types.push_back(types_[i]);
+  }
+  arena.shrink_to_fit();
+  wordArena_.swap(arena);
+  wordOffsets_.swap(offsets);
+  counts_.swap(counts);
+  types_.swap(types);
 }
 
 void Dictionary::add(const std::string& w) {
-  int32_t h = find(w);
   ntokens_++;
-  if (word2int_[h] == -1) {
-    entry e;
-    e.word = w;
-    e.count = 1;
-    e.type = getType(w);
-    words_.push_back(e);
-    word2int_[h] = size_++;
-  } else {
-    words_[word2int_[h]].count++;
-  }
+  addWord(w, hash(w), 1);
 }
 
 int32_t Dictionary::nwords() const {
@@ -82,27 +215,36 @@ int64_t Dictionary::ntokens() const {
   return ntokens_;
 }
 
-const std::vector<int32_t>& Dictionary::getSubwords(int32_t i) const {
+subword_range Dictionary::getSubwords(int32_t i) const {
   assert(i >= 0);
   assert(i < nwords_);
-  return words_[i].subwords;
+  return {subwords_ + offsets_[i], subwords_ + offsets_[i + 1]};
 }
 
-const std::vector<int32_t> Dictionary::getSubwords(
-    const std::string& word) const {
-  int32_t i = getId(word);
-  if (i >= 0) {
-    return getSubwords(i);
-  }
+const std::vector<int32_t> Dictionary::getSubwords(string_view word) const {
   std::vector<int32_t> ngrams;
-  if (word != EOS) {
-    computeSubwords(BOW + word + EOW, ngrams);
-  }
+  getSubwords(word, ngrams);
   return ngrams;
 }
 
+void Dictionary::getSubwords(string_view word, std::vector<int32_t>& ngrams)
+    const {
+  ngrams.clear();
+  const uint32_t h = hash(word);
+  int32_t i = getId(word, h);
+  if (i >= 0) {
+    const subword_range subwords = getSubwords(i);
+    ngrams.assign(subwords.cbegin(), subwords.cend());
+  } else {
+    // The bracketed word is built in a buffer of the thread, so that looking
+    // up a word out of the vocabulary does not allocate once it has grown.
+    static thread_local std::string bracketed;
+    addOovSubwords(ngrams, word, h, bracketed);
+  }
+}
+
 void Dictionary::getSubwords(
-    const std::string& word,
+    string_view word,
     std::vector<int32_t>& ngrams,
     std::vector<std::string>& substrings) const {
   int32_t i = getId(word);
@@ -110,13 +252,21 @@ void Dictionary::getSubwords(
   substrings.clear();
   if (i >= 0) {
     ngrams.push_back(i);
-    substrings.push_back(words_[i].word);
+    substrings.push_back(getWord(i));
   }
   if (word != EOS) {
-    computeSubwords(BOW + word + EOW, ngrams, &substrings);
+    std::string bracketed;
+    bracket(word, bracketed);
+    computeSubwords(bracketed, ngrams, &substrings);
   }
 }
 
+void Dictionary::bracket(string_view word, std::string& bracketed) const {
+  bracketed.assign(BOW);
+  bracketed.append(word.data(), word.size());
+  bracketed.append(EOW);
+}
+
 bool Dictionary::discard(int32_t id, real rand) const {
   assert(id >= 0);
   assert(id < nwords_);
@@ -126,30 +276,28 @@ bool Dictionary::discard(int32_t id, real rand) const {
   return rand > pdiscard_[id];
 }
 
-int32_t Dictionary::getId(const std::string& w, uint32_t h) const {
-  int32_t id = find(w, h);
-  return word2int_[id];
+int32_t Dictionary::getId(string_view w, uint32_t h) const {
+  return word2int_.find(h, [&](int32_t i) { return wordEquals(i, w); });
 }
 
-int32_t Dictionary::getId(const std::string& w) const {
-  int32_t h = find(w);
-  return word2int_[h];
+int32_t Dictionary::getId(string_view w) const {
+  return getId(w, hash(w));
 }
 
 entry_type Dictionary::getType(int32_t id) const {
   assert(id >= 0);
   assert(id < size_);
-  return words_[id].type;
+  return types_[id];
 }
 
-entry_type Dictionary::getType(const std::string& w) const {
-  return (w.find(args_->label) == 0) ? entry_type::label : entry_type::word;
+entry_type Dictionary::getType(string_view w) const {
+  return w.starts_with(args_->label) ? entry_type::label : entry_type::word;
 }
 
 std::string Dictionary::getWord(int32_t id) const {
   assert(id >= 0);
   assert(id < size_);
-  return words_[id].word;
+  return wordView(id).str();
 }
 
 // The correct implementation of fnv should be:
@@ -160,34 +308,46 @@ std::string Dictionary::getWord(int32_t id) const {
 // Since all fasttext models that were already released were trained
 // using signed char, we fixed the hash function to make models
 // compatible whatever compiler is used.
-uint32_t Dictionary::hash(const std::string& str) const {
-  uint32_t h = 2166136261;
-  for (size_t i = 0; i < str.size(); i++) {
-    h = h ^ uint32_t(int8_t(str[i]));
-    h = h * 16777619;
+uint32_t Dictionary::hash(string_view str) const {
+  return hash(str.data(), str.size());
+}
+
+const SubwordCache* Dictionary::getSubwordCache() const {
+  return subwordCache_.get();
+}
+
+uint32_t Dictionary::hash(const char* str, size_t size) const {
+  uint32_t h = utils::FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < size; i++) {
+    h = utils::fnvStep(h, str[i]);
   }
   return h;
 }
 
 void Dictionary::computeSubwords(
-    const std::string& word,
+    string_view word,
     std::vector<int32_t>& ngrams,
     std::vector<std::string>* substrings) const {
+  // The character n-grams starting at i are hashed incrementally: FNV-1a
+  // extends the hash of an n-gram with the bytes of the next character, so
+  // each byte is hashed once per start instead of once per n-gram. They are
+  // only copied out when substrings are requested.
   for (size_t i = 0; i < word.size(); i++) {
-    std::string ngram;
     if ((word[i] & 0xC0) == 0x80) {
       continue;
     }
+    uint32_t h = utils::FNV_OFFSET_BASIS;
     for (size_t j = i, n = 1; j < word.size() && n <= args_->maxn; n++) {
-      ngram.push_back(word[j++]);
+      h = utils::fnvStep(h, word[j]);
+      j++;
       while (j < word.size() && (word[j] & 0xC0) == 0x80) {
-        ngram.push_back(word[j++]);
+        h = utils::fnvStep(h, word[j]);
+        j++;
       }
       if (n >= args_->minn && !(n == 1 && (i == 0 || j == word.size()))) {
-        int32_t h = hash(ngram) % args_->bucket;
-        pushHash(ngrams, h);
+        pushHash(ngrams, h % args_->bucket);
         if (substrings) {
-          substrings->push_back(ngram);
+          substrings->emplace_back(word.data() + i, j - i);
         }
       }
     }
@@ -195,14 +355,23 @@ void Dictionary::computeSubwords(
 }
 
 void Dictionary::initNgrams() {
+  subwordOffsets_.clear();
+  subwordOffsets_.reserve(size_ + 1);
+  subwordIds_.clear();
+  std::string word;
   for (size_t i = 0; i < size_; i++) {
-    std::string word = BOW + words_[i].word + EOW;
-    words_[i].subwords.clear();
-    words_[i].subwords.push_back(i);
-    if (words_[i].word != EOS) {
-      computeSubwords(word, words_[i].subwords);
+    subwordOffsets_.push_back(subwordIds_.size());
+    subwordIds_.push_back(i);
+    if (!wordEquals(i, EOS)) {
+      bracket(wordView(i), word);
+      computeSubwords(word, subwordIds_);
     }
   }
+  subwordOffsets_.push_back(subwordIds_.size());
+  subwordIds_.shrink_to_fit();
+  file_.reset();
+  offsets_ = subwordOffsets_.data();
+  subwords_ = subwordIds_.data();
 }
 
 bool Dictionary::readWord(std::istream& in, std::string& word) const {
@@ -232,10 +401,13 @@ bool Dictionary::readWord(std::istream& in, std::string& word) const {
 }
 
 void Dictionary::readFromFile(std::istream& in) {
-  std::string word;
+  Tokenizer tokenizer(EOS);
+  string_view word;
+  uint32_t h;
   int64_t minThreshold = 1;
-  while (readWord(in, word)) {
-    add(word);
+  while (tokenizer.next(in, word, h)) {
+    ntokens_++;
+    addWord(word, h, 1);
     if (ntokens_ % 1000000 == 0 && args_->verbose > 1) {
       std::cerr << "\rRead " << ntokens_ / 1000000 << "M words" << std::flush;
     }
@@ -244,6 +416,180 @@ void Dictionary::readFromFile(std::istream& in) {
       threshold(minThreshold, minThreshold);
     }
   }
+  finishReading();
+}
+
+// Counts the shards of the file on nthreads threads and merges the counts
+// in file order. The result is identical to readFromFile(std::istream&),
+// unless the vocabulary grows past the size at which the serial pass starts
+// thresholding while reading; in that case the file is read again serially.
+// The line starts of the file are recorded in index, if given, when it is
+// read in shards; it is left empty otherwise.
+void Dictionary::readFromFile(
+    const std::string& filename,
+    int32_t nthreads,
+    LineIndex* index) {
+  if (CompressedFile::isCompressed(filename)) {
+    readFromFile(std::make_shared<const CompressedFile>(filename), nthreads);
+    return;
+  }
+  std::ifstream ifs(filename);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened!");
+  }
+  int64_t maxShards = std::max(int64_t(1), utils::size(ifs) / MIN_SHARD_SIZE);
+  nthreads = std::min(int64_t(nthreads), maxShards);
+  if (nthreads > 1) {
+    const std::vector<int64_t> shards = utils::lineShards(ifs, nthreads);
+    bool counted = readShards(
+        shards,
+        [&](size_t i) {
+          return std::unique_ptr<std::streambuf>(
+              new utils::FileRangeBuffer(filename, shards[i], shards[i + 1]));
+        },
+        index);
+    if (counted) {
+      return;
+    }
+  }
+  utils::seek(ifs, 0);
+  readFromFile(ifs);
+}
+
+// Same as above for a compressed corpus, whose shards are ranges of blocks
+// decoded by each thread.
+void Dictionary::readFromFile(
+    std::shared_ptr<const CompressedFile> file,
+    int32_t nthreads) {
+  int64_t maxShards = std::max(int64_t(1), file->size() / MIN_SHARD_SIZE);
+  nthreads = std::min(int64_t(nthreads), maxShards);
+  if (nthreads > 1) {
+    const std::vector<int64_t> shards = file->shards(nthreads);
+    bool counted = readShards(
+        shards,
+        [&](size_t i) {
+          return std::unique_ptr<std::streambuf>(
+              new CompressedBuffer(file, shards[i], shards[i + 1]));
+        },
+        nullptr);
+    if (counted) {
+      return;
+    }
+  }
+  CompressedBuffer buffer(file, 0, file->nblocks());
+  std::istream in(&buffer);
+  readFromFile(in);
+}
+
+// Counts each of the shards, from shards[i] to shards[i + 1], opened by
+// openShard on a thread of its own. Returns false, with the dictionary
+// cleared, if the vocabulary is too large to be counted without
+// thresholding while reading. The line starts are recorded in index, if
+// given, for shards that are byte ranges of a text file.
+bool Dictionary::readShards(
+    const std::vector<int64_t>& shards,
+    const std::function<std::unique_ptr<std::streambuf>(size_t)>& openShard,
+    LineIndex* index) {
+  const size_t n = shards.size() - 1;
+  std::vector<ShardCounts> shardCounts(n);
+  std::vector<std::exception_ptr> errors(n);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < n; i++) {
+    threads.push_back(std::thread([&, i]() {
+      try {
+        std::unique_ptr<std::streambuf> buffer = openShard(i);
+        std::istream in(buffer.get());
+        ShardCounts& shard = shardCounts[i];
+        Tokenizer tokenizer(EOS);
+        string_view word;
+        uint32_t h;
+        int64_t lastLine = 0;
+        while (tokenizer.next(in, word, h)) {
+          shard.add(word, h);
+          if (index && tokenizer.empty() &&
+              tokenizer.read() - lastLine >= LineIndex::SPAN) {
+            lastLine = tokenizer.read();
+            shard.lineOffsets.push_back(lastLine);
+            shard.lineTokens.push_back(shard.ntokens);
+          }
+        }
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const std::exception_ptr& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  for (const ShardCounts& shard : shardCounts) {
+    ntokens_ += shard.ntokens;
+    for (size_t i = 0; i < shard.words.size(); i++) {
+      addWord(shard.words[i], shard.hashes[i], shard.counts[i]);
+    }
+    if (size_ > 0.75 * MAX_VOCAB_SIZE) {
+      clearWords();
+      return false;
+    }
+  }
+  if (index) {
+    index->reset(shards.back());
+    int64_t ntokens = 0;
+    for (size_t i = 0; i < n; i++) {
+      const ShardCounts& shard = shardCounts[i];
+      index->add(shards[i], ntokens);
+      for (size_t j = 0; j < shard.lineOffsets.size(); j++) {
+        index->add(
+            shards[i] + shard.lineOffsets[j], ntokens + shard.lineTokens[j]);
+      }
+      ntokens += shard.ntokens;
+    }
+    index->finish(ntokens);
+  }
+  if (args_->verbose > 1) {
+    std::cerr << "\rRead " << ntokens_ / 1000000 << "M words" << std::flush;
+  }
+  finishReading();
+  return true;
+}
+
+// Reads the counts written by dump(), e.g. to train on a stream that can
+// only be read once. The counts are thresholded like those of a corpus.
+void Dictionary::readVocabulary(std::istream& in) {
+  int64_t n;
+  if (!(in >> n) || n < 0) {
+    throw std::invalid_argument("Invalid vocabulary file.");
+  }
+  std::string word, type;
+  int64_t count;
+  for (int64_t i = 0; i < n; i++) {
+    if (!(in >> word >> count >> type) || count < 0) {
+      throw std::invalid_argument("Invalid vocabulary file.");
+    }
+    addWord(word, hash(word), count);
+    ntokens_ += count;
+  }
+  finishReading();
+}
+
+void Dictionary::clearWords() {
+  word2int_.clear();
+  wordArena_.clear();
+  wordOffsets_.assign(1, 0);
+  counts_.clear();
+  types_.clear();
+  size_ = 0;
+  nwords_ = 0;
+  nlabels_ = 0;
+  ntokens_ = 0;
+}
+
+void Dictionary::finishReading() {
   threshold(args_->minCount, args_->minCountLabel);
   initTableDiscard();
   initNgrams();
@@ -259,33 +605,34 @@ void Dictionary::readFromFile(std::istream& in) {
 }
 
 void Dictionary::threshold(int64_t t, int64_t tl) {
-  sort(words_.begin(), words_.end(), [](const entry& e1, const entry& e2) {
-    if (e1.type != e2.type) {
-      return e1.type < e2.type;
+  std::vector<int32_t> order(counts_.size());
+  std::iota(order.begin(), order.end(), 0);
+  sort(order.begin(), order.end(), [&](int32_t i1, int32_t i2) {
+    if (types_[i1] != types_[i2]) {
+      return types_[i1] < types_[i2];
     }
-    return e1.count > e2.count;
+    return counts_[i1] > counts_[i2];
   });
-  words_.erase(
+  order.erase(
       remove_if(
-          words_.begin(),
-          words_.end(),
-          [&](const entry& e) {
-            return (e.type == entry_type::word && e.count < t) ||
-                (e.type == entry_type::label && e.count < tl);
+          order.begin(),
+          order.end(),
+          [&](int32_t i) {
+            return (types_[i] == entry_type::word && counts_[i] < t) ||
+                (types_[i] == entry_type::label && counts_[i] < tl);
           }),
-      words_.end());
-  words_.shrink_to_fit();
+      order.end());
+  reorder(order);
+  indexWords();
   size_ = 0;
   nwords_ = 0;
   nlabels_ = 0;
-  std::fill(word2int_.begin(), word2int_.end(), -1);
-  for (auto it = words_.begin(); it != words_.end(); ++it) {
-    int32_t h = find(it->word);
-    word2int_[h] = size_++;
-    if (it->type == entry_type::word) {
+  for (int32_t i = 0; i < counts_.size(); i++) {
+    size_++;
+    if (types_[i] == entry_type::word) {
       nwords_++;
     }
-    if (it->type == entry_type::label) {
+    if (types_[i] == entry_type::label) {
       nlabels_++;
     }
   }
@@ -294,16 +641,16 @@ void Dictionary::threshold(int64_t t, int64_t tl) {
 void Dictionary::initTableDiscard() {
   pdiscard_.resize(size_);
   for (size_t i = 0; i < size_; i++) {
-    real f = real(words_[i].count) / real(ntokens_);
+    real f = real(counts_[i]) / real(ntokens_);
     pdiscard_[i] = std::sqrt(args_->t / f) + args_->t / f;
   }
 }
 
 std::vector<int64_t> Dictionary::getCounts(entry_type type) const {
   std::vector<int64_t> counts;
-  for (auto& w : words_) {
-    if (w.type == type) {
-      counts.push_back(w.count);
+  for (size_t i = 0; i < counts_.size(); i++) {
+    if (types_[i] == type) {
+      counts.push_back(counts_[i]);
     }
   }
   return counts;
@@ -322,19 +669,41 @@ void Dictionary::addWordNgrams(
   }
 }
 
+// Subwords of out-of-vocabulary tokens come from the cache when it has them,
+// and are cached otherwise.
+void Dictionary::addOovSubwords(
+    std::vector<int32_t>& line,
+    string_view token,
+    uint32_t h,
+    std::string& word) const {
+  if (token == EOS) {
+    return;
+  }
+  if (subwordCache_ && subwordCache_->find(token, h, line)) {
+    return;
+  }
+  const size_t start = line.size();
+  bracket(token, word);
+  computeSubwords(word, line);
+  if (subwordCache_) {
+    subwordCache_->insert(
+        token, h, line.data() + start, line.data() + line.size());
+  }
+}
+
 void Dictionary::addSubwords(
     std::vector<int32_t>& line,
-    const std::string& token,
-    int32_t wid) const {
+    string_view token,
+    uint32_t h,
+    int32_t wid,
+    std::string& word) const {
   if (wid < 0) { // out of vocab
-    if (token != EOS) {
-      computeSubwords(BOW + token + EOW, line);
-    }
+    addOovSubwords(line, token, h, word);
   } else {
     if (args_->maxn <= 0) { // in vocab w/o subwords
       line.push_back(wid);
     } else { // in vocab w/ subwords
-      const std::vector<int32_t>& ngrams = getSubwords(wid);
+      const subword_range ngrams = getSubwords(wid);
       line.insert(line.end(), ngrams.cbegin(), ngrams.cend());
     }
   }
@@ -358,8 +727,39 @@ int32_t Dictionary::getLine(
   reset(in);
   words.clear();
   while (readWord(in, token)) {
-    int32_t h = find(token);
-    int32_t wid = word2int_[h];
+    int32_t wid = getId(token);
+    if (wid < 0) {
+      continue;
+    }
+
+    ntokens++;
+    if (getType(wid) == entry_type::word && !discard(wid, uniform(rng))) {
+      words.push_back(wid);
+    }
+    if (ntokens > MAX_LINE_SIZE || token == EOS) {
+      break;
+    }
+  }
+  return ntokens;
+}
+
+int32_t Dictionary::getLine(
+    std::istream& in,
+    std::vector<int32_t>& words,
+    std::minstd_rand& rng,
+    LineBuffers& buffers) const {
+  std::uniform_real_distribution<> uniform(0, 1);
+  Tokenizer& tokenizer = buffers.tokenizer;
+  string_view token;
+  uint32_t h;
+  int32_t ntokens = 0;
+
+  if (tokenizer.empty()) {
+    reset(in);
+  }
+  words.clear();
+  while (tokenizer.next(in, token, h)) {
+    int32_t wid = getId(token, h);
     if (wid < 0) {
       continue;
     }
@@ -379,21 +779,34 @@ int32_t Dictionary::getLine(
     std::istream& in,
     std::vector<int32_t>& words,
     std::vector<int32_t>& labels) const {
-  std::vector<int32_t> word_hashes;
-  std::string token;
+  LineBuffers buffers;
+  return getLine(in, words, labels, buffers);
+}
+
+int32_t Dictionary::getLine(
+    std::istream& in,
+    std::vector<int32_t>& words,
+    std::vector<int32_t>& labels,
+    LineBuffers& buffers) const {
+  std::vector<int32_t>& word_hashes = buffers.hashes;
+  Tokenizer& tokenizer = buffers.tokenizer;
+  string_view token;
+  uint32_t h;
   int32_t ntokens = 0;
 
-  reset(in);
+  if (tokenizer.empty()) {
+    reset(in);
+  }
   words.clear();
   labels.clear();
-  while (readWord(in, token)) {
-    uint32_t h = hash(token);
+  word_hashes.clear();
+  while (tokenizer.next(in, token, h)) {
     int32_t wid = getId(token, h);
     entry_type type = wid < 0 ? getType(token) : getType(wid);
 
     ntokens++;
     if (type == entry_type::word) {
-      addSubwords(words, token, wid);
+      addSubwords(words, token, h, wid, buffers.word);
       word_hashes.push_back(h);
     } else if (type == entry_type::label && wid >= 0) {
       labels.push_back(wid - nwords_);
@@ -425,45 +838,126 @@ std::string Dictionary::getLabel(int32_t lid) const {
     throw std::invalid_argument(
         "Label id is out of range [0, " + std::to_string(nlabels_) + "]");
   }
-  return words_[lid + nwords_].word;
+  return getWord(lid + nwords_);
 }
 
-void Dictionary::save(std::ostream& out) const {
+void Dictionary::getLabel(int32_t lid, std::string& label) const {
+  if (lid < 0 || lid >= nlabels_) {
+    throw std::invalid_argument(
+        "Label id is out of range [0, " + std::to_string(nlabels_) + "]");
+  }
+  const int32_t id = lid + nwords_;
+  label.assign(
+      wordArena_.data() + wordOffsets_[id],
+      wordOffsets_[id + 1] - wordOffsets_[id]);
+}
+
+void Dictionary::save(std::ostream& out, bool index) const {
   out.write((char*)&size_, sizeof(int32_t));
   out.write((char*)&nwords_, sizeof(int32_t));
   out.write((char*)&nlabels_, sizeof(int32_t));
   out.write((char*)&ntokens_, sizeof(int64_t));
   out.write((char*)&pruneidx_size_, sizeof(int64_t));
   for (int32_t i = 0; i < size_; i++) {
-    entry e = words_[i];
-    out.write(e.word.data(), e.word.size() * sizeof(char));
+    out.write(
+        wordArena_.data() + wordOffsets_[i],
+        (wordOffsets_[i + 1] - wordOffsets_[i]) * sizeof(char));
     out.put(0);
-    out.write((char*)&(e.count), sizeof(int64_t));
-    out.write((char*)&(e.type), sizeof(entry_type));
+    out.write((char*)&(counts_[i]), sizeof(int64_t));
+    out.write((char*)&(types_[i]), sizeof(entry_type));
   }
   for (const auto pair : pruneidx_) {
     out.write((char*)&(pair.first), sizeof(int32_t));
     out.write((char*)&(pair.second), sizeof(int32_t));
   }
+  const uint8_t hasIndex = index;
+  out.write((char*)&hasIndex, sizeof(uint8_t));
+  if (index) {
+    saveIndex(out);
+  }
 }
 
-void Dictionary::load(std::istream& in) {
-  words_.clear();
+void Dictionary::saveIndex(std::ostream& out) const {
+  word2int_.save(out);
+
+  utils::writePadding(out, 0);
+  out.write((char*)offsets_, (size_ + 1) * sizeof(int64_t));
+  out.write((char*)subwords_, offsets_[size_] * sizeof(int32_t));
+}
+
+void Dictionary::loadIndex(
+    std::istream& in,
+    std::shared_ptr<const MappedFile> file) {
+  if (subwordCache_) {
+    subwordCache_->clear();
+  }
+  word2int_.load(in, size_);
+
+  // Offsets are checked before they size anything, and ids before they index
+  // rows of the input matrix, so that a corrupt or truncated file is
+  // rejected here rather than read out of bounds later.
+  const int64_t nrows = int64_t(nwords_) + args_->bucket;
+  utils::skipPadding(in);
+  subwordOffsets_.clear();
+  subwordIds_.clear();
+  if (file) {
+    int64_t offset = in.tellg();
+    int64_t offsetsBytes = (size_ + 1) * sizeof(int64_t);
+    if (!in || offset < 0 || offset + offsetsBytes > file->size()) {
+      throw std::invalid_argument("Invalid model file: index out of range.");
+    }
+    offsets_ = reinterpret_cast<const int64_t*>(file->data() + offset);
+    checkOffsets(offsets_, size_);
+    int64_t subwordsBytes = offsets_[size_] * sizeof(int32_t);
+    if (offset + offsetsBytes + subwordsBytes > file->size()) {
+      throw std::invalid_argument("Invalid model file: index out of range.");
+    }
+    subwords_ = reinterpret_cast<const int32_t*>(
+        file->data() + offset + offsetsBytes);
+    in.seekg(offsetsBytes + subwordsBytes, std::ios_base::cur);
+  } else {
+    subwordOffsets_.resize(size_ + 1);
+    in.read((char*)subwordOffsets_.data(), (size_ + 1) * sizeof(int64_t));
+    if (!in) {
+      throw std::invalid_argument("Invalid model file: index out of range.");
+    }
+    checkOffsets(subwordOffsets_.data(), size_);
+    subwordIds_.resize(subwordOffsets_[size_]);
+    in.read((char*)subwordIds_.data(), subwordIds_.size() * sizeof(int32_t));
+    if (!in) {
+      throw std::invalid_argument("Invalid model file: index out of range.");
+    }
+    offsets_ = subwordOffsets_.data();
+    subwords_ = subwordIds_.data();
+  }
+  checkIds(offsets_, subwords_, size_, nrows);
+  file_ = file;
+}
+
+void Dictionary::load(
+    std::istream& in,
+    index_layout layout,
+    std::shared_ptr<const MappedFile> file) {
   in.read((char*)&size_, sizeof(int32_t));
   in.read((char*)&nwords_, sizeof(int32_t));
   in.read((char*)&nlabels_, sizeof(int32_t));
   in.read((char*)&ntokens_, sizeof(int64_t));
   in.read((char*)&pruneidx_size_, sizeof(int64_t));
+  wordArena_.clear();
+  wordOffsets_.assign(1, 0);
+  wordOffsets_.reserve(size_ + 1);
+  counts_.resize(size_);
+  types_.resize(size_);
   for (int32_t i = 0; i < size_; i++) {
     char c;
-    entry e;
     while ((c = in.get()) != 0) {
-      e.word.push_back(c);
+      wordArena_.push_back(c);
     }
-    in.read((char*)&e.count, sizeof(int64_t));
-    in.read((char*)&e.type, sizeof(entry_type));
-    words_.push_back(e);
+    wordOffsets_.push_back(wordArena_.size());
+    in.read((char*)&counts_[i], sizeof(int64_t));
+    in.read((char*)&types_[i], sizeof(entry_type));
   }
+  wordArena_.shrink_to_fit();
   pruneidx_.clear();
   for (int32_t i = 0; i < pruneidx_size_; i++) {
     int32_t first;
@@ -473,12 +967,15 @@ void Dictionary::load(std::istream& in) {
     pruneidx_[first] = second;
   }
   initTableDiscard();
-  initNgrams();
-
-  int32_t word2intsize = std::ceil(size_ / 0.7);
-  word2int_.assign(word2intsize, -1);
-  for (int32_t i = 0; i < size_; i++) {
-    word2int_[find(words_[i].word)] = i;
+  uint8_t hasIndex = 0;
+  if (layout == index_layout::word_table) {
+    in.read((char*)&hasIndex, sizeof(uint8_t));
+  }
+  if (hasIndex) {
+    loadIndex(in, file);
+  } else {
+    indexWords();
+    initNgrams();
   }
 }
 
@@ -509,31 +1006,28 @@ void Dictionary::prune(std::vector<int32_t>& idx) {
   }
   pruneidx_size_ = pruneidx_.size();
 
-  std::fill(word2int_.begin(), word2int_.end(), -1);
-
-  int32_t j = 0;
-  for (int32_t i = 0; i < words_.size(); i++) {
+  std::vector<int32_t> order;
+  for (int32_t i = 0; i < counts_.size(); i++) {
     if (getType(i) == entry_type::label ||
-        (j < words.size() && words[j] == i)) {
-      words_[j] = words_[i];
-      word2int_[find(words_[j].word)] = j;
-      j++;
+        (order.size() < words.size() && words[order.size()] == i)) {
+      order.push_back(i);
     }
   }
+  reorder(order);
   nwords_ = words.size();
   size_ = nwords_ + nlabels_;
-  words_.erase(words_.begin() + size_, words_.end());
+  indexWords();
   initNgrams();
 }
 
 void Dictionary::dump(std::ostream& out) const {
-  out << words_.size() << std::endl;
-  for (auto it : words_) {
+  out << counts_.size() << std::endl;
+  for (int32_t i = 0; i < counts_.size(); i++) {
     std::string entryType = "word";
-    if (it.type == entry_type::label) {
+    if (types_[i] == entry_type::label) {
       entryType = "label";
     }
-    out << it.word << " " << it.count << " " << entryType << std::endl;
+    out << getWord(i) << " " << counts_[i] << " " << entryType << std::endl;
   }
 }
 
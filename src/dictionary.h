@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <functional>
 #include <istream>
 #include <memory>
 #include <ostream>
@@ -17,18 +18,46 @@
 #include <vector>
 
 #include "args.h"
+#include "compressedfile.h"
+#include "lineindex.h"
+#include "mappedfile.h"
 #include "real.h"
+#include "stringview.h"
+#include "subwordcache.h"
+#include "tokenizer.h"
+#include "wordtable.h"
 
 namespace fasttext {
 
 typedef int32_t id_type;
 enum class entry_type : int8_t { word = 0, label = 1 };
+// Index stored after the words in model files: none before version 13, then
+// a flag followed, when it is set, by the WordTable and subwords.
+enum class index_layout : int8_t { none, word_table };
 
-struct entry {
-  std::string word;
-  int64_t count;
-  entry_type type;
-  std::vector<int32_t> subwords;
+// Read-only view of the contiguous ids stored for one word.
+struct subword_range {
+  const int32_t* first;
+  const int32_t* last;
+
+  inline const int32_t* begin() const {
+    return first;
+  }
+  inline const int32_t* end() const {
+    return last;
+  }
+  inline const int32_t* cbegin() const {
+    return first;
+  }
+  inline const int32_t* cend() const {
+    return last;
+  }
+  inline size_t size() const {
+    return last - first;
+  }
+  inline int32_t operator[](size_t i) const {
+    return first[i];
+  }
 };
 
 class Dictionary {
@@ -36,17 +65,60 @@ class Dictionary {
   static const int32_t MAX_VOCAB_SIZE = 30000000;
   static const int32_t MAX_LINE_SIZE = 1024;
 
-  int32_t find(const std::string&) const;
-  int32_t find(const std::string&, uint32_t h) const;
   void initTableDiscard();
   void initNgrams();
   void reset(std::istream&) const;
   void pushHash(std::vector<int32_t>&, int32_t) const;
-  void addSubwords(std::vector<int32_t>&, const std::string&, int32_t) const;
+  void addOovSubwords(
+      std::vector<int32_t>&,
+      string_view,
+      uint32_t,
+      std::string& word) const;
+  void addSubwords(
+      std::vector<int32_t>&,
+      string_view,
+      uint32_t,
+      int32_t,
+      std::string& word) const;
+  // Assigns BOW + word + EOW to bracketed, which keeps its capacity.
+  void bracket(string_view word, std::string& bracketed) const;
+  uint32_t hash(const char*, size_t) const;
+  // The word of id i, stored in wordArena_.
+  string_view wordView(int32_t i) const;
+  bool wordEquals(int32_t, string_view) const;
+  void pushWord(string_view, int64_t, entry_type);
+  void addWord(string_view, uint32_t, int64_t);
+  void indexWords();
+  void reorder(const std::vector<int32_t>&);
+  void clearWords();
+  void finishReading();
+  bool readShards(
+      const std::vector<int64_t>&,
+      const std::function<std::unique_ptr<std::streambuf>(size_t)>&,
+      LineIndex*);
+  void saveIndex(std::ostream&) const;
+  void loadIndex(std::istream&, std::shared_ptr<const MappedFile>);
 
   std::shared_ptr<Args> args_;
-  std::vector<int32_t> word2int_;
-  std::vector<entry> words_;
+  WordTable word2int_;
+
+  // Vocabulary stored as a struct of arrays: word i is the characters
+  // wordArena_[wordOffsets_[i]] .. wordArena_[wordOffsets_[i+1]].
+  std::vector<char> wordArena_;
+  std::vector<int64_t> wordOffsets_;
+  std::vector<int64_t> counts_;
+  std::vector<entry_type> types_;
+
+  // Subwords of word i are subwords_[offsets_[i]] .. subwords_[offsets_[i+1]]
+  // (CSR layout). They point either into the two vectors below, or into the
+  // model file when the dictionary was loaded from a MappedFile.
+  std::vector<int64_t> subwordOffsets_;
+  std::vector<int32_t> subwordIds_;
+  std::shared_ptr<const MappedFile> file_;
+  const int64_t* offsets_;
+  const int32_t* subwords_;
+  // Subwords of out-of-vocabulary tokens, or null when disabled.
+  std::unique_ptr<SubwordCache> subwordCache_;
 
   std::vector<real> pdiscard_;
   int32_t size_;
@@ -66,39 +138,83 @@ class Dictionary {
   static const std::string BOW;
   static const std::string EOW;
 
+  // Buffers of getLine, which no longer grow once they fit the longest line
+  // when they are reused across calls.
+  struct LineBuffers {
+    std::vector<int32_t> hashes;
+    std::string word;
+    Tokenizer tokenizer;
+
+    LineBuffers() : tokenizer(EOS) {}
+  };
+
   explicit Dictionary(std::shared_ptr<Args>);
-  explicit Dictionary(std::shared_ptr<Args>, std::istream&);
+  explicit Dictionary(
+      std::shared_ptr<Args>,
+      std::istream&,
+      index_layout layout = index_layout::word_table,
+      std::shared_ptr<const MappedFile> file = nullptr);
+  Dictionary(const Dictionary&) = delete;
+  Dictionary& operator=(const Dictionary&) = delete;
   int32_t nwords() const;
   int32_t nlabels() const;
   int64_t ntokens() const;
-  int32_t getId(const std::string&) const;
-  int32_t getId(const std::string&, uint32_t h) const;
+  int32_t getId(string_view) const;
+  int32_t getId(string_view, uint32_t h) const;
   entry_type getType(int32_t) const;
-  entry_type getType(const std::string&) const;
+  entry_type getType(string_view) const;
   bool discard(int32_t, real) const;
   std::string getWord(int32_t) const;
-  const std::vector<int32_t>& getSubwords(int32_t) const;
-  const std::vector<int32_t> getSubwords(const std::string&) const;
+  subword_range getSubwords(int32_t) const;
+  const std::vector<int32_t> getSubwords(string_view) const;
+  // Assigns the subwords of a word, in or out of the vocabulary, to ngrams,
+  // which keeps its capacity.
+  void getSubwords(string_view, std::vector<int32_t>& ngrams) const;
   void getSubwords(
-      const std::string&,
+      string_view,
       std::vector<int32_t>&,
       std::vector<std::string>&) const;
   void computeSubwords(
-      const std::string&,
+      string_view,
       std::vector<int32_t>&,
       std::vector<std::string>* substrings = nullptr) const;
-  uint32_t hash(const std::string& str) const;
+  uint32_t hash(string_view str) const;
+  // The cache of the subwords of out-of-vocabulary tokens, e.g. for its hit
+  // and miss counters, or null when it is disabled.
+  const SubwordCache* getSubwordCache() const;
   void add(const std::string&);
   bool readWord(std::istream&, std::string&) const;
   void readFromFile(std::istream&);
+  void readFromFile(const std::string&, int32_t, LineIndex* index = nullptr);
+  void readFromFile(std::shared_ptr<const CompressedFile>, int32_t);
+  void readVocabulary(std::istream&);
   std::string getLabel(int32_t) const;
-  void save(std::ostream&) const;
-  void load(std::istream&);
+  // Assigns the label to its second argument, which keeps its capacity.
+  void getLabel(int32_t, std::string&) const;
+  // Saves the dictionary, with its index unless index is false, e.g. for
+  // the compressed models in which it takes much room but is cheap to build.
+  void save(std::ostream&, bool index = true) const;
+  void load(
+      std::istream&,
+      index_layout layout = index_layout::word_table,
+      std::shared_ptr<const MappedFile> file = nullptr);
   std::vector<int64_t> getCounts(entry_type) const;
   int32_t getLine(std::istream&, std::vector<int32_t>&, std::vector<int32_t>&)
       const;
+  int32_t getLine(
+      std::istream&,
+      std::vector<int32_t>&,
+      std::vector<int32_t>&,
+      LineBuffers&) const;
   int32_t getLine(std::istream&, std::vector<int32_t>&, std::minstd_rand&)
       const;
+  // Same as above, for a line that may be longer than MAX_LINE_SIZE tokens:
+  // the next call with the same buffers reads the rest of it.
+  int32_t getLine(
+      std::istream&,
+      std::vector<int32_t>&,
+      std::minstd_rand&,
+      LineBuffers&) const;
   void threshold(int64_t, int64_t);
   void prune(std::vector<int32_t>&);
   bool isPruned() {
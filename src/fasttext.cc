@@ -7,11 +7,15 @@
  */
 
 #include "fasttext.h"
+#include "int8matrix.h"
+#include "kernels.h"
 #include "loss.h"
 #include "quantmatrix.h"
 
 #include <algorithm>
+#include <exception>
 #include <iomanip>
+#include <mutex>
 #include <iostream>
 #include <numeric>
 #include <sstream>
@@ -22,12 +26,77 @@
 
 namespace fasttext {
 
-constexpr int32_t FASTTEXT_VERSION = 12; /* Version 1b */
+constexpr int32_t FASTTEXT_VERSION = 13; /* Version 1c */
 constexpr int32_t FASTTEXT_FILEFORMAT_MAGIC_INT32 = 793712314;
+// From version 13 on, matrix data is padded to start on an aligned offset,
+// so that it can be memory-mapped in place, and the dictionary can store its
+// WordTable and subwords. The byte before each matrix, which used to flag
+// quantized matrices, is its type, which can also be MATRIX_INT8, and
+// quantized matrices store whether they are rotated.
+constexpr int32_t FASTTEXT_MMAP_VERSION = 13;
+constexpr uint8_t MATRIX_DENSE = 0;
+constexpr uint8_t MATRIX_PQ = 1;
+constexpr uint8_t MATRIX_INT8 = 2;
+constexpr int32_t TEST_BATCH_SIZE = 64;
+// Lines buffered per training thread when the input is streamed.
+constexpr int32_t STREAM_LINES_PER_THREAD = 1024;
+
+namespace {
+
+uint8_t matrixType(const Matrix& matrix) {
+  if (dynamic_cast<const QuantMatrix*>(&matrix)) {
+    return MATRIX_PQ;
+  }
+  if (dynamic_cast<const Int8Matrix*>(&matrix)) {
+    return MATRIX_INT8;
+  }
+  return MATRIX_DENSE;
+}
+
+// An empty matrix of the given quantized type, to load from a model file of
+// the given version.
+std::shared_ptr<Matrix> quantizedMatrix(uint8_t type, int32_t version) {
+  if (type == MATRIX_PQ) {
+    return std::make_shared<QuantMatrix>(version >= FASTTEXT_MMAP_VERSION);
+  }
+  if (type == MATRIX_INT8 && version >= FASTTEXT_MMAP_VERSION) {
+    return std::make_shared<Int8Matrix>();
+  }
+  throw std::invalid_argument("Invalid model file: unknown matrix type.");
+}
 
-bool comparePairs(
-    const std::pair<real, std::string>& l,
-    const std::pair<real, std::string>& r);
+// Whether predictions score every label, which a label index avoids.
+bool scoresEveryLabel(const Args& args) {
+  return args.model == model_name::sup &&
+      (args.loss == loss_name::softmax || args.loss == loss_name::ova);
+}
+
+// Reads input, or stdin for "-", once into lines until it ends or until it
+// has queued budget tokens, and then closes lines. The reader shares only
+// lines with the training threads, so that it can be left waiting on a pipe
+// once training is over: it returns when the pipe gives its next line.
+void streamLines(
+    const std::string& input,
+    int64_t budget,
+    std::shared_ptr<LineQueue> lines) {
+  std::ifstream ifs;
+  if (input != "-") {
+    ifs.open(input);
+  }
+  std::istream& in = input != "-" ? ifs : std::cin;
+  std::string line;
+  int64_t ntokens = 0;
+  while (ntokens < budget && std::getline(in, line)) {
+    ntokens += utils::countTokens(line);
+    line.push_back('\n');
+    if (!lines->push(std::move(line))) {
+      return;
+    }
+  }
+  lines->close();
+}
+
+} // namespace
 
 std::shared_ptr<Loss> FastText::createLoss(std::shared_ptr<Matrix>& output) {
   loss_name lossName = args_->loss;
@@ -48,7 +117,10 @@ std::shared_ptr<Loss> FastText::createLoss(std::shared_ptr<Matrix>& output) {
 }
 
 FastText::FastText()
-    : quant_(false), wordVectors_(nullptr), trainException_(nullptr) {}
+    : quant_(false),
+      wordVectors_(nullptr),
+      trainException_(nullptr),
+      nthreads_(1) {}
 
 void FastText::addInputVector(Vector& vec, int32_t ind) const {
   vec.addRow(*input_, ind);
@@ -67,7 +139,12 @@ std::shared_ptr<const DenseMatrix> FastText::getInputMatrix() const {
     throw std::runtime_error("Can't export quantized matrix");
   }
   assert(input_.get());
-  return std::dynamic_pointer_cast<DenseMatrix>(input_);
+  std::shared_ptr<const DenseMatrix> input =
+      std::dynamic_pointer_cast<DenseMatrix>(input_);
+  if (!input) {
+    throw std::runtime_error("Can't export memory-mapped matrix");
+  }
+  return input;
 }
 
 void FastText::setMatrices(
@@ -78,6 +155,9 @@ void FastText::setMatrices(
   input_ = std::dynamic_pointer_cast<Matrix>(inputMatrix);
   output_ = std::dynamic_pointer_cast<Matrix>(outputMatrix);
   wordVectors_.reset();
+  nnIndex_.reset();
+  pqIndex_.reset();
+  labelIndex_.reset();
   args_->dim = input_->size(1);
 
   buildModel();
@@ -88,7 +168,12 @@ std::shared_ptr<const DenseMatrix> FastText::getOutputMatrix() const {
     throw std::runtime_error("Can't export quantized matrix");
   }
   assert(output_.get());
-  return std::dynamic_pointer_cast<DenseMatrix>(output_);
+  std::shared_ptr<const DenseMatrix> output =
+      std::dynamic_pointer_cast<DenseMatrix>(output_);
+  if (!output) {
+    throw std::runtime_error("Can't export memory-mapped matrix");
+  }
+  return output;
 }
 
 int32_t FastText::getWordId(const std::string& word) const {
@@ -108,8 +193,11 @@ int32_t FastText::getLabelId(const std::string& label) const {
   return labelId;
 }
 
-void FastText::getWordVector(Vector& vec, const std::string& word) const {
-  const std::vector<int32_t>& ngrams = dict_->getSubwords(word);
+void FastText::getWordVector(Vector& vec, string_view word) const {
+  // Scratch of the thread, so that getting the vector of a word does not
+  // allocate once it has grown.
+  static thread_local std::vector<int32_t> ngrams;
+  dict_->getSubwords(word, ngrams);
   vec.zero();
   for (int i = 0; i < ngrams.size(); i++) {
     addInputVector(vec, ngrams[i]);
@@ -119,7 +207,7 @@ void FastText::getWordVector(Vector& vec, const std::string& word) const {
   }
 }
 
-void FastText::getSubwordVector(Vector& vec, const std::string& subword) const {
+void FastText::getSubwordVector(Vector& vec, string_view subword) const {
   vec.zero();
   int32_t h = dict_->hash(subword) % args_->bucket;
   h = h + dict_->nwords();
@@ -199,18 +287,27 @@ void FastText::saveModel(const std::string& filename) {
   }
   signModel(ofs);
   args_->save(ofs);
-  dict_->save(ofs);
+  // Compressed models are rather small without the index of the dictionary.
+  dict_->save(ofs, !quant_ && !dict_->isPruned());
 
-  ofs.write((char*)&(quant_), sizeof(bool));
+  const uint8_t inputType = matrixType(*input_);
+  ofs.write((char*)&(inputType), sizeof(uint8_t));
+  utils::writePadding(ofs, 2 * sizeof(int64_t));
   input_->save(ofs);
 
-  ofs.write((char*)&(args_->qout), sizeof(bool));
+  const uint8_t outputType = matrixType(*output_);
+  ofs.write((char*)&(outputType), sizeof(uint8_t));
+  utils::writePadding(ofs, 2 * sizeof(int64_t));
   output_->save(ofs);
 
   ofs.close();
 }
 
 void FastText::loadModel(const std::string& filename) {
+  loadModel(filename, false);
+}
+
+void FastText::loadModel(const std::string& filename, bool mmap) {
   std::ifstream ifs(filename, std::ifstream::binary);
   if (!ifs.is_open()) {
     throw std::invalid_argument(filename + " cannot be opened for loading!");
@@ -218,7 +315,12 @@ void FastText::loadModel(const std::string& filename) {
   if (!checkModel(ifs)) {
     throw std::invalid_argument(filename + " has wrong file format!");
   }
-  loadModel(ifs);
+  std::shared_ptr<const MappedFile> file;
+  if (mmap && version >= FASTTEXT_MMAP_VERSION) {
+    // older files are not aligned and are loaded into memory instead
+    file = std::make_shared<MappedFile>(filename);
+  }
+  loadModel(ifs, file);
   ifs.close();
 }
 
@@ -237,34 +339,61 @@ void FastText::buildModel() {
 }
 
 void FastText::loadModel(std::istream& in) {
+  loadModel(in, nullptr);
+}
+
+void FastText::loadModel(
+    std::istream& in,
+    std::shared_ptr<const MappedFile> file) {
   args_ = std::make_shared<Args>();
-  input_ = std::make_shared<DenseMatrix>();
-  output_ = std::make_shared<DenseMatrix>();
+  if (file) {
+    input_ = std::make_shared<MmapMatrix>(file);
+    output_ = std::make_shared<MmapMatrix>(file);
+  } else {
+    input_ = std::make_shared<DenseMatrix>();
+    output_ = std::make_shared<DenseMatrix>();
+  }
+  quant_ = false;
+  wordVectors_.reset();
+  nnIndex_.reset();
+  pqIndex_.reset();
+  labelIndex_.reset();
   args_->load(in);
   if (version == 11 && args_->model == model_name::sup) {
     // backward compatibility: old supervised models do not use char ngrams.
     args_->maxn = 0;
   }
-  dict_ = std::make_shared<Dictionary>(args_, in);
-
-  bool quant_input;
-  in.read((char*)&quant_input, sizeof(bool));
-  if (quant_input) {
+  const index_layout layout = version >= FASTTEXT_MMAP_VERSION
+      ? index_layout::word_table
+      : index_layout::none;
+  dict_ = std::make_shared<Dictionary>(args_, in, layout, file);
+
+  uint8_t inputType;
+  in.read((char*)&inputType, sizeof(uint8_t));
+  if (inputType != MATRIX_DENSE) {
     quant_ = true;
-    input_ = std::make_shared<QuantMatrix>();
+    input_ = quantizedMatrix(inputType, version);
+  }
+  if (version >= FASTTEXT_MMAP_VERSION) {
+    utils::skipPadding(in);
   }
   input_->load(in);
 
-  if (!quant_input && dict_->isPruned()) {
+  if (!quant_ && dict_->isPruned()) {
     throw std::invalid_argument(
         "Invalid model file.\n"
         "Please download the updated model from www.fasttext.cc.\n"
         "See issue #332 on Github for more information.\n");
   }
 
-  in.read((char*)&args_->qout, sizeof(bool));
+  uint8_t outputType;
+  in.read((char*)&outputType, sizeof(uint8_t));
+  args_->qout = outputType != MATRIX_DENSE;
   if (quant_ && args_->qout) {
-    output_ = std::make_shared<QuantMatrix>();
+    output_ = quantizedMatrix(outputType, version);
+  }
+  if (version >= FASTTEXT_MMAP_VERSION) {
+    utils::skipPadding(in);
   }
   output_->load(in);
 
@@ -280,7 +409,7 @@ std::tuple<int64_t, double, double> FastText::progressInfo(real progress) {
 
   if (progress > 0 && t >= 0) {
     eta = t * (1 - progress) / progress;
-    wst = double(tokenCount_) / t / args_->thread;
+    wst = double(tokenCount_) / t / nthreads_;
   }
 
   return std::tuple<double, double, int64_t>(wst, lr, eta);
@@ -332,6 +461,10 @@ void FastText::quantize(const Args& qargs, const TrainCallback& callback) {
       std::dynamic_pointer_cast<DenseMatrix>(input_);
   std::shared_ptr<DenseMatrix> output =
       std::dynamic_pointer_cast<DenseMatrix>(output_);
+  if (!input || !output) {
+    throw std::invalid_argument(
+        "Quantization requires a model that is not memory-mapped");
+  }
   bool normalizeGradient = (args_->model == model_name::sup);
 
   if (qargs.cutoff > 0 && qargs.cutoff < input->size(0)) {
@@ -352,23 +485,41 @@ void FastText::quantize(const Args& qargs, const TrainCallback& callback) {
       args_->verbose = qargs.verbose;
       auto loss = createLoss(output_);
       model_ = std::make_shared<Model>(input, output, loss, normalizeGradient);
+      openCorpus();
+      splitCorpus(LineIndex());
       startThreads(callback);
+      corpus_.reset();
     }
   }
-  input_ = std::make_shared<QuantMatrix>(
-      std::move(*(input.get())), qargs.dsub, qargs.qnorm);
-
-  if (args_->qout) {
-    output_ = std::make_shared<QuantMatrix>(
-        std::move(*(output.get())), 2, qargs.qnorm);
+  if (qargs.int8) {
+    input_ = std::make_shared<Int8Matrix>(*input);
+    if (args_->qout) {
+      output_ = std::make_shared<Int8Matrix>(*output);
+    }
+  } else {
+    input_ = std::make_shared<QuantMatrix>(
+        std::move(*(input.get())),
+        qargs.dsub,
+        qargs.qnorm,
+        qargs.opq,
+        qargs.thread);
+
+    // The output matrix is scored one row at a time by the hierarchical
+    // softmax, so that rotating every query would cost more than it saves.
+    if (args_->qout) {
+      output_ = std::make_shared<QuantMatrix>(
+          std::move(*(output.get())), 2, qargs.qnorm, false, qargs.thread);
+    }
   }
   quant_ = true;
+  labelIndex_.reset();
   auto loss = createLoss(output_);
   model_ = std::make_shared<Model>(input_, output_, loss, normalizeGradient);
 }
 
+template <typename State>
 void FastText::supervised(
-    Model::State& state,
+    State& state,
     real lr,
     const std::vector<int32_t>& line,
     const std::vector<int32_t>& labels) {
@@ -384,8 +535,9 @@ void FastText::supervised(
   }
 }
 
+template <typename State>
 void FastText::cbow(
-    Model::State& state,
+    State& state,
     real lr,
     const std::vector<int32_t>& line) {
   std::vector<int32_t> bow;
@@ -395,7 +547,7 @@ void FastText::cbow(
     bow.clear();
     for (int32_t c = -boundary; c <= boundary; c++) {
       if (c != 0 && w + c >= 0 && w + c < line.size()) {
-        const std::vector<int32_t>& ngrams = dict_->getSubwords(line[w + c]);
+        const subword_range ngrams = dict_->getSubwords(line[w + c]);
         bow.insert(bow.end(), ngrams.cbegin(), ngrams.cend());
       }
     }
@@ -403,14 +555,17 @@ void FastText::cbow(
   }
 }
 
+template <typename State>
 void FastText::skipgram(
-    Model::State& state,
+    State& state,
     real lr,
     const std::vector<int32_t>& line) {
+  std::vector<int32_t> ngrams;
   std::uniform_int_distribution<> uniform(1, args_->ws);
   for (int32_t w = 0; w < line.size(); w++) {
     int32_t boundary = uniform(state.rng);
-    const std::vector<int32_t>& ngrams = dict_->getSubwords(line[w]);
+    const subword_range subwords = dict_->getSubwords(line[w]);
+    ngrams.assign(subwords.cbegin(), subwords.cend());
     for (int32_t c = -boundary; c <= boundary; c++) {
       if (c != 0 && w + c >= 0 && w + c < line.size()) {
         model_->update(ngrams, line, w + c, lr, state);
@@ -430,23 +585,35 @@ FastText::test(std::istream& in, int32_t k, real threshold) {
 
 void FastText::test(std::istream& in, int32_t k, real threshold, Meter& meter)
     const {
-  std::vector<int32_t> line;
-  std::vector<int32_t> labels;
-  Predictions predictions;
-  Model::State state(args_->dim, dict_->nlabels(), 0);
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  std::vector<std::vector<int32_t>> lines(TEST_BATCH_SIZE);
+  std::vector<std::vector<int32_t>> labels(TEST_BATCH_SIZE);
+  std::vector<Predictions> predictions;
+  Model::BatchState state(TEST_BATCH_SIZE, args_->dim, dict_->nlabels(), 0);
+  Dictionary::LineBuffers buffers;
   in.clear();
   in.seekg(0, std::ios_base::beg);
 
-  while (in.peek() != EOF) {
-    line.clear();
-    labels.clear();
-    dict_->getLine(in, line, labels);
-
-    if (!labels.empty() && !line.empty()) {
-      predictions.clear();
-      predict(k, line, predictions, threshold);
-      meter.log(labels, predictions);
+  int32_t n = 0;
+  while (n > 0 || in.peek() != EOF) {
+    if (in.peek() != EOF) {
+      dict_->getLine(in, lines[n], labels[n], buffers);
+      if (!labels[n].empty() && !lines[n].empty()) {
+        n++;
+      }
+      if (n < TEST_BATCH_SIZE) {
+        continue;
+      }
     }
+    lines.resize(n);
+    model_->predict(lines, k, threshold, predictions, state);
+    for (int32_t i = 0; i < n; i++) {
+      meter.log(labels[i], predictions[i]);
+    }
+    lines.resize(TEST_BATCH_SIZE);
+    n = 0;
   }
 }
 
@@ -471,22 +638,146 @@ bool FastText::predictLine(
     int32_t k,
     real threshold) const {
   predictions.clear();
+  PredictContext context(*this);
+  if (!predictLine(in, context, k, threshold)) {
+    return false;
+  }
+  for (int32_t i = 0; i < context.size(); i++) {
+    predictions.push_back(
+        std::make_pair(context.probability(i), context.label(i)));
+  }
+
+  return true;
+}
+
+FastText::PredictContext::PredictContext(const FastText& fasttext)
+    : state_(fasttext.args_->dim, fasttext.dict_->nlabels(), 0),
+      in_(&buf_),
+      size_(0) {}
+
+bool FastText::predictLine(
+    std::istream& in,
+    PredictContext& context,
+    int32_t k,
+    real threshold) const {
+  context.size_ = 0;
   if (in.peek() == EOF) {
     return false;
   }
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  if (context.state_.hidden.size() != args_->dim ||
+      context.state_.output.size() != dict_->nlabels()) {
+    throw std::invalid_argument(
+        "The prediction context was created for another model.");
+  }
 
-  std::vector<int32_t> words, labels;
-  dict_->getLine(in, words, labels);
-  Predictions linePredictions;
-  predict(k, words, linePredictions, threshold);
-  for (const auto& p : linePredictions) {
-    predictions.push_back(
-        std::make_pair(std::exp(p.first), dict_->getLabel(p.second)));
+  dict_->getLine(in, context.words_, context.labels_, context.buffers_);
+  Predictions& predictions = context.predictions_;
+  predictions.clear();
+  if (!context.words_.empty()) {
+    model_->predict(
+        context.words_, k, threshold, predictions, context.state_);
+  }
+  auto& results = context.results_;
+  if (results.size() < predictions.size()) {
+    results.resize(predictions.size());
+  }
+  for (size_t i = 0; i < predictions.size(); i++) {
+    results[i].first = std::exp(predictions[i].first);
+    dict_->getLabel(predictions[i].second, results[i].second);
   }
+  context.size_ = predictions.size();
 
   return true;
 }
 
+void FastText::predictLine(
+    const std::string& line,
+    PredictContext& context,
+    int32_t k,
+    real threshold) const {
+  context.buf_.reset(line);
+  context.in_.clear();
+  predictLine(context.in_, context, k, threshold);
+}
+
+void FastText::predictBatch(
+    const std::vector<std::string>& lines,
+    std::vector<std::vector<std::pair<real, std::string>>>& predictions,
+    int32_t k,
+    real threshold,
+    int32_t nthreads) const {
+  if (args_->model != model_name::sup) {
+    throw std::invalid_argument("Model needs to be supervised for prediction!");
+  }
+  const int64_t n = lines.size();
+  predictions.resize(n);
+  if (n == 0) {
+    return;
+  }
+  // A few lines, as predicted from webassembly, need no full minibatch.
+  const int64_t batchSize = std::min<int64_t>(TEST_BATCH_SIZE, n);
+  std::atomic<int64_t> next(0);
+  std::exception_ptr exception = nullptr;
+  std::mutex exceptionMutex;
+
+  auto predictLines = [&]() {
+    std::vector<std::vector<int32_t>> words(batchSize);
+    std::vector<int32_t> labels;
+    std::vector<Predictions> batchPredictions;
+    Model::BatchState state(batchSize, args_->dim, dict_->nlabels(), 0);
+    PredictContext::StringBuf buf;
+    std::istream in(&buf);
+    Dictionary::LineBuffers buffers;
+    try {
+      for (int64_t begin = next.fetch_add(batchSize); begin < n;
+           begin = next.fetch_add(batchSize)) {
+        const int64_t end = std::min(n, begin + batchSize);
+        words.resize(end - begin);
+        for (int64_t i = begin; i < end; i++) {
+          buf.reset(lines[i]);
+          in.clear();
+          buffers.tokenizer.clear();
+          dict_->getLine(in, words[i - begin], labels, buffers);
+        }
+        model_->predict(words, k, threshold, batchPredictions, state);
+        for (int64_t i = begin; i < end; i++) {
+          auto& linePredictions = predictions[i];
+          linePredictions.clear();
+          for (const auto& p : batchPredictions[i - begin]) {
+            linePredictions.push_back(
+                std::make_pair(std::exp(p.first), dict_->getLabel(p.second)));
+          }
+        }
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(exceptionMutex);
+      exception = std::current_exception();
+      next = n;
+    }
+  };
+
+  const int64_t nbatches = (n + batchSize - 1) / batchSize;
+  nthreads = std::max<int64_t>(1, std::min<int64_t>(nthreads, nbatches));
+  if (nthreads > 1) {
+    std::vector<std::thread> threads;
+    for (int32_t i = 0; i < nthreads; i++) {
+      threads.push_back(std::thread(predictLines));
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  } else {
+    // webassembly can't instantiate `std::thread`
+    predictLines();
+  }
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
 void FastText::getSentenceVector(std::istream& in, fasttext::Vector& svec) {
   svec.zero();
   if (args_->model == model_name::sup) {
@@ -565,9 +856,72 @@ std::vector<std::pair<real, std::string>> FastText::getNN(
 
   getWordVector(query, word);
 
-  lazyComputeWordVectors();
-  assert(wordVectors_);
-  return getNN(*wordVectors_, query, k, {word});
+  return getNN(query, k, {word});
+}
+
+std::vector<std::pair<real, std::string>> FastText::getNN(
+    const Vector& query,
+    int32_t k,
+    const std::set<std::string>& banSet) {
+  if (pqIndex_) {
+    return getPQNN(query, k, banSet);
+  }
+  if (!nnIndex_) {
+    lazyComputeWordVectors();
+    assert(wordVectors_);
+    return getNN(*wordVectors_, query, k, banSet);
+  }
+  real queryNorm = query.norm();
+  if (std::abs(queryNorm) < 1e-8) {
+    queryNorm = 1;
+  }
+  std::vector<std::pair<real, std::string>> result;
+  for (const auto& neighbor :
+       nnIndex_->search(query.data(), k + banSet.size())) {
+    std::string word = dict_->getWord(neighbor.second);
+    if (result.size() < k && banSet.find(word) == banSet.end()) {
+      result.push_back(std::make_pair(neighbor.first / queryNorm, word));
+    }
+  }
+  return result;
+}
+
+std::vector<std::pair<real, std::string>> FastText::getPQNN(
+    const Vector& query,
+    int32_t k,
+    const std::set<std::string>& banSet) {
+  real queryNorm = query.norm();
+  if (std::abs(queryNorm) < 1e-8) {
+    queryNorm = 1;
+  }
+  // the codes only rank the candidates, four times as many as needed are
+  // rescored with their exact vectors
+  std::vector<std::pair<real, std::string>> candidates;
+  Vector vec(args_->dim);
+  for (const auto& candidate :
+       pqIndex_->search(query.data(), 4 * (k + banSet.size()))) {
+    std::string word = dict_->getWord(candidate.second);
+    if (banSet.find(word) != banSet.end()) {
+      continue;
+    }
+    getWordVector(vec, word);
+    real norm = vec.norm();
+    real similarity = 0;
+    if (norm > 0) {
+      real dp = kernels::dot(query.data(), vec.data(), args_->dim);
+      similarity = dp / (norm * queryNorm);
+    }
+    candidates.push_back(std::make_pair(similarity, word));
+  }
+  auto compare = [](const std::pair<real, std::string>& l,
+                    const std::pair<real, std::string>& r) {
+    return l.first > r.first;
+  };
+  std::stable_sort(candidates.begin(), candidates.end(), compare);
+  if (candidates.size() > k) {
+    candidates.resize(k);
+  }
+  return candidates;
 }
 
 std::vector<std::pair<real, std::string>> FastText::getNN(
@@ -575,33 +929,47 @@ std::vector<std::pair<real, std::string>> FastText::getNN(
     const Vector& query,
     int32_t k,
     const std::set<std::string>& banSet) {
-  std::vector<std::pair<real, std::string>> heap;
+  std::vector<std::pair<real, int32_t>> heap;
+  auto compare = [](const std::pair<real, int32_t>& l,
+                    const std::pair<real, int32_t>& r) {
+    return l.first > r.first;
+  };
 
   real queryNorm = query.norm();
   if (std::abs(queryNorm) < 1e-8) {
     queryNorm = 1;
   }
 
+  // compare ids rather than copies of every word of the dictionary
+  std::vector<int32_t> banIds;
+  for (const std::string& word : banSet) {
+    banIds.push_back(dict_->getId(word));
+  }
+
   for (int32_t i = 0; i < dict_->nwords(); i++) {
-    std::string word = dict_->getWord(i);
-    if (banSet.find(word) == banSet.end()) {
+    if (!utils::contains(banIds, i)) {
       real dp = wordVectors.dotRow(query, i);
       real similarity = dp / queryNorm;
 
       if (heap.size() == k && similarity < heap.front().first) {
         continue;
       }
-      heap.push_back(std::make_pair(similarity, word));
-      std::push_heap(heap.begin(), heap.end(), comparePairs);
+      heap.push_back(std::make_pair(similarity, i));
+      std::push_heap(heap.begin(), heap.end(), compare);
       if (heap.size() > k) {
-        std::pop_heap(heap.begin(), heap.end(), comparePairs);
+        std::pop_heap(heap.begin(), heap.end(), compare);
         heap.pop_back();
       }
     }
   }
-  std::sort_heap(heap.begin(), heap.end(), comparePairs);
+  std::sort_heap(heap.begin(), heap.end(), compare);
 
-  return heap;
+  std::vector<std::pair<real, std::string>> result;
+  for (const auto& neighbor : heap) {
+    result.push_back(
+        std::make_pair(neighbor.first, dict_->getWord(neighbor.second)));
+  }
+  return result;
 }
 
 std::vector<std::pair<real, std::string>> FastText::getAnalogies(
@@ -620,25 +988,268 @@ std::vector<std::pair<real, std::string>> FastText::getAnalogies(
   getWordVector(buffer, wordC);
   query.addVector(buffer, 1.0 / (buffer.norm() + 1e-8));
 
+  return getNN(query, k, {wordA, wordB, wordC});
+}
+
+void FastText::buildNNIndex(
+    int32_t m,
+    int32_t efConstruction,
+    int32_t efSearch,
+    int32_t thread) {
   lazyComputeWordVectors();
-  assert(wordVectors_);
-  return getNN(*wordVectors_, query, k, {wordA, wordB, wordC});
+  std::unique_ptr<HnswIndex> index(new HnswIndex());
+  index->build(*wordVectors_, m, efConstruction, thread, args_->seed);
+  index->setEfSearch(efSearch);
+  pqIndex_.reset();
+  nnIndex_ = std::move(index);
+}
+
+void FastText::saveNNIndex(const std::string& filename) const {
+  if (!nnIndex_) {
+    throw std::invalid_argument("No nearest neighbour index to save.");
+  }
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for saving!");
+  }
+  nnIndex_->save(ofs);
+  ofs.close();
+}
+
+void FastText::loadNNIndex(const std::string& filename, int32_t efSearch) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  std::unique_ptr<HnswIndex> index(new HnswIndex());
+  index->load(ifs, std::make_shared<MappedFile>(filename));
+  if (index->size() != dict_->nwords() || index->dim() != args_->dim) {
+    throw std::invalid_argument(
+        filename + " is not an index of the words of this model!");
+  }
+  if (efSearch > 0) {
+    index->setEfSearch(efSearch);
+  }
+  pqIndex_.reset();
+  nnIndex_ = std::move(index);
+}
+
+void FastText::buildPQIndex(
+    int32_t nlist,
+    int32_t dsub,
+    int32_t nprobe,
+    int32_t thread) {
+  std::unique_ptr<IvfPqIndex> index(new IvfPqIndex());
+  index->build(
+      dict_->nwords(),
+      args_->dim,
+      [this](int32_t i, Vector& vec) {
+        getWordVector(vec, dict_->getWord(i));
+        real norm = vec.norm();
+        if (norm > 0) {
+          vec.mul(1.0 / norm);
+        }
+      },
+      nlist,
+      dsub,
+      thread,
+      args_->seed);
+  index->setNProbe(nprobe);
+  nnIndex_.reset();
+  pqIndex_ = std::move(index);
+}
+
+void FastText::savePQIndex(const std::string& filename) const {
+  if (!pqIndex_) {
+    throw std::invalid_argument("No nearest neighbour index to save.");
+  }
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for saving!");
+  }
+  pqIndex_->save(ofs);
+  ofs.close();
+}
+
+void FastText::loadPQIndex(const std::string& filename, int32_t nprobe) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  std::unique_ptr<IvfPqIndex> index(new IvfPqIndex());
+  index->load(ifs, std::make_shared<MappedFile>(filename));
+  if (index->size() != dict_->nwords() || index->dim() != args_->dim) {
+    throw std::invalid_argument(
+        filename + " is not an index of the words of this model!");
+  }
+  if (nprobe > 0) {
+    index->setNProbe(nprobe);
+  }
+  nnIndex_.reset();
+  pqIndex_ = std::move(index);
+}
+
+void FastText::buildLabelIndex(int32_t nlist, int32_t thread) {
+  if (!scoresEveryLabel(*args_)) {
+    throw std::invalid_argument(
+        "A label index needs a softmax or one-vs-all supervised model.");
+  }
+  std::shared_ptr<MipsIndex> index = std::make_shared<MipsIndex>();
+  index->build(*output_, nlist, thread, args_->seed);
+  labelIndex_ = index;
+  model_->setIndex(labelIndex_);
+}
+
+void FastText::saveLabelIndex(const std::string& filename) const {
+  if (!labelIndex_) {
+    throw std::invalid_argument("No label index to save.");
+  }
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for saving!");
+  }
+  labelIndex_->save(ofs);
+  ofs.close();
+}
+
+void FastText::loadLabelIndex(const std::string& filename) {
+  if (!scoresEveryLabel(*args_)) {
+    throw std::invalid_argument(
+        "A label index needs a softmax or one-vs-all supervised model.");
+  }
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  std::shared_ptr<MipsIndex> index = std::make_shared<MipsIndex>();
+  index->load(ifs);
+  if (!index->matches(*output_)) {
+    throw std::invalid_argument(
+        filename + " is not an index of the labels of this model!");
+  }
+  labelIndex_ = index;
+  model_->setIndex(labelIndex_);
 }
 
 bool FastText::keepTraining(const int64_t ntokens) const {
-  return tokenCount_ < args_->epoch * ntokens && !trainException_;
+  return tokenCount_ < args_->epoch * ntokens && !trainException_ &&
+      !(stream_ && stream_->done());
+}
+
+template <typename State>
+int64_t FastText::trainLine(
+    std::istream& in,
+    Dictionary::LineBuffers& buffers,
+    State& state,
+    real lr,
+    std::vector<int32_t>& line,
+    std::vector<int32_t>& labels) {
+  int64_t ntokens = 0;
+  if (args_->model == model_name::sup) {
+    ntokens = dict_->getLine(in, line, labels, buffers);
+    supervised(state, lr, line, labels);
+  } else if (args_->model == model_name::cbow) {
+    ntokens = dict_->getLine(in, line, state.rng, buffers);
+    cbow(state, lr, line);
+  } else if (args_->model == model_name::sg) {
+    ntokens = dict_->getLine(in, line, state.rng, buffers);
+    skipgram(state, lr, line);
+  }
+  return ntokens;
+}
+
+bool FastText::isStreamingInput() const {
+  return args_->input == "-" || utils::isStream(args_->input);
+}
+
+bool FastText::nextStreamLine(std::istringstream& in, std::string& buffer) {
+  if (in.rdbuf()->in_avail() > 0) {
+    return true;
+  }
+  if (!stream_->pop(buffer)) {
+    return false;
+  }
+  in.clear();
+  in.str(buffer);
+  return true;
+}
+
+void FastText::openCorpus() {
+  corpus_.reset();
+  if (!isStreamingInput() && CompressedFile::isCompressed(args_->input)) {
+    corpus_ = std::make_shared<const CompressedFile>(args_->input);
+  }
+}
+
+// Splits the input between the training threads: into line-aligned ranges
+// of similar token counts for a text file, from the line starts counted
+// with the vocabulary when there are any, and into block ranges of similar
+// compressed sizes for a compressed one. A single thread reads the whole
+// input. Each thread gets a shard of its own, so there are no more threads
+// than shards.
+void FastText::splitCorpus(const LineIndex& counted) {
+  shards_.clear();
+  nthreads_ = args_->thread;
+  if (isStreamingInput()) {
+    return;
+  }
+  if (corpus_) {
+    shards_ = corpus_->shards(args_->thread);
+  } else if (args_->thread <= 1) {
+    std::ifstream ifs(args_->input);
+    shards_ = {0, utils::size(ifs)};
+  } else if (!counted.empty()) {
+    shards_ = counted.shards(args_->thread);
+  } else {
+    LineIndex index(args_->input, args_->verbose, args_->lineIndexCache);
+    shards_ = index.shards(args_->thread);
+  }
+  const int32_t nshards = shards_.size() - 1;
+  if (nshards < nthreads_) {
+    if (args_->verbose > 0) {
+      std::cerr << "Warning : the input only splits into " << nshards
+                << " shards, training on " << nshards << " threads."
+                << std::endl;
+    }
+    nthreads_ = nshards;
+  }
 }
 
 void FastText::trainThread(int32_t threadId, const TrainCallback& callback) {
-  std::ifstream ifs(args_->input);
-  utils::seek(ifs, threadId * utils::size(ifs) / args_->thread);
+  std::istringstream lineStream;
+  std::string lineBuffer;
+  // Each thread loops over its own shard, rewound by Dictionary::reset.
+  std::unique_ptr<std::streambuf> shardBuffer;
+  if (!stream_) {
+    const size_t shard = threadId;
+    if (corpus_) {
+      shardBuffer.reset(new CompressedBuffer(
+          corpus_, shards_[shard], shards_[shard + 1]));
+    } else {
+      shardBuffer.reset(new utils::FileRangeBuffer(
+          args_->input, shards_[shard], shards_[shard + 1]));
+    }
+  }
+  std::istream shardStream(shardBuffer.get());
+  std::istream& in =
+      stream_ ? static_cast<std::istream&>(lineStream) : shardStream;
 
   Model::State state(args_->dim, output_->size(0), threadId + args_->seed);
+  std::unique_ptr<Model::BatchState> batch;
+  if (args_->batchSize > 1) {
+    batch.reset(new Model::BatchState(
+        args_->batchSize,
+        args_->dim,
+        output_->size(0),
+        threadId + args_->seed));
+  }
 
   const int64_t ntokens = dict_->ntokens();
   int64_t localTokenCount = 0;
   std::vector<int32_t> line, labels;
+  Dictionary::LineBuffers buffers;
   uint64_t callbackCounter = 0;
+  real lr = args_->lr;
   try {
     while (keepTraining(ntokens)) {
       real progress = real(tokenCount_) / (args_->epoch * ntokens);
@@ -650,31 +1261,32 @@ void FastText::trainThread(int32_t threadId, const TrainCallback& callback) {
             progressInfo(progress);
         callback(progress, loss_, wst, lr, eta);
       }
-      real lr = args_->lr * (1.0 - progress);
-      if (args_->model == model_name::sup) {
-        localTokenCount += dict_->getLine(ifs, line, labels);
-        supervised(state, lr, line, labels);
-      } else if (args_->model == model_name::cbow) {
-        localTokenCount += dict_->getLine(ifs, line, state.rng);
-        cbow(state, lr, line);
-      } else if (args_->model == model_name::sg) {
-        localTokenCount += dict_->getLine(ifs, line, state.rng);
-        skipgram(state, lr, line);
+      lr = args_->lr * (1.0 - progress);
+      if (stream_ && !nextStreamLine(lineStream, lineBuffer)) {
+        break;
+      }
+      if (batch) {
+        localTokenCount += trainLine(in, buffers, *batch, lr, line, labels);
+      } else {
+        localTokenCount += trainLine(in, buffers, state, lr, line, labels);
       }
       if (localTokenCount > args_->lrUpdateRate) {
         tokenCount_ += localTokenCount;
         localTokenCount = 0;
-        if (threadId == 0 && args_->verbose > 1) {
-          loss_ = state.getLoss();
+        if (threadId == 0 && args_->verbose > 1 && (!batch || batch->size())) {
+          loss_ = batch ? batch->getLoss() : state.getLoss();
         }
       }
     }
+    if (batch) {
+      model_->flush(lr, *batch);
+    }
+    tokenCount_ += localTokenCount;
   } catch (DenseMatrix::EncounteredNaNError&) {
     trainException_ = std::current_exception();
   }
   if (threadId == 0)
-    loss_ = state.getLoss();
-  ifs.close();
+    loss_ = batch ? batch->getLoss() : state.getLoss();
 }
 
 std::shared_ptr<Matrix> FastText::getInputMatrixFromFile(
@@ -743,17 +1355,39 @@ std::shared_ptr<Matrix> FastText::createTrainOutputMatrix() const {
 void FastText::train(const Args& args, const TrainCallback& callback) {
   args_ = std::make_shared<Args>(args);
   dict_ = std::make_shared<Dictionary>(args_);
-  if (args_->input == "-") {
-    // manage expectations
-    throw std::invalid_argument("Cannot use stdin for training!");
+  if (!isStreamingInput()) {
+    std::ifstream ifs(args_->input);
+    if (!ifs.is_open()) {
+      throw std::invalid_argument(
+          args_->input + " cannot be opened for training!");
+    }
   }
-  std::ifstream ifs(args_->input);
-  if (!ifs.is_open()) {
+  openCorpus();
+  LineIndex counted;
+  if (!args_->vocabFile.empty()) {
+    std::ifstream vfs(args_->vocabFile);
+    if (!vfs.is_open()) {
+      throw std::invalid_argument(
+          args_->vocabFile + " cannot be opened for training!");
+    }
+    dict_->readVocabulary(vfs);
+  } else if (!args_->vocabInput.empty()) {
+    // a first pass over another copy of the corpus, which may be a pipe
+    std::ifstream vfs(args_->vocabInput);
+    if (!vfs.is_open()) {
+      throw std::invalid_argument(
+          args_->vocabInput + " cannot be opened for training!");
+    }
+    dict_->readFromFile(vfs);
+  } else if (isStreamingInput()) {
     throw std::invalid_argument(
-        args_->input + " cannot be opened for training!");
+        "Training from a stream requires -vocabFile or -vocabInput.");
+  } else if (corpus_) {
+    dict_->readFromFile(corpus_, args_->thread);
+  } else {
+    dict_->readFromFile(args_->input, args_->thread, &counted);
   }
-  dict_->readFromFile(ifs);
-  ifs.close();
+  splitCorpus(counted);
 
   if (!args_->pretrainedVectors.empty()) {
     input_ = getInputMatrixFromFile(args_->pretrainedVectors);
@@ -762,10 +1396,12 @@ void FastText::train(const Args& args, const TrainCallback& callback) {
   }
   output_ = createTrainOutputMatrix();
   quant_ = false;
+  labelIndex_.reset();
   auto loss = createLoss(output_);
   bool normalizeGradient = (args_->model == model_name::sup);
   model_ = std::make_shared<Model>(input_, output_, loss, normalizeGradient);
   startThreads(callback);
+  corpus_.reset();
 }
 
 void FastText::abort() {
@@ -781,9 +1417,16 @@ void FastText::startThreads(const TrainCallback& callback) {
   tokenCount_ = 0;
   loss_ = -1;
   trainException_ = nullptr;
+  std::thread reader;
+  if (isStreamingInput()) {
+    stream_ =
+        std::make_shared<LineQueue>(STREAM_LINES_PER_THREAD * nthreads_);
+    reader = std::thread(
+        streamLines, args_->input, args_->epoch * dict_->ntokens(), stream_);
+  }
   std::vector<std::thread> threads;
-  if (args_->thread > 1) {
-    for (int32_t i = 0; i < args_->thread; i++) {
+  if (nthreads_ > 1) {
+    for (int32_t i = 0; i < nthreads_; i++) {
       threads.push_back(std::thread([=]() { trainThread(i, callback); }));
     }
   } else {
@@ -803,11 +1446,26 @@ void FastText::startThreads(const TrainCallback& callback) {
   for (int32_t i = 0; i < threads.size(); i++) {
     threads[i].join();
   }
+  if (stream_) {
+    // Training may end before the reader does, on an error or at the budget
+    // while the reader waits for the producer to write or close the pipe.
+    // It is not waited for: it stops at its next line on the closed queue.
+    stream_->close();
+    reader.detach();
+    stream_.reset();
+  }
   if (trainException_) {
     std::exception_ptr exception = trainException_;
     trainException_ = nullptr;
     std::rethrow_exception(exception);
   }
+  if (isStreamingInput() && tokenCount_ < args_->epoch * ntokens) {
+    std::cerr << "Warning : the input ended after "
+              << 100 * tokenCount_ / (args_->epoch * ntokens)
+              << "% of the tokens of " << args_->epoch
+              << " epoch(s) of the vocabulary, before the learning rate "
+              << "decayed to 0." << std::endl;
+  }
   if (args_->verbose > 0) {
     std::cerr << "\r";
     printInfo(1.0, loss_, std::cerr);
@@ -823,10 +1481,4 @@ bool FastText::isQuant() const {
   return quant_;
 }
 
-bool comparePairs(
-    const std::pair<real, std::string>& l,
-    const std::pair<real, std::string>& r) {
-  return l.first > r.first;
-}
-
 } // namespace fasttext
@@ -17,15 +17,24 @@
 #include <memory>
 #include <queue>
 #include <set>
+#include <sstream>
 #include <tuple>
 
 #include "args.h"
+#include "compressedfile.h"
 #include "densematrix.h"
 #include "dictionary.h"
+#include "hnswindex.h"
+#include "ivfpqindex.h"
+#include "lineindex.h"
+#include "linequeue.h"
 #include "matrix.h"
 #include "meter.h"
+#include "mipsindex.h"
+#include "mmapmatrix.h"
 #include "model.h"
 #include "real.h"
+#include "stringview.h"
 #include "utils.h"
 #include "vector.h"
 
@@ -36,6 +45,53 @@ class FastText {
   using TrainCallback =
       std::function<void(float, float, double, double, int64_t)>;
 
+  // Buffers of the predictions of one thread: the model state, the tokens of
+  // the line and the predictions themselves. They are reused by every call
+  // to predictLine, so that once they have grown to fit the longest line,
+  // predicting a line makes no heap allocation.
+  class PredictContext {
+   public:
+    explicit PredictContext(const FastText& fasttext);
+    PredictContext(const PredictContext&) = delete;
+    PredictContext& operator=(const PredictContext&) = delete;
+
+    // The predictions of the last line, as returned by predictLine.
+    int32_t size() const {
+      return size_;
+    }
+
+    real probability(int32_t i) const {
+      return results_[i].first;
+    }
+
+    const std::string& label(int32_t i) const {
+      return results_[i].second;
+    }
+
+   protected:
+    friend class FastText;
+
+    // Reads a string in place, where an istringstream would copy it.
+    class StringBuf : public std::streambuf {
+     public:
+      void reset(const std::string& s) {
+        char* data = const_cast<char*>(s.data());
+        setg(data, data, data + s.size());
+      }
+    };
+
+    Model::State state_;
+    StringBuf buf_;
+    std::istream in_;
+    std::vector<int32_t> words_;
+    std::vector<int32_t> labels_;
+    Dictionary::LineBuffers buffers_;
+    Predictions predictions_;
+    // Only grows, so that the labels keep the capacity of their strings.
+    std::vector<std::pair<real, std::string>> results_;
+    int32_t size_;
+  };
+
  protected:
   std::shared_ptr<Args> args_;
   std::shared_ptr<Dictionary> dict_;
@@ -48,18 +104,46 @@ class FastText {
   bool quant_;
   int32_t version;
   std::unique_ptr<DenseMatrix> wordVectors_;
+  // Approximate nearest neighbour index over wordVectors_ or, once loaded
+  // from a file, over its own copy of the word vectors.
+  std::unique_ptr<HnswIndex> nnIndex_;
+  // Compressed index of the word vectors, whose candidates are rescored
+  // with vectors computed from the model, which need not be precomputed.
+  std::unique_ptr<IvfPqIndex> pqIndex_;
+  // Index of the rows of output_, with which predictions score only the
+  // labels that may make the top k.
+  std::shared_ptr<const MipsIndex> labelIndex_;
   std::exception_ptr trainException_;
+  std::shared_ptr<LineQueue> stream_;
+  std::shared_ptr<const CompressedFile> corpus_;
+  std::vector<int64_t> shards_;
+  // Threads that train, no more than shards_ has ranges. args_->thread,
+  // which is saved with the model, keeps the number asked for.
+  int32_t nthreads_;
 
   void signModel(std::ostream&);
   bool checkModel(std::istream&);
+  void loadModel(std::istream& in, std::shared_ptr<const MappedFile> file);
   void startThreads(const TrainCallback& callback = {});
   void addInputVector(Vector&, int32_t) const;
   void trainThread(int32_t, const TrainCallback& callback);
+  bool isStreamingInput() const;
+  void openCorpus();
+  void splitCorpus(const LineIndex& counted);
+  bool nextStreamLine(std::istringstream& in, std::string& buffer);
   std::vector<std::pair<real, std::string>> getNN(
       const DenseMatrix& wordVectors,
       const Vector& queryVec,
       int32_t k,
       const std::set<std::string>& banSet);
+  std::vector<std::pair<real, std::string>> getNN(
+      const Vector& queryVec,
+      int32_t k,
+      const std::set<std::string>& banSet);
+  std::vector<std::pair<real, std::string>> getPQNN(
+      const Vector& queryVec,
+      int32_t k,
+      const std::set<std::string>& banSet);
   void lazyComputeWordVectors();
   void printInfo(real, real, std::ostream&);
   std::shared_ptr<Matrix> getInputMatrixFromFile(const std::string&) const;
@@ -67,13 +151,26 @@ class FastText {
   std::shared_ptr<Matrix> createTrainOutputMatrix() const;
   std::vector<int64_t> getTargetCounts() const;
   std::shared_ptr<Loss> createLoss(std::shared_ptr<Matrix>& output);
+  // State is either Model::State, to update the model after every example,
+  // or Model::BatchState, to update it once per minibatch.
+  template <typename State>
   void supervised(
-      Model::State& state,
+      State& state,
       real lr,
       const std::vector<int32_t>& line,
       const std::vector<int32_t>& labels);
-  void cbow(Model::State& state, real lr, const std::vector<int32_t>& line);
-  void skipgram(Model::State& state, real lr, const std::vector<int32_t>& line);
+  template <typename State>
+  void cbow(State& state, real lr, const std::vector<int32_t>& line);
+  template <typename State>
+  void skipgram(State& state, real lr, const std::vector<int32_t>& line);
+  template <typename State>
+  int64_t trainLine(
+      std::istream& in,
+      Dictionary::LineBuffers& buffers,
+      State& state,
+      real lr,
+      std::vector<int32_t>& line,
+      std::vector<int32_t>& labels);
   std::vector<int32_t> selectEmbeddings(int32_t cutoff) const;
   void precomputeWordVectors(DenseMatrix& wordVectors);
   bool keepTraining(const int64_t ntokens) const;
@@ -89,9 +186,9 @@ class FastText {
 
   int32_t getLabelId(const std::string& label) const;
 
-  void getWordVector(Vector& vec, const std::string& word) const;
+  void getWordVector(Vector& vec, string_view word) const;
 
-  void getSubwordVector(Vector& vec, const std::string& subword) const;
+  void getSubwordVector(Vector& vec, string_view subword) const;
 
   inline void getInputVector(Vector& vec, int32_t ind) {
     vec.zero();
@@ -120,6 +217,8 @@ class FastText {
 
   void loadModel(const std::string& filename);
 
+  void loadModel(const std::string& filename, bool mmap);
+
   void getSentenceVector(std::istream& in, Vector& vec);
 
   void quantize(const Args& qargs, const TrainCallback& callback = {});
@@ -141,6 +240,31 @@ class FastText {
       int32_t k,
       real threshold) const;
 
+  // Variants of predictLine that write the predictions into context, which
+  // must have been created for this model. The second one predicts line,
+  // tokenized as a line read from a stream.
+  bool predictLine(
+      std::istream& in,
+      PredictContext& context,
+      int32_t k,
+      real threshold) const;
+  void predictLine(
+      const std::string& line,
+      PredictContext& context,
+      int32_t k,
+      real threshold) const;
+
+  // Predicts the labels of every line of lines, each tokenized as a line
+  // read by predictLine, into the same position of predictions. The lines
+  // are shared out in minibatches between nthreads threads, each reusing a
+  // single state, and the predictions do not depend on nthreads.
+  void predictBatch(
+      const std::vector<std::string>& lines,
+      std::vector<std::vector<std::pair<real, std::string>>>& predictions,
+      int32_t k,
+      real threshold,
+      int32_t nthreads = 1) const;
+
   std::vector<std::pair<std::string, Vector>> getNgramVectors(
       const std::string& word) const;
 
@@ -154,6 +278,44 @@ class FastText {
       const std::string& wordB,
       const std::string& wordC);
 
+  // getNN and getAnalogies search the index, when there is one, instead of
+  // comparing the query with every word vector.
+  void buildNNIndex(
+      int32_t m,
+      int32_t efConstruction,
+      int32_t efSearch,
+      int32_t thread);
+
+  void saveNNIndex(const std::string& filename) const;
+
+  // efSearch > 0 overrides the value the index was saved with.
+  void loadNNIndex(const std::string& filename, int32_t efSearch = 0);
+
+  // Same for an inverted file of product quantization codes of the word
+  // vectors, with nlist lists, about sqrt(nwords) if 0, and nsubq = dim /
+  // dsub bytes per word, of which queries scan nprobe lists.
+  void buildPQIndex(
+      int32_t nlist,
+      int32_t dsub,
+      int32_t nprobe,
+      int32_t thread);
+
+  void savePQIndex(const std::string& filename) const;
+
+  // nprobe > 0 overrides the value the index was saved with.
+  void loadPQIndex(const std::string& filename, int32_t nprobe = 0);
+
+  // Predictions of softmax and one-vs-all models search the label index,
+  // when there is one, instead of scoring every label. It has nlist lists
+  // of labels, about sqrt(nlabels) if 0. The labels found are the exact top
+  // k; one-vs-all probabilities are exact too, while softmax ones count the
+  // labels that are not scored at the centroid of their list.
+  void buildLabelIndex(int32_t nlist, int32_t thread);
+
+  void saveLabelIndex(const std::string& filename) const;
+
+  void loadLabelIndex(const std::string& filename);
+
   void train(const Args& args, const TrainCallback& callback = {});
 
   void abort();
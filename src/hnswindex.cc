@@ -0,0 +1,408 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "hnswindex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "kernels.h"
+#include "utils.h"
+
+namespace fasttext {
+
+namespace {
+
+constexpr int32_t HNSW_MAGIC = 0x77736e68;
+constexpr int32_t HNSW_VERSION = 1;
+constexpr int32_t DEFAULT_EF_SEARCH = 64;
+// Link lists are guarded by one of LOCK_STRIPES mutexes while building.
+constexpr int32_t LOCK_STRIPES = 1 << 16;
+
+typedef std::pair<real, int32_t> scored;
+
+} // namespace
+
+class HnswIndex::Builder {
+ public:
+  Builder(HnswIndex& index, int32_t efConstruction)
+      : index_(index), efConstruction_(efConstruction), locks_(LOCK_STRIPES) {}
+
+  void insert(int32_t q, std::vector<bool>& visited);
+
+ private:
+  HnswIndex& index_;
+  const int32_t efConstruction_;
+  std::vector<std::mutex> locks_;
+  std::mutex entryMutex_;
+
+  int32_t* links(int32_t i, int32_t level) {
+    return const_cast<int32_t*>(index_.links(i, level));
+  }
+
+  std::mutex& lock(int32_t i) {
+    return locks_[i & (LOCK_STRIPES - 1)];
+  }
+
+  std::vector<int32_t> selectNeighbors(
+      const std::vector<scored>& candidates,
+      int32_t m) const;
+  void connect(int32_t q, const std::vector<int32_t>& neighbors, int32_t level);
+};
+
+// Keeps the candidates, sorted by decreasing similarity to the new node, that
+// are closer to it than to any neighbour kept before them, so that the links
+// of a node point in diverse directions.
+std::vector<int32_t> HnswIndex::Builder::selectNeighbors(
+    const std::vector<scored>& candidates,
+    int32_t m) const {
+  std::vector<int32_t> selected;
+  for (const scored& candidate : candidates) {
+    if (selected.size() >= m) {
+      break;
+    }
+    const real* vec =
+        index_.vectors_ + int64_t(candidate.second) * index_.dim_;
+    bool keep = true;
+    for (int32_t s : selected) {
+      if (index_.similarity(vec, s) > candidate.first) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep) {
+      selected.push_back(candidate.second);
+    }
+  }
+  return selected;
+}
+
+void HnswIndex::Builder::connect(
+    int32_t q,
+    const std::vector<int32_t>& neighbors,
+    int32_t level) {
+  const int32_t maxM = level == 0 ? index_.maxM0_ : index_.m_;
+  {
+    std::lock_guard<std::mutex> guard(lock(q));
+    int32_t* qlinks = links(q, level);
+    qlinks[0] = neighbors.size();
+    std::copy(neighbors.begin(), neighbors.end(), qlinks + 1);
+  }
+  const real* qvec = index_.vectors_ + int64_t(q) * index_.dim_;
+  for (int32_t e : neighbors) {
+    std::lock_guard<std::mutex> guard(lock(e));
+    int32_t* elinks = links(e, level);
+    if (elinks[0] < maxM) {
+      elinks[1 + elinks[0]++] = q;
+      continue;
+    }
+    const real* evec = index_.vectors_ + int64_t(e) * index_.dim_;
+    std::vector<scored> candidates;
+    candidates.emplace_back(kernels::dot(evec, qvec, index_.dim_), q);
+    for (int32_t j = 1; j <= elinks[0]; j++) {
+      candidates.emplace_back(index_.similarity(evec, elinks[j]), elinks[j]);
+    }
+    std::sort(candidates.begin(), candidates.end(), std::greater<scored>());
+    std::vector<int32_t> selected = selectNeighbors(candidates, maxM);
+    elinks[0] = selected.size();
+    std::copy(selected.begin(), selected.end(), elinks + 1);
+  }
+}
+
+void HnswIndex::Builder::insert(int32_t q, std::vector<bool>& visited) {
+  const real* vec = index_.vectors_ + int64_t(q) * index_.dim_;
+  const int32_t level = index_.level(q);
+  // A node that raises the top level keeps the entry point locked until it
+  // is linked, as it becomes the new entry point.
+  std::unique_lock<std::mutex> entryLock(entryMutex_);
+  const int32_t maxLevel = index_.maxLevel_;
+  int32_t entry = index_.entry_;
+  if (entry < 0) {
+    index_.entry_ = q;
+    index_.maxLevel_ = level;
+    return;
+  }
+  if (level <= maxLevel) {
+    entryLock.unlock();
+  }
+  for (int32_t l = maxLevel; l > level; l--) {
+    entry = index_.greedySearch(vec, entry, l, &locks_);
+  }
+  for (int32_t l = std::min(level, maxLevel); l >= 0; l--) {
+    std::vector<scored> candidates =
+        index_.searchLayer(vec, entry, efConstruction_, l, visited, &locks_);
+    candidates.erase(
+        std::remove_if(
+            candidates.begin(),
+            candidates.end(),
+            [q](const scored& c) { return c.second == q; }),
+        candidates.end());
+    if (candidates.empty()) {
+      continue;
+    }
+    connect(q, selectNeighbors(candidates, index_.m_), l);
+    entry = candidates.front().second;
+  }
+  if (level > maxLevel) {
+    index_.entry_ = q;
+    index_.maxLevel_ = level;
+  }
+}
+
+HnswIndex::HnswIndex()
+    : n_(0),
+      dim_(0),
+      m_(0),
+      maxM0_(0),
+      efSearch_(DEFAULT_EF_SEARCH),
+      maxLevel_(-1),
+      entry_(-1),
+      vectors_(nullptr),
+      links0_(nullptr),
+      upperOffsets_(nullptr),
+      upperLinks_(nullptr) {}
+
+int32_t HnswIndex::level(int32_t i) const {
+  return (upperOffsets_[i + 1] - upperOffsets_[i]) / (m_ + 1);
+}
+
+const int32_t* HnswIndex::links(int32_t i, int32_t level) const {
+  if (level == 0) {
+    return links0_ + int64_t(i) * (maxM0_ + 1);
+  }
+  return upperLinks_ + upperOffsets_[i] + int64_t(level - 1) * (m_ + 1);
+}
+
+real HnswIndex::similarity(const real* query, int32_t i) const {
+  return kernels::dot(query, vectors_ + int64_t(i) * dim_, dim_);
+}
+
+void HnswIndex::copyLinks(
+    int32_t i,
+    int32_t level,
+    std::vector<int32_t>& out,
+    std::vector<std::mutex>* locks) const {
+  std::unique_lock<std::mutex> guard;
+  if (locks) {
+    guard = std::unique_lock<std::mutex>((*locks)[i & (LOCK_STRIPES - 1)]);
+  }
+  const int32_t* l = links(i, level);
+  out.assign(l + 1, l + 1 + l[0]);
+}
+
+int32_t HnswIndex::greedySearch(
+    const real* query,
+    int32_t entry,
+    int32_t level,
+    std::vector<std::mutex>* locks) const {
+  std::vector<int32_t> neighbors;
+  int32_t current = entry;
+  real best = similarity(query, current);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    copyLinks(current, level, neighbors, locks);
+    for (int32_t e : neighbors) {
+      real s = similarity(query, e);
+      if (s > best) {
+        best = s;
+        current = e;
+        changed = true;
+      }
+    }
+  }
+  return current;
+}
+
+// Best-first search of layer level from entry, keeping the ef most similar
+// nodes seen. Returns them by decreasing similarity.
+std::vector<scored> HnswIndex::searchLayer(
+    const real* query,
+    int32_t entry,
+    int32_t ef,
+    int32_t level,
+    std::vector<bool>& visited,
+    std::vector<std::mutex>* locks) const {
+  std::priority_queue<scored> candidates;
+  std::priority_queue<scored, std::vector<scored>, std::greater<scored>>
+      results;
+  std::vector<int32_t> seen;
+  std::vector<int32_t> neighbors;
+
+  real s = similarity(query, entry);
+  candidates.emplace(s, entry);
+  results.emplace(s, entry);
+  visited[entry] = true;
+  seen.push_back(entry);
+  while (!candidates.empty()) {
+    scored c = candidates.top();
+    if (results.size() >= ef && c.first < results.top().first) {
+      break;
+    }
+    candidates.pop();
+    copyLinks(c.second, level, neighbors, locks);
+    for (int32_t e : neighbors) {
+      if (visited[e]) {
+        continue;
+      }
+      visited[e] = true;
+      seen.push_back(e);
+      real se = similarity(query, e);
+      if (results.size() < ef || se > results.top().first) {
+        candidates.emplace(se, e);
+        results.emplace(se, e);
+        if (results.size() > ef) {
+          results.pop();
+        }
+      }
+    }
+  }
+  for (int32_t i : seen) {
+    visited[i] = false;
+  }
+
+  std::vector<scored> best(results.size());
+  for (size_t i = best.size(); i > 0; i--) {
+    best[i - 1] = results.top();
+    results.pop();
+  }
+  return best;
+}
+
+void HnswIndex::build(
+    const DenseMatrix& vectors,
+    int32_t m,
+    int32_t efConstruction,
+    int32_t nthreads,
+    int32_t seed) {
+  if (m < 2 || efConstruction < 1) {
+    throw std::invalid_argument(
+        "The index needs m >= 2 and efConstruction >= 1.");
+  }
+  n_ = vectors.rows();
+  dim_ = vectors.cols();
+  m_ = m;
+  maxM0_ = 2 * m;
+  maxLevel_ = -1;
+  entry_ = -1;
+  file_.reset();
+
+  // Level l holds a node with probability m^-l.
+  std::minstd_rand rng(seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  const double levelScale = 1.0 / std::log(double(m));
+  upperOffsetsData_.assign(n_ + 1, 0);
+  for (int32_t i = 0; i < n_; i++) {
+    int64_t level = -std::log(1.0 - uniform(rng)) * levelScale;
+    upperOffsetsData_[i + 1] = upperOffsetsData_[i] + level * (m_ + 1);
+  }
+  links0Data_.assign(int64_t(n_) * (maxM0_ + 1), 0);
+  upperLinksData_.assign(upperOffsetsData_[n_], 0);
+  vectors_ = vectors.data();
+  links0_ = links0Data_.data();
+  upperOffsets_ = upperOffsetsData_.data();
+  upperLinks_ = upperLinksData_.data();
+
+  Builder builder(*this, efConstruction);
+  std::atomic<int32_t> next(0);
+  auto insertRows = [&]() {
+    std::vector<bool> visited(n_);
+    for (int32_t i = next++; i < n_; i = next++) {
+      builder.insert(i, visited);
+    }
+  };
+  if (nthreads <= 1) {
+    insertRows();
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < nthreads; t++) {
+    threads.push_back(std::thread(insertRows));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+std::vector<scored> HnswIndex::search(const real* query, int32_t k) const {
+  if (entry_ < 0 || k <= 0) {
+    return std::vector<scored>();
+  }
+  int32_t entry = entry_;
+  for (int32_t l = maxLevel_; l > 0; l--) {
+    entry = greedySearch(query, entry, l, nullptr);
+  }
+  std::vector<bool> visited(n_);
+  std::vector<scored> best =
+      searchLayer(query, entry, std::max(efSearch_, k), 0, visited, nullptr);
+  if (best.size() > k) {
+    best.resize(k);
+  }
+  return best;
+}
+
+void HnswIndex::save(std::ostream& out) const {
+  out.write((char*)&HNSW_MAGIC, sizeof(int32_t));
+  out.write((char*)&HNSW_VERSION, sizeof(int32_t));
+  out.write((char*)&n_, sizeof(int32_t));
+  out.write((char*)&dim_, sizeof(int32_t));
+  out.write((char*)&m_, sizeof(int32_t));
+  out.write((char*)&efSearch_, sizeof(int32_t));
+  out.write((char*)&maxLevel_, sizeof(int32_t));
+  out.write((char*)&entry_, sizeof(int32_t));
+  utils::writePadding(out, 0);
+  out.write((char*)vectors_, int64_t(n_) * dim_ * sizeof(real));
+  utils::writePadding(out, 0);
+  out.write((char*)links0_, int64_t(n_) * (maxM0_ + 1) * sizeof(int32_t));
+  utils::writePadding(out, 0);
+  out.write((char*)upperOffsets_, int64_t(n_ + 1) * sizeof(int64_t));
+  utils::writePadding(out, 0);
+  out.write((char*)upperLinks_, upperOffsets_[n_] * sizeof(int32_t));
+}
+
+void HnswIndex::load(
+    std::istream& in,
+    std::shared_ptr<const MappedFile> file) {
+  int32_t magic, version;
+  in.read((char*)&magic, sizeof(int32_t));
+  in.read((char*)&version, sizeof(int32_t));
+  if (!in || magic != HNSW_MAGIC || version != HNSW_VERSION) {
+    throw std::invalid_argument("Invalid index file: wrong magic or version.");
+  }
+  in.read((char*)&n_, sizeof(int32_t));
+  in.read((char*)&dim_, sizeof(int32_t));
+  in.read((char*)&m_, sizeof(int32_t));
+  in.read((char*)&efSearch_, sizeof(int32_t));
+  in.read((char*)&maxLevel_, sizeof(int32_t));
+  in.read((char*)&entry_, sizeof(int32_t));
+  if (!in || n_ < 0 || dim_ <= 0 || m_ < 2 || entry_ >= n_ ||
+      (entry_ < 0) != (n_ == 0)) {
+    throw std::invalid_argument("Invalid index file: bad header.");
+  }
+  maxM0_ = 2 * m_;
+  file_ = file;
+  links0Data_.clear();
+  upperOffsetsData_.clear();
+  upperLinksData_.clear();
+  vectors_ = reinterpret_cast<const real*>(
+      utils::mapArray(in, *file_, int64_t(n_) * dim_ * sizeof(real)));
+  links0_ = reinterpret_cast<const int32_t*>(utils::mapArray(
+      in, *file_, int64_t(n_) * (maxM0_ + 1) * sizeof(int32_t)));
+  upperOffsets_ = reinterpret_cast<const int64_t*>(
+      utils::mapArray(in, *file_, int64_t(n_ + 1) * sizeof(int64_t)));
+  upperLinks_ = reinterpret_cast<const int32_t*>(
+      utils::mapArray(in, *file_, upperOffsets_[n_] * sizeof(int32_t)));
+}
+
+} // namespace fasttext
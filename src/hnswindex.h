@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "densematrix.h"
+#include "mappedfile.h"
+#include "real.h"
+
+namespace fasttext {
+
+// Hierarchical navigable small world graph (Malkov and Yashunin, 2016) over
+// the rows of a matrix of normalized vectors, for approximate maximum inner
+// product search. Every node has up to 2 * m neighbours on layer 0 and up to
+// m on the upper layers it belongs to; a search explores efSearch candidates
+// on layer 0, which trades recall for latency.
+//
+// An index built in memory points to the rows of the matrix it was built on.
+// A saved index holds a copy of the vectors, so that a loaded one can be
+// searched in place from a memory-mapped file.
+class HnswIndex {
+ protected:
+  int32_t n_;
+  int32_t dim_;
+  int32_t m_;
+  int32_t maxM0_;
+  int32_t efSearch_;
+  int32_t maxLevel_;
+  int32_t entry_;
+
+  // Links of node i on layer 0: a count followed by maxM0_ slots, at
+  // links0_[i * (maxM0_ + 1)]. Its links on layer l > 0 are at
+  // upperLinks_[upperOffsets_[i] + (l - 1) * (m_ + 1)], in the same format.
+  const real* vectors_;
+  const int32_t* links0_;
+  const int64_t* upperOffsets_;
+  const int32_t* upperLinks_;
+
+  std::vector<int32_t> links0Data_;
+  std::vector<int64_t> upperOffsetsData_;
+  std::vector<int32_t> upperLinksData_;
+  std::shared_ptr<const MappedFile> file_;
+
+  class Builder;
+
+  int32_t level(int32_t i) const;
+  const int32_t* links(int32_t i, int32_t level) const;
+  real similarity(const real* query, int32_t i) const;
+  // The link lists are read under locks while the index is being built.
+  void copyLinks(
+      int32_t i,
+      int32_t level,
+      std::vector<int32_t>& out,
+      std::vector<std::mutex>* locks) const;
+  int32_t greedySearch(
+      const real* query,
+      int32_t entry,
+      int32_t level,
+      std::vector<std::mutex>* locks) const;
+  std::vector<std::pair<real, int32_t>> searchLayer(
+      const real* query,
+      int32_t entry,
+      int32_t ef,
+      int32_t level,
+      std::vector<bool>& visited,
+      std::vector<std::mutex>* locks) const;
+
+ public:
+  HnswIndex();
+  HnswIndex(const HnswIndex&) = delete;
+  HnswIndex& operator=(const HnswIndex&) = delete;
+
+  int32_t size() const {
+    return n_;
+  }
+
+  int32_t dim() const {
+    return dim_;
+  }
+
+  int32_t getEfSearch() const {
+    return efSearch_;
+  }
+
+  void setEfSearch(int32_t ef) {
+    efSearch_ = ef;
+  }
+
+  // Indexes the rows of vectors, which must outlive the index, on nthreads
+  // threads. The graph depends on the order in which the threads insert the
+  // rows, and is only reproducible with a single thread.
+  void build(
+      const DenseMatrix& vectors,
+      int32_t m,
+      int32_t efConstruction,
+      int32_t nthreads,
+      int32_t seed);
+
+  // The k rows of largest inner product with query, in decreasing order.
+  std::vector<std::pair<real, int32_t>> search(const real* query, int32_t k)
+      const;
+
+  void save(std::ostream&) const;
+  // Reads an index saved in file, whose arrays stay in the file's mapping.
+  void load(std::istream&, std::shared_ptr<const MappedFile> file);
+};
+
+} // namespace fasttext
@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "int8matrix.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "densematrix.h"
+#include "kernels.h"
+#include "vector.h"
+
+namespace fasttext {
+
+namespace {
+
+constexpr real INT8_MAX_CODE = 127.0;
+
+// Writes the codes of the n values of x to codes and returns their scale.
+real quantizeRow(const real* x, int8_t* codes, int64_t n) {
+  real maxAbs = 0.0;
+  for (int64_t j = 0; j < n; j++) {
+    maxAbs = std::max(maxAbs, std::abs(x[j]));
+  }
+  if (maxAbs == 0.0) {
+    std::fill(codes, codes + n, 0);
+    return 0.0;
+  }
+  const real scale = maxAbs / INT8_MAX_CODE;
+  for (int64_t j = 0; j < n; j++) {
+    real code = std::round(x[j] / scale);
+    codes[j] = int8_t(std::max(-INT8_MAX_CODE, std::min(INT8_MAX_CODE, code)));
+  }
+  return scale;
+}
+
+} // namespace
+
+Int8Matrix::Int8Matrix() : Matrix() {}
+
+Int8Matrix::Int8Matrix(const DenseMatrix& mat)
+    : Matrix(mat.size(0), mat.size(1)), scales_(m_), codes_(m_ * n_) {
+  for (int64_t i = 0; i < m_; i++) {
+    scales_[i] = quantizeRow(mat.data() + i * n_, codes_.data() + i * n_, n_);
+  }
+}
+
+real Int8Matrix::dotRow(const Vector& vec, int64_t i) const {
+  assert(i >= 0);
+  assert(i < m_);
+  assert(vec.size() == n_);
+  return scales_[i] * kernels::dot(vec.data(), row(i), n_);
+}
+
+void Int8Matrix::addVectorToRow(const Vector&, int64_t, real) {
+  throw std::runtime_error("Operation not permitted on quantized matrices.");
+}
+
+void Int8Matrix::addRowToVector(Vector& x, int32_t i) const {
+  addRowToVector(x, i, 1.0);
+}
+
+void Int8Matrix::addRowToVector(Vector& x, int32_t i, real a) const {
+  assert(i >= 0);
+  assert(i < this->size(0));
+  assert(x.size() == this->size(1));
+  kernels::axpy(a * scales_[i], row(i), x.data(), n_);
+}
+
+// x is quantized like a row, which turns every dot product with a row into
+// an integer one.
+void Int8Matrix::mulVector(const Vector& x, Vector& out) const {
+  assert(x.size() == n_);
+  assert(out.size() == m_);
+  // Scratch space of the thread, so that scoring a vector does not allocate.
+  static thread_local std::vector<int8_t> query;
+  query.resize(n_);
+  const real scale = quantizeRow(x.data(), query.data(), n_);
+  for (int64_t i = 0; i < m_; i++) {
+    out[i] = scale * scales_[i] * kernels::dotInt8(query.data(), row(i), n_);
+  }
+}
+
+void Int8Matrix::dotRows(const DenseMatrix& x, DenseMatrix& out, int64_t n)
+    const {
+  assert(x.cols() == n_);
+  assert(out.cols() == m_);
+  assert(n <= x.rows() && n <= out.rows());
+  std::vector<int8_t> query(n_);
+  for (int64_t b = 0; b < n; b++) {
+    const real scale = quantizeRow(x.data() + b * n_, query.data(), n_);
+    real* ob = out.data() + b * m_;
+    for (int64_t i = 0; i < m_; i++) {
+      ob[i] = scale * scales_[i] * kernels::dotInt8(query.data(), row(i), n_);
+    }
+  }
+}
+
+void Int8Matrix::save(std::ostream& out) const {
+  out.write((char*)&m_, sizeof(int64_t));
+  out.write((char*)&n_, sizeof(int64_t));
+  out.write((char*)scales_.data(), m_ * sizeof(real));
+  out.write((char*)codes_.data(), m_ * n_ * sizeof(int8_t));
+}
+
+void Int8Matrix::load(std::istream& in) {
+  in.read((char*)&m_, sizeof(int64_t));
+  in.read((char*)&n_, sizeof(int64_t));
+  scales_ = std::vector<real>(m_);
+  in.read((char*)scales_.data(), m_ * sizeof(real));
+  codes_ = std::vector<int8_t>(m_ * n_);
+  in.read((char*)codes_.data(), m_ * n_ * sizeof(int8_t));
+}
+
+void Int8Matrix::dump(std::ostream& out) const {
+  out << m_ << " " << n_ << std::endl;
+  for (int64_t i = 0; i < m_; i++) {
+    for (int64_t j = 0; j < n_; j++) {
+      if (j > 0) {
+        out << " ";
+      }
+      out << scales_[i] * row(i)[j];
+    }
+    out << std::endl;
+  }
+}
+
+} // namespace fasttext
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "matrix.h"
+#include "real.h"
+
+namespace fasttext {
+
+class Vector;
+class DenseMatrix;
+
+// Matrix whose rows are stored as 8-bit integers in [-127, 127] with one
+// scale per row, so that row i is approximately scales_[i] * codes of i.
+// It takes a quarter of the memory of a DenseMatrix and loses far less
+// precision than product quantization. Rows are added and scored against
+// real vectors directly from the bytes, while whole matrix products quantize
+// the input vectors to bytes as well, to run on integer dot products.
+class Int8Matrix : public Matrix {
+ protected:
+  std::vector<real> scales_;
+  std::vector<int8_t> codes_;
+
+  inline const int8_t* row(int64_t i) const {
+    return codes_.data() + i * n_;
+  }
+
+ public:
+  Int8Matrix();
+  explicit Int8Matrix(const DenseMatrix&);
+  Int8Matrix(const Int8Matrix&) = delete;
+  Int8Matrix& operator=(const Int8Matrix&) = delete;
+  virtual ~Int8Matrix() noexcept override = default;
+
+  real dotRow(const Vector&, int64_t) const override;
+  void addVectorToRow(const Vector&, int64_t, real) override;
+  void addRowToVector(Vector& x, int32_t i) const override;
+  void addRowToVector(Vector& x, int32_t i, real a) const override;
+  void mulVector(const Vector& x, Vector& out) const override;
+  void dotRows(const DenseMatrix& x, DenseMatrix& out, int64_t n)
+      const override;
+  void save(std::ostream&) const override;
+  void load(std::istream&) override;
+  void dump(std::ostream&) const override;
+};
+
+} // namespace fasttext
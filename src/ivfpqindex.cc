@@ -0,0 +1,337 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "ivfpqindex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "kernels.h"
+#include "utils.h"
+
+namespace fasttext {
+
+namespace {
+
+constexpr int32_t IVFPQ_MAGIC = 0x71667669;
+constexpr int32_t IVFPQ_VERSION = 1;
+constexpr int32_t DEFAULT_NPROBE = 16;
+constexpr int32_t COARSE_NITER = 20;
+// The coarse quantizer and the product quantizer are trained on a sample of
+// at least COARSE_SAMPLE vectors, and at least COARSE_SAMPLE_PER_LIST
+// vectors per list.
+constexpr int32_t COARSE_SAMPLE = 1 << 16;
+constexpr int32_t COARSE_SAMPLE_PER_LIST = 64;
+// Vectors are assigned to lists by batches of ASSIGN_BATCH.
+constexpr int64_t ASSIGN_BATCH = 256;
+
+typedef std::pair<real, int32_t> scored;
+
+// Calls fn on nthreads contiguous ranges of [0, n), one per thread.
+void parallelFor(
+    int64_t n,
+    int32_t nthreads,
+    const std::function<void(int64_t, int64_t)>& fn) {
+  nthreads = std::max<int64_t>(1, std::min<int64_t>(nthreads, n));
+  if (nthreads == 1) {
+    fn(0, n);
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < nthreads; t++) {
+    threads.push_back(
+        std::thread(fn, n * t / nthreads, n * (t + 1) / nthreads));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+} // namespace
+
+IvfPqIndex::IvfPqIndex()
+    : n_(0),
+      dim_(0),
+      nlist_(0),
+      nprobe_(DEFAULT_NPROBE),
+      centroids_(nullptr),
+      listOffsets_(nullptr),
+      ids_(nullptr),
+      codes_(nullptr) {}
+
+// lists[i] is the list whose centroid is the closest to row i of x in L2
+// distance, that is the one maximizing x.c - |c|^2 / 2.
+void IvfPqIndex::assign(const real* x, int64_t nx, int32_t* lists) const {
+  std::vector<real> halfNorms(nlist_);
+  for (int32_t l = 0; l < nlist_; l++) {
+    const real* c = centroids_ + int64_t(l) * dim_;
+    halfNorms[l] = 0.5 * kernels::dot(c, c, dim_);
+  }
+  std::vector<real> dots(ASSIGN_BATCH * nlist_);
+  for (int64_t b = 0; b < nx; b += ASSIGN_BATCH) {
+    const int64_t nb = std::min(ASSIGN_BATCH, nx - b);
+    kernels::dotRows(centroids_, nlist_, dim_, x + b * dim_, nb, dots.data());
+    for (int64_t i = 0; i < nb; i++) {
+      const real* d = dots.data() + i * nlist_;
+      int32_t best = 0;
+      for (int32_t l = 1; l < nlist_; l++) {
+        if (d[l] - halfNorms[l] > d[best] - halfNorms[best]) {
+          best = l;
+        }
+      }
+      lists[b + i] = best;
+    }
+  }
+}
+
+// Lloyd's k-means on the sample, seeded with its first nlist_ vectors. An
+// empty list gets a random vector of the sample as its new centroid.
+void IvfPqIndex::trainCoarse(
+    const std::vector<real>& sample,
+    int32_t nsample,
+    int32_t nthreads,
+    int32_t seed) {
+  std::minstd_rand rng(seed);
+  std::uniform_int_distribution<int32_t> uniform(0, nsample - 1);
+  centroidsData_.assign(
+      sample.begin(), sample.begin() + int64_t(nlist_) * dim_);
+  centroids_ = centroidsData_.data();
+  std::vector<int32_t> lists(nsample);
+  std::vector<int32_t> counts(nlist_);
+  for (int32_t iter = 0; iter < COARSE_NITER; iter++) {
+    parallelFor(nsample, nthreads, [&](int64_t begin, int64_t end) {
+      assign(sample.data() + begin * dim_, end - begin, lists.data() + begin);
+    });
+    std::fill(centroidsData_.begin(), centroidsData_.end(), 0.0);
+    std::fill(counts.begin(), counts.end(), 0);
+    for (int32_t i = 0; i < nsample; i++) {
+      kernels::axpy(
+          1.0,
+          sample.data() + int64_t(i) * dim_,
+          centroidsData_.data() + int64_t(lists[i]) * dim_,
+          dim_);
+      counts[lists[i]]++;
+    }
+    for (int32_t l = 0; l < nlist_; l++) {
+      real* c = centroidsData_.data() + int64_t(l) * dim_;
+      if (counts[l] == 0) {
+        const real* x = sample.data() + int64_t(uniform(rng)) * dim_;
+        std::copy(x, x + dim_, c);
+        continue;
+      }
+      for (int32_t j = 0; j < dim_; j++) {
+        c[j] /= counts[l];
+      }
+    }
+  }
+}
+
+void IvfPqIndex::build(
+    int32_t n,
+    int32_t dim,
+    const VectorFunction& vector,
+    int32_t nlist,
+    int32_t dsub,
+    int32_t nthreads,
+    int32_t seed) {
+  if (nlist <= 0) {
+    nlist = std::max(1, int32_t(std::sqrt(double(n))));
+  }
+  if (nlist > n || dsub < 1 || dsub > dim) {
+    throw std::invalid_argument(
+        "The index needs 0 < nlist <= n and 0 < dsub <= dim.");
+  }
+  n_ = n;
+  dim_ = dim;
+  nlist_ = nlist;
+  file_.reset();
+
+  std::vector<int32_t> perm(n_);
+  std::iota(perm.begin(), perm.end(), 0);
+  std::minstd_rand rng(seed);
+  std::shuffle(perm.begin(), perm.end(), rng);
+  const int32_t nsample = std::min<int64_t>(
+      n_,
+      std::max<int64_t>(
+          COARSE_SAMPLE, int64_t(COARSE_SAMPLE_PER_LIST) * nlist_));
+  std::vector<real> sample(int64_t(nsample) * dim_);
+  parallelFor(nsample, nthreads, [&](int64_t begin, int64_t end) {
+    Vector vec(dim_);
+    for (int64_t i = begin; i < end; i++) {
+      vector(perm[i], vec);
+      std::copy(vec.data(), vec.data() + dim_, sample.data() + i * dim_);
+    }
+  });
+  trainCoarse(sample, nsample, nthreads, seed);
+
+  std::vector<int32_t> lists(nsample);
+  assign(sample.data(), nsample, lists.data());
+  for (int32_t i = 0; i < nsample; i++) {
+    kernels::axpy(
+        -1.0,
+        centroids_ + int64_t(lists[i]) * dim_,
+        sample.data() + int64_t(i) * dim_,
+        dim_);
+  }
+  pq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer(dim_, dsub));
+  pq_->train(nsample, sample.data(), nthreads);
+  sample = std::vector<real>();
+
+  const int32_t nsubq = pq_->get_nsubq();
+  lists.resize(n_);
+  std::vector<uint8_t> codes(int64_t(n_) * nsubq);
+  parallelFor(n_, nthreads, [&](int64_t begin, int64_t end) {
+    Vector vec(dim_);
+    std::vector<real> batch(ASSIGN_BATCH * dim_);
+    for (int64_t b = begin; b < end; b += ASSIGN_BATCH) {
+      const int64_t nb = std::min(ASSIGN_BATCH, end - b);
+      for (int64_t i = 0; i < nb; i++) {
+        vector(b + i, vec);
+        std::copy(vec.data(), vec.data() + dim_, batch.data() + i * dim_);
+      }
+      assign(batch.data(), nb, lists.data() + b);
+      for (int64_t i = 0; i < nb; i++) {
+        real* x = batch.data() + i * dim_;
+        const real* c = centroids_ + int64_t(lists[b + i]) * dim_;
+        kernels::axpy(-1.0, c, x, dim_);
+        pq_->compute_code(x, codes.data() + (b + i) * nsubq);
+      }
+    }
+  });
+
+  listOffsetsData_.assign(nlist_ + 1, 0);
+  for (int32_t i = 0; i < n_; i++) {
+    listOffsetsData_[lists[i] + 1]++;
+  }
+  std::partial_sum(
+      listOffsetsData_.begin(),
+      listOffsetsData_.end(),
+      listOffsetsData_.begin());
+  std::vector<int64_t> next(listOffsetsData_.begin(), listOffsetsData_.end());
+  idsData_.resize(n_);
+  codesData_.resize(int64_t(n_) * nsubq);
+  for (int32_t i = 0; i < n_; i++) {
+    int64_t j = next[lists[i]]++;
+    idsData_[j] = i;
+    std::memcpy(
+        codesData_.data() + j * nsubq,
+        codes.data() + int64_t(i) * nsubq,
+        nsubq);
+  }
+  listOffsets_ = listOffsetsData_.data();
+  ids_ = idsData_.data();
+  codes_ = codesData_.data();
+}
+
+// The inner product of the query with vector c + r of list l is q.c + q.r,
+// where q.r is approximated by the sum of the table entries of the code of
+// r. The table does not depend on the list.
+std::vector<scored> IvfPqIndex::search(const real* query, int32_t k) const {
+  if (n_ == 0 || k <= 0) {
+    return std::vector<scored>();
+  }
+  std::vector<real> coarse(nlist_);
+  kernels::dotRows(centroids_, nlist_, dim_, query, 1, coarse.data());
+  std::vector<int32_t> probes(nlist_);
+  std::iota(probes.begin(), probes.end(), 0);
+  const int32_t nprobe = std::max(1, std::min(nprobe_, nlist_));
+  std::partial_sort(
+      probes.begin(),
+      probes.begin() + nprobe,
+      probes.end(),
+      [&coarse](int32_t a, int32_t b) { return coarse[a] > coarse[b]; });
+
+  const int32_t nsubq = pq_->get_nsubq();
+  const int32_t ksub = pq_->get_ksub();
+  std::vector<real> table(int64_t(nsubq) * ksub);
+  pq_->compute_dot_table(query, table.data());
+
+  std::priority_queue<scored, std::vector<scored>, std::greater<scored>> heap;
+  for (int32_t p = 0; p < nprobe; p++) {
+    const int32_t l = probes[p];
+    for (int64_t j = listOffsets_[l]; j < listOffsets_[l + 1]; j++) {
+      real score = coarse[l] + pq_->mulcode(table.data(), codes_, j, 1.0);
+      if (heap.size() < k) {
+        heap.emplace(score, ids_[j]);
+      } else if (score > heap.top().first) {
+        heap.pop();
+        heap.emplace(score, ids_[j]);
+      }
+    }
+  }
+
+  std::vector<scored> best(heap.size());
+  for (size_t i = best.size(); i > 0; i--) {
+    best[i - 1] = heap.top();
+    heap.pop();
+  }
+  return best;
+}
+
+void IvfPqIndex::save(std::ostream& out) const {
+  const int64_t codesize = int64_t(n_) * pq_->get_nsubq();
+  out.write((char*)&IVFPQ_MAGIC, sizeof(int32_t));
+  out.write((char*)&IVFPQ_VERSION, sizeof(int32_t));
+  out.write((char*)&n_, sizeof(int32_t));
+  out.write((char*)&dim_, sizeof(int32_t));
+  out.write((char*)&nlist_, sizeof(int32_t));
+  out.write((char*)&nprobe_, sizeof(int32_t));
+  pq_->save(out);
+  utils::writePadding(out, 0);
+  out.write((char*)centroids_, int64_t(nlist_) * dim_ * sizeof(real));
+  utils::writePadding(out, 0);
+  out.write((char*)listOffsets_, int64_t(nlist_ + 1) * sizeof(int64_t));
+  utils::writePadding(out, 0);
+  out.write((char*)ids_, int64_t(n_) * sizeof(int32_t));
+  utils::writePadding(out, 0);
+  out.write((char*)codes_, codesize * sizeof(uint8_t));
+}
+
+void IvfPqIndex::load(
+    std::istream& in,
+    std::shared_ptr<const MappedFile> file) {
+  int32_t magic, version;
+  in.read((char*)&magic, sizeof(int32_t));
+  in.read((char*)&version, sizeof(int32_t));
+  if (!in || magic != IVFPQ_MAGIC || version != IVFPQ_VERSION) {
+    throw std::invalid_argument("Invalid index file: wrong magic or version.");
+  }
+  in.read((char*)&n_, sizeof(int32_t));
+  in.read((char*)&dim_, sizeof(int32_t));
+  in.read((char*)&nlist_, sizeof(int32_t));
+  in.read((char*)&nprobe_, sizeof(int32_t));
+  if (!in || n_ <= 0 || dim_ <= 0 || nlist_ <= 0 || nlist_ > n_) {
+    throw std::invalid_argument("Invalid index file: bad header.");
+  }
+  pq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer());
+  pq_->load(in);
+  file_ = file;
+  centroidsData_.clear();
+  listOffsetsData_.clear();
+  idsData_.clear();
+  codesData_.clear();
+  centroids_ = reinterpret_cast<const real*>(
+      utils::mapArray(in, *file_, int64_t(nlist_) * dim_ * sizeof(real)));
+  listOffsets_ = reinterpret_cast<const int64_t*>(
+      utils::mapArray(in, *file_, int64_t(nlist_ + 1) * sizeof(int64_t)));
+  ids_ = reinterpret_cast<const int32_t*>(
+      utils::mapArray(in, *file_, int64_t(n_) * sizeof(int32_t)));
+  codes_ = reinterpret_cast<const uint8_t*>(utils::mapArray(
+      in, *file_, int64_t(n_) * pq_->get_nsubq() * sizeof(uint8_t)));
+  if (listOffsets_[0] != 0 || listOffsets_[nlist_] != n_) {
+    throw std::invalid_argument("Invalid index file: bad inverted lists.");
+  }
+}
+
+} // namespace fasttext
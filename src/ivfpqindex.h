@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "mappedfile.h"
+#include "productquantizer.h"
+#include "real.h"
+#include "vector.h"
+
+namespace fasttext {
+
+// Inverted file of product quantization codes (Jegou et al., 2011), for
+// approximate maximum inner product search over normalized vectors that are
+// never held in memory all at once. A coarse k-means splits the vectors into
+// nlist lists, and each vector is stored as the code of its residual to the
+// centroid of its list, nsubq bytes. A query scans the codes of the nprobe
+// lists whose centroids are closest to it, scoring every code with nsubq
+// lookups in a table of its inner products with the centroids of the
+// product quantizer.
+class IvfPqIndex {
+ protected:
+  int32_t n_;
+  int32_t dim_;
+  int32_t nlist_;
+  int32_t nprobe_;
+  std::unique_ptr<ProductQuantizer> pq_;
+
+  // The ids and codes of the vectors of list l are at positions
+  // [listOffsets_[l], listOffsets_[l + 1]) of ids_ and codes_.
+  const real* centroids_;
+  const int64_t* listOffsets_;
+  const int32_t* ids_;
+  const uint8_t* codes_;
+
+  std::vector<real> centroidsData_;
+  std::vector<int64_t> listOffsetsData_;
+  std::vector<int32_t> idsData_;
+  std::vector<uint8_t> codesData_;
+  std::shared_ptr<const MappedFile> file_;
+
+  void assign(const real* x, int64_t nx, int32_t* lists) const;
+  void trainCoarse(
+      const std::vector<real>& sample,
+      int32_t nsample,
+      int32_t nthreads,
+      int32_t seed);
+
+ public:
+  // Writes vector i into its second argument.
+  typedef std::function<void(int32_t, Vector&)> VectorFunction;
+
+  IvfPqIndex();
+  IvfPqIndex(const IvfPqIndex&) = delete;
+  IvfPqIndex& operator=(const IvfPqIndex&) = delete;
+
+  int32_t size() const {
+    return n_;
+  }
+
+  int32_t dim() const {
+    return dim_;
+  }
+
+  int32_t getNProbe() const {
+    return nprobe_;
+  }
+
+  void setNProbe(int32_t nprobe) {
+    nprobe_ = nprobe;
+  }
+
+  // Indexes n vectors of dimension dim, computed by vector from nthreads
+  // threads at once, into nlist lists, or about sqrt(n) if nlist is 0, with
+  // one byte of code per dsub dimensions.
+  void build(
+      int32_t n,
+      int32_t dim,
+      const VectorFunction& vector,
+      int32_t nlist,
+      int32_t dsub,
+      int32_t nthreads,
+      int32_t seed);
+
+  // The k vectors of largest approximate inner product with query, in
+  // decreasing order.
+  std::vector<std::pair<real, int32_t>> search(const real* query, int32_t k)
+      const;
+
+  void save(std::ostream&) const;
+  // Reads an index saved in file, whose arrays stay in the file's mapping.
+  void load(std::istream&, std::shared_ptr<const MappedFile> file);
+};
+
+} // namespace fasttext
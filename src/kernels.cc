@@ -0,0 +1,835 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "kernels.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(__EMSCRIPTEN__)
+#define FASTTEXT_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace fasttext {
+
+namespace kernels {
+
+namespace {
+
+// Rows of w visited together by dotRows and addRows, sized so that a block
+// stays in L1 while every row of x streams over it.
+constexpr int64_t GEMM_BLOCK_SIZE = 8192;
+
+inline int64_t gemmBlock(int64_t n) {
+  return std::max(int64_t(1), GEMM_BLOCK_SIZE / (n + 1));
+}
+
+typedef real (*dot_fn)(const real*, const real*, int64_t);
+typedef double (*sumSquares_fn)(const real*, int64_t);
+typedef void (*axpy_fn)(real, const real*, real*, int64_t);
+typedef int64_t (
+    *nearest_fn)(const real*, const real*, int64_t, int64_t, real*);
+typedef real (*dot8_fn)(const real*, const int8_t*, int64_t);
+typedef void (*axpy8_fn)(real, const int8_t*, real*, int64_t);
+typedef int32_t (*dotInt8_fn)(const int8_t*, const int8_t*, int64_t);
+
+struct KernelTable {
+  isa_name isa;
+  dot_fn dot;
+  sumSquares_fn sumSquares;
+  axpy_fn axpy;
+  nearest_fn nearestColumn;
+  dot8_fn dot8;
+  axpy8_fn axpy8;
+  dotInt8_fn dotInt8;
+};
+
+real dotScalar(const real* x, const real* y, int64_t n) {
+  real d = 0.0;
+  for (int64_t j = 0; j < n; j++) {
+    d += x[j] * y[j];
+  }
+  return d;
+}
+
+double sumSquaresScalar(const real* x, int64_t n) {
+  double d = 0.0;
+  for (int64_t j = 0; j < n; j++) {
+    d += x[j] * x[j];
+  }
+  return d;
+}
+
+void axpyScalar(real a, const real* x, real* y, int64_t n) {
+  for (int64_t j = 0; j < n; j++) {
+    y[j] += a * x[j];
+  }
+}
+
+real dot8Scalar(const real* x, const int8_t* y, int64_t n) {
+  real d = 0.0;
+  for (int64_t j = 0; j < n; j++) {
+    d += x[j] * y[j];
+  }
+  return d;
+}
+
+void axpy8Scalar(real a, const int8_t* x, real* y, int64_t n) {
+  for (int64_t j = 0; j < n; j++) {
+    y[j] += a * x[j];
+  }
+}
+
+int32_t dotInt8Scalar(const int8_t* x, const int8_t* y, int64_t n) {
+  int32_t d = 0;
+  for (int64_t j = 0; j < n; j++) {
+    d += int32_t(x[j]) * y[j];
+  }
+  return d;
+}
+
+// Distance of x to column j of c, in the order of every vectorized variant.
+inline real columnDistance(
+    const real* x,
+    const real* c,
+    int64_t n,
+    int64_t k,
+    int64_t j) {
+  real d = 0.0;
+  for (int64_t i = 0; i < n; i++) {
+    real t = x[i] - c[i * k + j];
+    d += t * t;
+  }
+  return d;
+}
+
+int64_t nearestColumnScalar(
+    const real* x,
+    const real* c,
+    int64_t n,
+    int64_t k,
+    real* dist) {
+  int64_t best = 0;
+  real bestDist = columnDistance(x, c, n, k, 0);
+  for (int64_t j = 1; j < k; j++) {
+    real d = columnDistance(x, c, n, k, j);
+    if (d < bestDist) {
+      best = j;
+      bestDist = d;
+    }
+  }
+  *dist = bestDist;
+  return best;
+}
+
+// Merges the best distance and index of each lane, found by a vectorized
+// variant over the first k0 columns, with the scalar search of the rest.
+int64_t mergeNearest(
+    const real* x,
+    const real* c,
+    int64_t n,
+    int64_t k,
+    int64_t k0,
+    const real* laneDist,
+    const int32_t* laneIdx,
+    int64_t lanes,
+    real* dist) {
+  int64_t best = laneIdx[0];
+  real bestDist = laneDist[0];
+  for (int64_t l = 1; l < lanes; l++) {
+    if (laneDist[l] < bestDist ||
+        (laneDist[l] == bestDist && laneIdx[l] < best)) {
+      best = laneIdx[l];
+      bestDist = laneDist[l];
+    }
+  }
+  for (int64_t j = k0; j < k; j++) {
+    real d = columnDistance(x, c, n, k, j);
+    if (d < bestDist) {
+      best = j;
+      bestDist = d;
+    }
+  }
+  *dist = bestDist;
+  return best;
+}
+
+#ifdef FASTTEXT_X86_DISPATCH
+
+__attribute__((target("sse2"))) real
+dotSSE2(const real* x, const real* y, int64_t n) {
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    acc0 = _mm_add_ps(
+        acc0, _mm_mul_ps(_mm_loadu_ps(x + j), _mm_loadu_ps(y + j)));
+    acc1 = _mm_add_ps(
+        acc1, _mm_mul_ps(_mm_loadu_ps(x + j + 4), _mm_loadu_ps(y + j + 4)));
+  }
+  for (; j + 4 <= n; j += 4) {
+    acc0 = _mm_add_ps(
+        acc0, _mm_mul_ps(_mm_loadu_ps(x + j), _mm_loadu_ps(y + j)));
+  }
+  acc0 = _mm_add_ps(acc0, acc1);
+  acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+  acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+  real d = _mm_cvtss_f32(acc0);
+  for (; j < n; j++) {
+    d += x[j] * y[j];
+  }
+  return d;
+}
+
+__attribute__((target("sse2"))) double
+sumSquaresSSE2(const real* x, int64_t n) {
+  __m128d acc0 = _mm_setzero_pd();
+  __m128d acc1 = _mm_setzero_pd();
+  int64_t j = 0;
+  for (; j + 4 <= n; j += 4) {
+    __m128 v = _mm_loadu_ps(x + j);
+    v = _mm_mul_ps(v, v);
+    acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(v));
+    acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+  }
+  acc0 = _mm_add_pd(acc0, acc1);
+  double d = _mm_cvtsd_f64(_mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0)));
+  for (; j < n; j++) {
+    d += x[j] * x[j];
+  }
+  return d;
+}
+
+__attribute__((target("sse2"))) void
+axpySSE2(real a, const real* x, real* y, int64_t n) {
+  const __m128 va = _mm_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 4 <= n; j += 4) {
+    __m128 vy = _mm_loadu_ps(y + j);
+    vy = _mm_add_ps(vy, _mm_mul_ps(va, _mm_loadu_ps(x + j)));
+    _mm_storeu_ps(y + j, vy);
+  }
+  for (; j < n; j++) {
+    y[j] += a * x[j];
+  }
+}
+
+__attribute__((target("sse2"))) int64_t nearestColumnSSE2(
+    const real* x,
+    const real* c,
+    int64_t n,
+    int64_t k,
+    real* dist) {
+  if (k < 4) {
+    return nearestColumnScalar(x, c, n, k, dist);
+  }
+  __m128 bestDist = _mm_set1_ps(std::numeric_limits<real>::infinity());
+  __m128i bestIdx = _mm_setzero_si128();
+  __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128i step = _mm_set1_epi32(4);
+  int64_t j = 0;
+  for (; j + 4 <= k; j += 4) {
+    __m128 d = _mm_setzero_ps();
+    for (int64_t i = 0; i < n; i++) {
+      __m128 t = _mm_sub_ps(_mm_set1_ps(x[i]), _mm_loadu_ps(c + i * k + j));
+      d = _mm_add_ps(d, _mm_mul_ps(t, t));
+    }
+    __m128 closer = _mm_cmplt_ps(d, bestDist);
+    bestDist = _mm_or_ps(
+        _mm_and_ps(closer, d), _mm_andnot_ps(closer, bestDist));
+    __m128i mask = _mm_castps_si128(closer);
+    bestIdx = _mm_or_si128(
+        _mm_and_si128(mask, idx), _mm_andnot_si128(mask, bestIdx));
+    idx = _mm_add_epi32(idx, step);
+  }
+  real laneDist[4];
+  int32_t laneIdx[4];
+  _mm_storeu_ps(laneDist, bestDist);
+  _mm_storeu_si128((__m128i*)laneIdx, bestIdx);
+  return mergeNearest(x, c, n, k, j, laneDist, laneIdx, 4, dist);
+}
+
+// The 4 bytes at p, sign-extended to 32-bit integers.
+__attribute__((target("sse2"))) inline __m128i load4Int8SSE2(
+    const int8_t* p) {
+  int32_t bytes;
+  std::memcpy(&bytes, p, sizeof(bytes));
+  __m128i v = _mm_cvtsi32_si128(bytes);
+  v = _mm_unpacklo_epi8(v, v);
+  v = _mm_unpacklo_epi16(v, v);
+  return _mm_srai_epi32(v, 24);
+}
+
+__attribute__((target("sse2"))) real
+dot8SSE2(const real* x, const int8_t* y, int64_t n) {
+  __m128 acc = _mm_setzero_ps();
+  int64_t j = 0;
+  for (; j + 4 <= n; j += 4) {
+    __m128 vy = _mm_cvtepi32_ps(load4Int8SSE2(y + j));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + j), vy));
+  }
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+  real d = _mm_cvtss_f32(acc);
+  for (; j < n; j++) {
+    d += x[j] * y[j];
+  }
+  return d;
+}
+
+__attribute__((target("sse2"))) void
+axpy8SSE2(real a, const int8_t* x, real* y, int64_t n) {
+  const __m128 va = _mm_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 4 <= n; j += 4) {
+    __m128 vx = _mm_cvtepi32_ps(load4Int8SSE2(x + j));
+    __m128 vy = _mm_loadu_ps(y + j);
+    _mm_storeu_ps(y + j, _mm_add_ps(vy, _mm_mul_ps(va, vx)));
+  }
+  for (; j < n; j++) {
+    y[j] += a * x[j];
+  }
+}
+
+// SSE2 has no byte multiply: the bytes are sign-extended to 16 bits, whose
+// pairwise products are summed into 32 bits by pmaddwd.
+__attribute__((target("sse2"))) int32_t
+dotInt8SSE2(const int8_t* x, const int8_t* y, int64_t n) {
+  __m128i acc = _mm_setzero_si128();
+  int64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    __m128i vx = _mm_loadu_si128((const __m128i*)(x + j));
+    __m128i vy = _mm_loadu_si128((const __m128i*)(y + j));
+    __m128i xlo = _mm_srai_epi16(_mm_unpacklo_epi8(vx, vx), 8);
+    __m128i xhi = _mm_srai_epi16(_mm_unpackhi_epi8(vx, vx), 8);
+    __m128i ylo = _mm_srai_epi16(_mm_unpacklo_epi8(vy, vy), 8);
+    __m128i yhi = _mm_srai_epi16(_mm_unpackhi_epi8(vy, vy), 8);
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(xlo, ylo));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(xhi, yhi));
+  }
+  int32_t lanes[4];
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  int32_t d = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  for (; j < n; j++) {
+    d += int32_t(x[j]) * y[j];
+  }
+  return d;
+}
+
+__attribute__((target("avx2,fma"))) real
+dotAVX2(const real* x, const real* y, int64_t n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  int64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    acc0 = _mm256_fmadd_ps(
+        _mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j), acc0);
+    acc1 = _mm256_fmadd_ps(
+        _mm256_loadu_ps(x + j + 8), _mm256_loadu_ps(y + j + 8), acc1);
+  }
+  for (; j + 8 <= n; j += 8) {
+    acc0 = _mm256_fmadd_ps(
+        _mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j), acc0);
+  }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  __m128 s = _mm_add_ps(
+      _mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  real d = _mm_cvtss_f32(s);
+  for (; j < n; j++) {
+    d += x[j] * y[j];
+  }
+  return d;
+}
+
+__attribute__((target("avx2"))) double
+sumSquaresAVX2(const real* x, int64_t n) {
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256 v = _mm256_loadu_ps(x + j);
+    v = _mm256_mul_ps(v, v);
+    acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+    acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+  }
+  acc0 = _mm256_add_pd(acc0, acc1);
+  __m128d s = _mm_add_pd(
+      _mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+  double d = _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+  for (; j < n; j++) {
+    d += x[j] * x[j];
+  }
+  return d;
+}
+
+__attribute__((target("avx2,fma"))) void
+axpyAVX2(real a, const real* x, real* y, int64_t n) {
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256 vy = _mm256_loadu_ps(y + j);
+    vy = _mm256_fmadd_ps(va, _mm256_loadu_ps(x + j), vy);
+    _mm256_storeu_ps(y + j, vy);
+  }
+  for (; j < n; j++) {
+    y[j] += a * x[j];
+  }
+}
+
+__attribute__((target("avx2,fma"))) int64_t nearestColumnAVX2(
+    const real* x,
+    const real* c,
+    int64_t n,
+    int64_t k,
+    real* dist) {
+  if (k < 8) {
+    return nearestColumnScalar(x, c, n, k, dist);
+  }
+  __m256 bestDist = _mm256_set1_ps(std::numeric_limits<real>::infinity());
+  __m256i bestIdx = _mm256_setzero_si256();
+  __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i step = _mm256_set1_epi32(8);
+  int64_t j = 0;
+  for (; j + 8 <= k; j += 8) {
+    __m256 d = _mm256_setzero_ps();
+    for (int64_t i = 0; i < n; i++) {
+      __m256 t = _mm256_sub_ps(
+          _mm256_set1_ps(x[i]), _mm256_loadu_ps(c + i * k + j));
+      d = _mm256_add_ps(d, _mm256_mul_ps(t, t));
+    }
+    __m256 closer = _mm256_cmp_ps(d, bestDist, _CMP_LT_OQ);
+    bestDist = _mm256_blendv_ps(bestDist, d, closer);
+    bestIdx = _mm256_blendv_epi8(bestIdx, idx, _mm256_castps_si256(closer));
+    idx = _mm256_add_epi32(idx, step);
+  }
+  real laneDist[8];
+  int32_t laneIdx[8];
+  _mm256_storeu_ps(laneDist, bestDist);
+  _mm256_storeu_si256((__m256i*)laneIdx, bestIdx);
+  return mergeNearest(x, c, n, k, j, laneDist, laneIdx, 8, dist);
+}
+
+__attribute__((target("avx2,fma"))) real
+dot8AVX2(const real* x, const int8_t* y, int64_t n) {
+  __m256 acc = _mm256_setzero_ps();
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256 vy = _mm256_cvtepi32_ps(
+        _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(y + j))));
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(x + j), vy, acc);
+  }
+  __m128 s = _mm_add_ps(
+      _mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  real d = _mm_cvtss_f32(s);
+  for (; j < n; j++) {
+    d += x[j] * y[j];
+  }
+  return d;
+}
+
+__attribute__((target("avx2,fma"))) void
+axpy8AVX2(real a, const int8_t* x, real* y, int64_t n) {
+  const __m256 va = _mm256_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    __m256 vx = _mm256_cvtepi32_ps(
+        _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(x + j))));
+    __m256 vy = _mm256_loadu_ps(y + j);
+    _mm256_storeu_ps(y + j, _mm256_fmadd_ps(va, vx, vy));
+  }
+  for (; j < n; j++) {
+    y[j] += a * x[j];
+  }
+}
+
+// pmaddubsw multiplies unsigned by signed bytes, so the sign of x is moved
+// onto y. The pairwise sums of |x| * y stay below 2 * 127 * 127 and never
+// saturate 16 bits.
+__attribute__((target("avx2"))) int32_t
+dotInt8AVX2(const int8_t* x, const int8_t* y, int64_t n) {
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i acc = _mm256_setzero_si256();
+  int64_t j = 0;
+  for (; j + 32 <= n; j += 32) {
+    __m256i vx = _mm256_loadu_si256((const __m256i*)(x + j));
+    __m256i vy = _mm256_loadu_si256((const __m256i*)(y + j));
+    __m256i p = _mm256_maddubs_epi16(
+        _mm256_sign_epi8(vx, vx), _mm256_sign_epi8(vy, vx));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(p, ones));
+  }
+  __m128i s = _mm_add_epi32(
+      _mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+  int32_t d = _mm_cvtsi128_si32(s);
+  for (; j < n; j++) {
+    d += int32_t(x[j]) * y[j];
+  }
+  return d;
+}
+
+__attribute__((target("avx512f"))) real
+dotAVX512(const real* x, const real* y, int64_t n) {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  int64_t j = 0;
+  for (; j + 32 <= n; j += 32) {
+    acc0 = _mm512_fmadd_ps(
+        _mm512_loadu_ps(x + j), _mm512_loadu_ps(y + j), acc0);
+    acc1 = _mm512_fmadd_ps(
+        _mm512_loadu_ps(x + j + 16), _mm512_loadu_ps(y + j + 16), acc1);
+  }
+  for (; j + 16 <= n; j += 16) {
+    acc0 = _mm512_fmadd_ps(
+        _mm512_loadu_ps(x + j), _mm512_loadu_ps(y + j), acc0);
+  }
+  if (j < n) {
+    __mmask16 mask = (__mmask16)((1u << (n - j)) - 1);
+    acc1 = _mm512_fmadd_ps(
+        _mm512_maskz_loadu_ps(mask, x + j),
+        _mm512_maskz_loadu_ps(mask, y + j),
+        acc1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f"))) double
+sumSquaresAVX512(const real* x, int64_t n) {
+  __m512d acc0 = _mm512_setzero_pd();
+  __m512d acc1 = _mm512_setzero_pd();
+  int64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    __m512 v = _mm512_loadu_ps(x + j);
+    v = _mm512_mul_ps(v, v);
+    acc0 = _mm512_add_pd(acc0, _mm512_cvtps_pd(_mm512_castps512_ps256(v)));
+    acc1 = _mm512_add_pd(
+        acc1,
+        _mm512_cvtps_pd(_mm256_castpd_ps(
+            _mm512_extractf64x4_pd(_mm512_castps_pd(v), 1))));
+  }
+  double d = _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+  for (; j < n; j++) {
+    d += x[j] * x[j];
+  }
+  return d;
+}
+
+__attribute__((target("avx512f"))) void
+axpyAVX512(real a, const real* x, real* y, int64_t n) {
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    __m512 vy = _mm512_loadu_ps(y + j);
+    vy = _mm512_fmadd_ps(va, _mm512_loadu_ps(x + j), vy);
+    _mm512_storeu_ps(y + j, vy);
+  }
+  if (j < n) {
+    __mmask16 mask = (__mmask16)((1u << (n - j)) - 1);
+    __m512 vy = _mm512_maskz_loadu_ps(mask, y + j);
+    vy = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, x + j), vy);
+    _mm512_mask_storeu_ps(y + j, mask, vy);
+  }
+}
+
+__attribute__((target("avx512f"))) int64_t nearestColumnAVX512(
+    const real* x,
+    const real* c,
+    int64_t n,
+    int64_t k,
+    real* dist) {
+  if (k < 16) {
+    return nearestColumnScalar(x, c, n, k, dist);
+  }
+  __m512 bestDist = _mm512_set1_ps(std::numeric_limits<real>::infinity());
+  __m512i bestIdx = _mm512_setzero_si512();
+  __m512i idx = _mm512_setr_epi32(
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m512i step = _mm512_set1_epi32(16);
+  int64_t j = 0;
+  for (; j + 16 <= k; j += 16) {
+    __m512 d = _mm512_setzero_ps();
+    for (int64_t i = 0; i < n; i++) {
+      __m512 t = _mm512_sub_ps(
+          _mm512_set1_ps(x[i]), _mm512_loadu_ps(c + i * k + j));
+      d = _mm512_add_ps(d, _mm512_mul_ps(t, t));
+    }
+    __mmask16 closer = _mm512_cmp_ps_mask(d, bestDist, _CMP_LT_OQ);
+    bestDist = _mm512_mask_mov_ps(bestDist, closer, d);
+    bestIdx = _mm512_mask_mov_epi32(bestIdx, closer, idx);
+    idx = _mm512_add_epi32(idx, step);
+  }
+  real laneDist[16];
+  int32_t laneIdx[16];
+  _mm512_storeu_ps(laneDist, bestDist);
+  _mm512_storeu_si512(laneIdx, bestIdx);
+  return mergeNearest(x, c, n, k, j, laneDist, laneIdx, 16, dist);
+}
+
+__attribute__((target("avx512f"))) real
+dot8AVX512(const real* x, const int8_t* y, int64_t n) {
+  __m512 acc = _mm512_setzero_ps();
+  int64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    __m512 vy = _mm512_cvtepi32_ps(
+        _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(y + j))));
+    acc = _mm512_fmadd_ps(_mm512_loadu_ps(x + j), vy, acc);
+  }
+  real d = _mm512_reduce_add_ps(acc);
+  for (; j < n; j++) {
+    d += x[j] * y[j];
+  }
+  return d;
+}
+
+__attribute__((target("avx512f"))) void
+axpy8AVX512(real a, const int8_t* x, real* y, int64_t n) {
+  const __m512 va = _mm512_set1_ps(a);
+  int64_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    __m512 vx = _mm512_cvtepi32_ps(
+        _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(x + j))));
+    __m512 vy = _mm512_loadu_ps(y + j);
+    _mm512_storeu_ps(y + j, _mm512_fmadd_ps(va, vx, vy));
+  }
+  for (; j < n; j++) {
+    y[j] += a * x[j];
+  }
+}
+
+// vpdpbusd sums the 4 products of unsigned by signed bytes of each 32-bit
+// lane into it, without intermediate saturation. As with AVX2, the sign of
+// x is moved onto y.
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) int32_t
+dotInt8VNNI(const int8_t* x, const int8_t* y, int64_t n) {
+  const __m512i zero = _mm512_setzero_si512();
+  __m512i acc = _mm512_setzero_si512();
+  int64_t j = 0;
+  for (; j + 64 <= n; j += 64) {
+    __m512i vx = _mm512_loadu_si512(x + j);
+    __m512i vy = _mm512_loadu_si512(y + j);
+    __mmask64 negative = _mm512_movepi8_mask(vx);
+    vy = _mm512_mask_sub_epi8(vy, negative, zero, vy);
+    acc = _mm512_dpbusd_epi32(acc, _mm512_abs_epi8(vx), vy);
+  }
+  if (j < n) {
+    __mmask64 mask = (~__mmask64(0)) >> (64 - (n - j));
+    __m512i vx = _mm512_maskz_loadu_epi8(mask, x + j);
+    __m512i vy = _mm512_maskz_loadu_epi8(mask, y + j);
+    __mmask64 negative = _mm512_movepi8_mask(vx);
+    vy = _mm512_mask_sub_epi8(vy, negative, zero, vy);
+    acc = _mm512_dpbusd_epi32(acc, _mm512_abs_epi8(vx), vy);
+  }
+  return _mm512_reduce_add_epi32(acc);
+}
+
+#endif // FASTTEXT_X86_DISPATCH
+
+isa_name detectIsa() {
+#ifdef FASTTEXT_X86_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vnni")) {
+    return isa_name::avx512vnni;
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    return isa_name::avx512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return isa_name::avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return isa_name::sse2;
+  }
+#endif
+  return isa_name::scalar;
+}
+
+// FASTTEXT_ISA={scalar,sse2,avx2,avx512,avx512vnni} can only lower the detected
+// level, which is useful to compare the kernels on a single host.
+isa_name selectIsa() {
+  isa_name detected = detectIsa();
+  const char* env = std::getenv("FASTTEXT_ISA");
+  if (env == nullptr) {
+    return detected;
+  }
+  for (int i = 0; i <= static_cast<int>(detected); i++) {
+    if (std::strcmp(env, isaToString(static_cast<isa_name>(i))) == 0) {
+      return static_cast<isa_name>(i);
+    }
+  }
+  return detected;
+}
+
+KernelTable makeTable() {
+  KernelTable t = {
+      isa_name::scalar,
+      dotScalar,
+      sumSquaresScalar,
+      axpyScalar,
+      nearestColumnScalar,
+      dot8Scalar,
+      axpy8Scalar,
+      dotInt8Scalar};
+#ifdef FASTTEXT_X86_DISPATCH
+  t.isa = selectIsa();
+  switch (t.isa) {
+    case isa_name::avx512vnni:
+    case isa_name::avx512:
+      t.dot = dotAVX512;
+      t.sumSquares = sumSquaresAVX512;
+      t.axpy = axpyAVX512;
+      t.nearestColumn = nearestColumnAVX512;
+      t.dot8 = dot8AVX512;
+      t.axpy8 = axpy8AVX512;
+      // CPUs with AVX-512 also have AVX2.
+      t.dotInt8 =
+          t.isa == isa_name::avx512vnni ? dotInt8VNNI : dotInt8AVX2;
+      break;
+    case isa_name::avx2:
+      t.dot = dotAVX2;
+      t.sumSquares = sumSquaresAVX2;
+      t.axpy = axpyAVX2;
+      t.nearestColumn = nearestColumnAVX2;
+      t.dot8 = dot8AVX2;
+      t.axpy8 = axpy8AVX2;
+      t.dotInt8 = dotInt8AVX2;
+      break;
+    case isa_name::sse2:
+      t.dot = dotSSE2;
+      t.sumSquares = sumSquaresSSE2;
+      t.axpy = axpySSE2;
+      t.nearestColumn = nearestColumnSSE2;
+      t.dot8 = dot8SSE2;
+      t.axpy8 = axpy8SSE2;
+      t.dotInt8 = dotInt8SSE2;
+      break;
+    case isa_name::scalar:
+      break;
+  }
+#endif
+  return t;
+}
+
+const KernelTable& table() {
+  static const KernelTable t = makeTable();
+  return t;
+}
+
+} // namespace
+
+isa_name isa() {
+  return table().isa;
+}
+
+const char* isaToString(isa_name name) {
+  switch (name) {
+    case isa_name::scalar:
+      return "scalar";
+    case isa_name::sse2:
+      return "sse2";
+    case isa_name::avx2:
+      return "avx2";
+    case isa_name::avx512:
+      return "avx512";
+    case isa_name::avx512vnni:
+      return "avx512vnni";
+  }
+  return "unknown"; // should never happen
+}
+
+real dot(const real* x, const real* y, int64_t n) {
+  return table().dot(x, y, n);
+}
+
+double sumSquares(const real* x, int64_t n) {
+  return table().sumSquares(x, n);
+}
+
+void axpy(real a, const real* x, real* y, int64_t n) {
+  table().axpy(a, x, y, n);
+}
+
+real dot(const real* x, const int8_t* y, int64_t n) {
+  return table().dot8(x, y, n);
+}
+
+void axpy(real a, const int8_t* x, real* y, int64_t n) {
+  table().axpy8(a, x, y, n);
+}
+
+int32_t dotInt8(const int8_t* x, const int8_t* y, int64_t n) {
+  return table().dotInt8(x, y, n);
+}
+
+int64_t nearestColumn(
+    const real* x,
+    const real* c,
+    int64_t n,
+    int64_t k,
+    real* dist) {
+  return table().nearestColumn(x, c, n, k, dist);
+}
+
+bool dotRows(
+    const real* w,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    int64_t nb,
+    real* out) {
+  const dot_fn dotKernel = table().dot;
+  const int64_t block = gemmBlock(n);
+  bool finite = true;
+  for (int64_t i0 = 0; i0 < m; i0 += block) {
+    const int64_t i1 = std::min(m, i0 + block);
+    for (int64_t b = 0; b < nb; b++) {
+      const real* xb = x + b * n;
+      real* ob = out + b * m;
+      for (int64_t i = i0; i < i1; i++) {
+        ob[i] = dotKernel(w + i * n, xb, n);
+        // NaN is the only value that differs from itself.
+        finite &= ob[i] == ob[i];
+      }
+    }
+  }
+  return finite;
+}
+
+void addRows(
+    const real* w,
+    int64_t m,
+    int64_t n,
+    const real* c,
+    int64_t nb,
+    real* x) {
+  const axpy_fn axpyKernel = table().axpy;
+  const int64_t block = gemmBlock(n);
+  for (int64_t i0 = 0; i0 < m; i0 += block) {
+    const int64_t i1 = std::min(m, i0 + block);
+    for (int64_t b = 0; b < nb; b++) {
+      real* xb = x + b * n;
+      const real* cb = c + b * m;
+      for (int64_t i = i0; i < i1; i++) {
+        axpyKernel(cb[i], w + i * n, xb, n);
+      }
+    }
+  }
+}
+
+} // namespace kernels
+
+} // namespace fasttext
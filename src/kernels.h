@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "real.h"
+
+namespace fasttext {
+
+namespace kernels {
+
+enum class isa_name : int { scalar = 0, sse2, avx2, avx512, avx512vnni };
+
+// Instruction set selected once, on first use, from CPUID. The kernels below
+// are compiled for every supported target inside a single portable binary.
+isa_name isa();
+const char* isaToString(isa_name);
+
+// sum_j x[j] * y[j]
+real dot(const real* x, const real* y, int64_t n);
+
+// sum_j x[j] * x[j], with the squares in single precision and their sum in
+// double precision.
+double sumSquares(const real* x, int64_t n);
+
+// y[j] += a * x[j]
+void axpy(real a, const real* x, real* y, int64_t n);
+
+// Variants of dot and axpy over a vector of 8-bit integers y, resp. x.
+real dot(const real* x, const int8_t* y, int64_t n);
+void axpy(real a, const int8_t* x, real* y, int64_t n);
+
+// sum_j x[j] * y[j] over 8-bit integers in [-127, 127], which is exact, and
+// thus the same on every instruction set, as long as it fits in 32 bits.
+int32_t dotInt8(const int8_t* x, const int8_t* y, int64_t n);
+
+// Index of the column of c, an n x k matrix stored by rows, closest to x in
+// squared L2 distance, which is written to dist. The distances are computed
+// without fused multiply-adds and ties go to the lowest index, so that the
+// result is the same on every instruction set.
+int64_t nearestColumn(
+    const real* x,
+    const real* c,
+    int64_t n,
+    int64_t k,
+    real* dist);
+
+// out[b * m + i] = dot(w + i * n, x + b * n, n) for the m rows of w and the
+// nb rows of x, with the rows of w visited in cache-sized blocks. Returns
+// false if one of the products is NaN.
+bool dotRows(
+    const real* w,
+    int64_t m,
+    int64_t n,
+    const real* x,
+    int64_t nb,
+    real* out);
+
+// x[b * n + j] += sum_i c[b * m + i] * w[i * n + j] for the m rows of w and
+// the nb rows of x, with the rows of w visited in blocks as in dotRows.
+void addRows(
+    const real* w,
+    int64_t m,
+    int64_t n,
+    const real* c,
+    int64_t nb,
+    real* x);
+
+} // namespace kernels
+
+} // namespace fasttext
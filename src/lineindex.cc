@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "lineindex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "utils.h"
+
+namespace fasttext {
+
+namespace {
+
+constexpr int32_t LINE_INDEX_MAGIC = 0x78646966;
+constexpr int32_t LINE_INDEX_VERSION = 2;
+// Bytes read from each end of the corpus for the key of its cache.
+constexpr int64_t CHECKSUM_SIZE = 1 << 16;
+
+uint64_t fnv64(uint64_t h, const char* data, int64_t size) {
+  for (int64_t i = 0; i < size; i++) {
+    h = utils::fnv64Step(h, uint8_t(data[i]));
+  }
+  return h;
+}
+
+// Identifies the version of a file: a change that keeps its size, inode and
+// modification time, e.g. on a file system with a coarser clock, still needs
+// to keep its first and last bytes.
+uint64_t fileKey(const std::string& filename, const utils::FileStat& st) {
+  uint64_t h = utils::FNV64_OFFSET_BASIS;
+  h = utils::fnv64Step(h, st.size);
+  h = utils::fnv64Step(h, st.inode);
+  h = utils::fnv64Step(h, st.mtimeSec);
+  h = utils::fnv64Step(h, st.mtimeNsec);
+  std::ifstream ifs(filename, std::ifstream::binary);
+  std::vector<char> bytes(CHECKSUM_SIZE);
+  ifs.read(bytes.data(), CHECKSUM_SIZE);
+  h = fnv64(h, bytes.data(), ifs.gcount());
+  if (st.size > CHECKSUM_SIZE) {
+    ifs.clear();
+    ifs.seekg(std::max(st.size - CHECKSUM_SIZE, CHECKSUM_SIZE));
+    ifs.read(bytes.data(), CHECKSUM_SIZE);
+    h = fnv64(h, bytes.data(), ifs.gcount());
+  }
+  return h;
+}
+
+} // namespace
+
+LineIndex::LineIndex() : fileSize_(0), fileKey_(0) {}
+
+LineIndex::LineIndex(
+    const std::string& filename,
+    int32_t verbose,
+    bool cache)
+    : fileSize_(0), fileKey_(0) {
+  utils::FileStat st;
+  if (!utils::fileStat(filename, st)) {
+    throw std::invalid_argument(filename + " cannot be opened!");
+  }
+  fileSize_ = st.size;
+  const std::string cacheFile = filename + ".ftidx";
+  if (cache) {
+    fileKey_ = fileKey(filename, st);
+    std::ifstream ifs(cacheFile, std::ifstream::binary);
+    if (ifs.is_open() && load(ifs)) {
+      return;
+    }
+  }
+  build(filename);
+  if (verbose > 1) {
+    std::cerr << "Indexed " << offsets_.size() << " line starts" << std::endl;
+  }
+  if (!cache) {
+    return;
+  }
+  // The cache is optional, e.g. next to a corpus in a read-only directory.
+  const std::string tmp = cacheFile + ".tmp";
+  std::ofstream ofs(tmp, std::ofstream::binary);
+  if (ofs.is_open()) {
+    save(ofs);
+    ofs.close();
+    if (!ofs || std::rename(tmp.c_str(), cacheFile.c_str()) != 0) {
+      std::remove(tmp.c_str());
+    }
+  }
+}
+
+void LineIndex::reset(int64_t fileSize) {
+  fileSize_ = fileSize;
+  offsets_.assign(1, 0);
+  tokens_.assign(1, 0);
+}
+
+void LineIndex::add(int64_t offset, int64_t tokens) {
+  if (offset - offsets_.back() >= SPAN && offset < fileSize_) {
+    offsets_.push_back(offset);
+    tokens_.push_back(tokens);
+  }
+}
+
+void LineIndex::finish(int64_t ntokens) {
+  offsets_.push_back(fileSize_);
+  tokens_.push_back(ntokens);
+}
+
+void LineIndex::build(const std::string& filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened!");
+  }
+  reset(fileSize_);
+  std::string line;
+  int64_t pos = 0;
+  int64_t ntokens = 0;
+  while (std::getline(ifs, line)) {
+    pos += line.size() + (ifs.eof() ? 0 : 1);
+    ntokens += utils::countTokens(line);
+    add(pos, ntokens);
+  }
+  finish(ntokens);
+}
+
+bool LineIndex::load(std::istream& in) {
+  int32_t magic, version;
+  int64_t fileSize, n;
+  uint64_t fileKey;
+  in.read((char*)&magic, sizeof(int32_t));
+  in.read((char*)&version, sizeof(int32_t));
+  in.read((char*)&fileSize, sizeof(int64_t));
+  in.read((char*)&fileKey, sizeof(uint64_t));
+  in.read((char*)&n, sizeof(int64_t));
+  if (!in || magic != LINE_INDEX_MAGIC || version != LINE_INDEX_VERSION ||
+      fileSize != fileSize_ || fileKey != fileKey_ || n < 2 ||
+      n > fileSize_ + 2) {
+    return false;
+  }
+  offsets_.resize(n);
+  tokens_.resize(n);
+  in.read((char*)offsets_.data(), n * sizeof(int64_t));
+  in.read((char*)tokens_.data(), n * sizeof(int64_t));
+  return in && offsets_.front() == 0 && offsets_.back() == fileSize_ &&
+      std::is_sorted(offsets_.begin(), offsets_.end()) &&
+      std::is_sorted(tokens_.begin(), tokens_.end());
+}
+
+void LineIndex::save(std::ostream& out) const {
+  int64_t n = offsets_.size();
+  out.write((char*)&LINE_INDEX_MAGIC, sizeof(int32_t));
+  out.write((char*)&LINE_INDEX_VERSION, sizeof(int32_t));
+  out.write((char*)&fileSize_, sizeof(int64_t));
+  out.write((char*)&fileKey_, sizeof(uint64_t));
+  out.write((char*)&n, sizeof(int64_t));
+  out.write((char*)offsets_.data(), n * sizeof(int64_t));
+  out.write((char*)tokens_.data(), n * sizeof(int64_t));
+}
+
+std::vector<int64_t> LineIndex::shards(int32_t n) const {
+  std::vector<int64_t> shards(1, 0);
+  for (int32_t i = 1; i < n; i++) {
+    int64_t target = i * ntokens() / n;
+    size_t j = std::lower_bound(tokens_.begin(), tokens_.end(), target) -
+        tokens_.begin();
+    if (offsets_[j] > shards.back() && offsets_[j] < fileSize_) {
+      shards.push_back(offsets_[j]);
+    }
+  }
+  shards.push_back(fileSize_);
+  return shards;
+}
+
+} // namespace fasttext
@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace fasttext {
+
+// Sparse index of the line starts of a text corpus, with the number of tokens
+// before each of them, to split the corpus into line-aligned shards of
+// similar token counts. It is filled while the vocabulary is counted, or
+// else built by a pass over the corpus, which is then cached next to it, in
+// <corpus>.ftidx, unless disabled. The cache is keyed by the size, inode and
+// modification time of the corpus, to the nanosecond, and by a checksum of
+// its first and last bytes.
+class LineIndex {
+ public:
+  // Minimal number of bytes between two indexed line starts.
+  static constexpr int64_t SPAN = 1 << 16;
+
+ protected:
+  int64_t fileSize_;
+  uint64_t fileKey_;
+  std::vector<int64_t> offsets_;
+  std::vector<int64_t> tokens_;
+
+  void build(const std::string& filename);
+  bool load(std::istream&);
+  void save(std::ostream&) const;
+
+ public:
+  LineIndex();
+  explicit LineIndex(
+      const std::string& filename,
+      int32_t verbose = 0,
+      bool cache = true);
+
+  bool empty() const {
+    return offsets_.empty();
+  }
+
+  int64_t size() const {
+    return fileSize_;
+  }
+
+  int64_t ntokens() const {
+    return tokens_.back();
+  }
+
+  // Starts an index of a file of the given size, whose line starts are then
+  // added in increasing order, each with the number of tokens before it,
+  // until finish is given the number of tokens of the file.
+  void reset(int64_t fileSize);
+  void add(int64_t offset, int64_t tokens);
+  void finish(int64_t ntokens);
+
+  // Splits the corpus into at most n line-aligned ranges of similar token
+  // counts. Returns the boundaries, from 0 to the file size.
+  std::vector<int64_t> shards(int32_t n) const;
+};
+
+} // namespace fasttext
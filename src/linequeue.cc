@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "linequeue.h"
+
+#include <utility>
+
+namespace fasttext {
+
+LineQueue::LineQueue(size_t capacity)
+    : capacity_(capacity), lines_(), closed_(false) {}
+
+bool LineQueue::push(std::string&& line) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  notFull_.wait(
+      lock, [this]() { return closed_ || lines_.size() < capacity_; });
+  if (closed_) {
+    return false;
+  }
+  lines_.push_back(std::move(line));
+  notEmpty_.notify_one();
+  return true;
+}
+
+bool LineQueue::pop(std::string& line) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  notEmpty_.wait(lock, [this]() { return closed_ || !lines_.empty(); });
+  if (lines_.empty()) {
+    return false;
+  }
+  line.swap(lines_.front());
+  lines_.pop_front();
+  notFull_.notify_one();
+  return true;
+}
+
+void LineQueue::close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  closed_ = true;
+  notFull_.notify_all();
+  notEmpty_.notify_all();
+}
+
+bool LineQueue::done() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return closed_ && lines_.empty();
+}
+
+} // namespace fasttext
@@ -0,0 +1,42 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace fasttext {
+
+// Bounded multi-producer multi-consumer queue of text lines. push blocks
+// while the queue is full and pop while it is empty; once closed, push
+// fails and pop drains the lines left before failing.
+class LineQueue {
+ protected:
+  const size_t capacity_;
+  std::deque<std::string> lines_;
+  bool closed_;
+  mutable std::mutex mutex_;
+  std::condition_variable notFull_;
+  std::condition_variable notEmpty_;
+
+ public:
+  explicit LineQueue(size_t capacity);
+  LineQueue(const LineQueue&) = delete;
+  LineQueue& operator=(const LineQueue&) = delete;
+
+  bool push(std::string&& line);
+  bool pop(std::string& line);
+  void close();
+  bool done() const;
+};
+
+} // namespace fasttext
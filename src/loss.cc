@@ -9,7 +9,9 @@
 #include "loss.h"
 #include "utils.h"
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 namespace fasttext {
 
@@ -27,6 +29,20 @@ real std_log(real x) {
   return std::log(x + 1e-5);
 }
 
+void softmax(real* output, int64_t osz) {
+  real max = output[0], z = 0.0;
+  for (int64_t i = 0; i < osz; i++) {
+    max = std::max(output[i], max);
+  }
+  for (int64_t i = 0; i < osz; i++) {
+    output[i] = exp(output[i] - max);
+    z += output[i];
+  }
+  for (int64_t i = 0; i < osz; i++) {
+    output[i] /= z;
+  }
+}
+
 Loss::Loss(std::shared_ptr<Matrix>& wo) : wo_(wo) {
   t_sigmoid_.reserve(SIGMOID_TABLE_SIZE + 1);
   for (int i = 0; i < SIGMOID_TABLE_SIZE + 1; i++) {
@@ -61,22 +77,76 @@ real Loss::sigmoid(real x) const {
   }
 }
 
+bool Loss::usesAllTargets() const {
+  return false;
+}
+
+void Loss::setIndex(std::shared_ptr<const MipsIndex> index) {
+  index_ = index;
+}
+
 void Loss::predict(
     int32_t k,
     real threshold,
     Predictions& heap,
     Model::State& state) const {
   computeOutput(state);
-  findKBest(k, threshold, heap, state.output);
+  findKBest(k, threshold, heap, state.output.data(), state.output.size());
   std::sort_heap(heap.begin(), heap.end(), comparePairs);
 }
 
+void Loss::forward(
+    const std::vector<std::vector<int32_t>>& targets,
+    const std::vector<int32_t>& targetIndices,
+    Model::BatchState& state,
+    real lr,
+    bool backprop) {
+  for (int64_t b = 0; b < state.size(); b++) {
+    state.loadExample(b);
+    state.losses[b] =
+        forward(targets[b], targetIndices[b], state.example, lr, backprop);
+    state.storeExample(b);
+  }
+}
+
+void Loss::computeOutput(Model::BatchState& state) const {
+  for (int64_t b = 0; b < state.size(); b++) {
+    state.loadExample(b);
+    computeOutput(state.example);
+    state.storeExample(b);
+  }
+}
+
+void Loss::predict(
+    int32_t k,
+    real threshold,
+    std::vector<Predictions>& heaps,
+    Model::BatchState& state) const {
+  if (index_) {
+    // The index scores too few rows per example for a product with the
+    // whole output matrix to pay off.
+    for (int64_t b = 0; b < state.size(); b++) {
+      state.loadExample(b);
+      predict(k, threshold, heaps[b], state.example);
+    }
+    return;
+  }
+  computeOutput(state);
+  const int64_t osz = state.output.cols();
+  for (int64_t b = 0; b < state.size(); b++) {
+    Predictions& heap = heaps[b];
+    findKBest(k, threshold, heap, state.output.data() + b * osz, osz);
+    std::sort_heap(heap.begin(), heap.end(), comparePairs);
+  }
+}
+
 void Loss::findKBest(
     int32_t k,
     real threshold,
     Predictions& heap,
-    const Vector& output) const {
-  for (int32_t i = 0; i < output.size(); i++) {
+    const real* output,
+    int64_t osz) const {
+  for (int32_t i = 0; i < osz; i++) {
     if (output[i] < threshold) {
       continue;
     }
@@ -123,9 +193,25 @@ void BinaryLogisticLoss::computeOutput(Model::State& state) const {
   }
 }
 
+void BinaryLogisticLoss::computeOutput(Model::BatchState& state) const {
+  DenseMatrix& output = state.output;
+  wo_->dotRows(state.hidden, output, state.size());
+  const int64_t osz = output.cols();
+  for (int64_t b = 0; b < state.size(); b++) {
+    real* row = output.data() + b * osz;
+    for (int64_t i = 0; i < osz; i++) {
+      row[i] = sigmoid(row[i]);
+    }
+  }
+}
+
 OneVsAllLoss::OneVsAllLoss(std::shared_ptr<Matrix>& wo)
     : BinaryLogisticLoss(wo) {}
 
+bool OneVsAllLoss::usesAllTargets() const {
+  return true;
+}
+
 real OneVsAllLoss::forward(
     const std::vector<int32_t>& targets,
     int32_t /* we take all targets here */,
@@ -142,6 +228,64 @@ real OneVsAllLoss::forward(
   return loss;
 }
 
+void OneVsAllLoss::forward(
+    const std::vector<std::vector<int32_t>>& targets,
+    const std::vector<int32_t>& /* we take all targets here */,
+    Model::BatchState& state,
+    real lr,
+    bool backprop) {
+  computeOutput(state);
+
+  // Scores are replaced in place by the coefficients of the update, so
+  // that the gradient and the output rows are each a single product.
+  DenseMatrix& output = state.output;
+  const int64_t osz = output.cols();
+  for (int64_t b = 0; b < state.size(); b++) {
+    real* row = output.data() + b * osz;
+    real loss = 0.0;
+    for (int32_t i = 0; i < osz; i++) {
+      bool isMatch = utils::contains(targets[b], i);
+      real score = row[i];
+      loss += isMatch ? -log(score) : -log(1.0 - score);
+      row[i] = lr * (real(isMatch) - score);
+    }
+    state.losses[b] = loss;
+  }
+  if (backprop) {
+    wo_->addRowsToMatrix(output, state.grad, state.size());
+    wo_->addMatrixToRows(output, state.hidden, state.size());
+  }
+}
+
+// The index finds the k best scores s, whose probabilities are the table
+// sigmoid, which is at most the exact one: no score below the logit of the
+// threshold can reach it.
+void OneVsAllLoss::predict(
+    int32_t k,
+    real threshold,
+    Predictions& heap,
+    Model::State& state) const {
+  if (!index_) {
+    Loss::predict(k, threshold, heap, state);
+    return;
+  }
+  real minScore = -std::numeric_limits<real>::infinity();
+  if (threshold >= 1.0) {
+    minScore = MAX_SIGMOID;
+  } else if (threshold > 0.0) {
+    minScore = std::log(threshold / (1.0 - threshold));
+  }
+  index_->search(*wo_, state.hidden, k, minScore, heap);
+  for (size_t i = 0; i < heap.size(); i++) {
+    real probability = sigmoid(heap[i].first);
+    if (probability < threshold) {
+      heap.resize(i);
+      break;
+    }
+    heap[i].first = std_log(probability);
+  }
+}
+
 NegativeSamplingLoss::NegativeSamplingLoss(
     std::shared_ptr<Matrix>& wo,
     int neg,
@@ -260,44 +404,95 @@ real HierarchicalSoftmaxLoss::forward(
   return loss;
 }
 
+// Depth-first search of the tree without recursion. The score of a node,
+// the log-probability of its path, does not increase down the tree, so a
+// node scoring below the k-th best label found so far is not expanded. The
+// better child of a node is visited first: the first leaves reached are
+// then among the best, and they prune most of the tree.
 void HierarchicalSoftmaxLoss::predict(
     int32_t k,
     real threshold,
     Predictions& heap,
     Model::State& state) const {
-  dfs(k, threshold, 2 * osz_ - 2, 0.0, heap, state.hidden);
-  std::sort_heap(heap.begin(), heap.end(), comparePairs);
+  // Nodes left to visit, and the dot products of the internal ones with the
+  // hidden vector, reused across calls so that predicting does not allocate.
+  static thread_local Predictions stack;
+  static thread_local std::vector<real> dots;
+  stack.clear();
+  dots.clear();
+  // The products of the two children of a node are computed together when
+  // it is expanded, rather than each when it is reached: they are
+  // independent, so their loads overlap, and sibling internal nodes are
+  // adjacent rows of wo_.
+  auto nodeDot = [&](int32_t node) -> real {
+    return node < osz_ ? 0.0 : wo_->dotRow(state.hidden, node - osz_);
+  };
+  const real minScore = std_log(threshold);
+  stack.push_back(std::make_pair(0.0, 2 * osz_ - 2));
+  dots.push_back(nodeDot(2 * osz_ - 2));
+  while (!stack.empty()) {
+    real score = stack.back().first;
+    int32_t node = stack.back().second;
+    real f = dots.back();
+    stack.pop_back();
+    dots.pop_back();
+    if (score < minScore) {
+      continue;
+    }
+    if (heap.size() == k && score < heap.front().first) {
+      continue;
+    }
+    if (node < osz_) {
+      // Leaves tend to come by decreasing score, the worst case of
+      // push_heap, so the first k are only made into a heap once there are
+      // k of them.
+      if (heap.size() < k) {
+        heap.push_back(std::make_pair(score, node));
+        if (heap.size() == k) {
+          std::make_heap(heap.begin(), heap.end(), comparePairs);
+        }
+      } else {
+        std::pop_heap(heap.begin(), heap.end(), comparePairs);
+        heap.back() = std::make_pair(score, node);
+        std::push_heap(heap.begin(), heap.end(), comparePairs);
+      }
+      continue;
+    }
+    f = 1. / (1 + std::exp(-f));
+    const int32_t left = tree_[node].left;
+    const int32_t right = tree_[node].right;
+    const real leftDot = nodeDot(left);
+    const real rightDot = nodeDot(right);
+    const real leftScore = score + std_log(1.0 - f);
+    const real rightScore = score + std_log(f);
+    if (leftScore < rightScore) {
+      stack.push_back(std::make_pair(leftScore, left));
+      dots.push_back(leftDot);
+      stack.push_back(std::make_pair(rightScore, right));
+      dots.push_back(rightDot);
+    } else {
+      stack.push_back(std::make_pair(rightScore, right));
+      dots.push_back(rightDot);
+      stack.push_back(std::make_pair(leftScore, left));
+      dots.push_back(leftDot);
+    }
+  }
+  if (heap.size() < k) {
+    std::sort(heap.begin(), heap.end(), comparePairs);
+  } else {
+    std::sort_heap(heap.begin(), heap.end(), comparePairs);
+  }
 }
 
-void HierarchicalSoftmaxLoss::dfs(
+void HierarchicalSoftmaxLoss::predict(
     int32_t k,
     real threshold,
-    int32_t node,
-    real score,
-    Predictions& heap,
-    const Vector& hidden) const {
-  if (score < std_log(threshold)) {
-    return;
-  }
-  if (heap.size() == k && score < heap.front().first) {
-    return;
+    std::vector<Predictions>& heaps,
+    Model::BatchState& state) const {
+  for (int64_t b = 0; b < state.size(); b++) {
+    state.loadExample(b);
+    predict(k, threshold, heaps[b], state.example);
   }
-
-  if (tree_[node].left == -1 && tree_[node].right == -1) {
-    heap.push_back(std::make_pair(score, node));
-    std::push_heap(heap.begin(), heap.end(), comparePairs);
-    if (heap.size() > k) {
-      std::pop_heap(heap.begin(), heap.end(), comparePairs);
-      heap.pop_back();
-    }
-    return;
-  }
-
-  real f = wo_->dotRow(hidden, node - osz_);
-  f = 1. / (1 + std::exp(-f));
-
-  dfs(k, threshold, tree_[node].left, score + std_log(1.0 - f), heap, hidden);
-  dfs(k, threshold, tree_[node].right, score + std_log(f), heap, hidden);
 }
 
 SoftmaxLoss::SoftmaxLoss(std::shared_ptr<Matrix>& wo) : Loss(wo) {}
@@ -305,17 +500,34 @@ SoftmaxLoss::SoftmaxLoss(std::shared_ptr<Matrix>& wo) : Loss(wo) {}
 void SoftmaxLoss::computeOutput(Model::State& state) const {
   Vector& output = state.output;
   output.mul(*wo_, state.hidden);
-  real max = output[0], z = 0.0;
-  int32_t osz = output.size();
-  for (int32_t i = 0; i < osz; i++) {
-    max = std::max(output[i], max);
+  softmax(output.data(), output.size());
+}
+
+void SoftmaxLoss::computeOutput(Model::BatchState& state) const {
+  DenseMatrix& output = state.output;
+  wo_->dotRows(state.hidden, output, state.size());
+  const int64_t osz = output.cols();
+  for (int64_t b = 0; b < state.size(); b++) {
+    softmax(output.data() + b * osz, osz);
   }
-  for (int32_t i = 0; i < osz; i++) {
-    output[i] = exp(output[i] - max);
-    z += output[i];
+}
+
+void SoftmaxLoss::predict(
+    int32_t k,
+    real threshold,
+    Predictions& heap,
+    Model::State& state) const {
+  if (!index_) {
+    Loss::predict(k, threshold, heap, state);
+    return;
   }
-  for (int32_t i = 0; i < osz; i++) {
-    output[i] /= z;
+  real minScore = -std::numeric_limits<real>::infinity();
+  if (threshold > 0.0) {
+    minScore = std::log(threshold);
+  }
+  index_->searchLogSoftmax(*wo_, state.hidden, k, minScore, heap);
+  for (auto& prediction : heap) {
+    prediction.first = std_log(std::exp(prediction.first));
   }
 }
 
@@ -343,4 +555,33 @@ real SoftmaxLoss::forward(
   return -log(state.output[target]);
 };
 
+void SoftmaxLoss::forward(
+    const std::vector<std::vector<int32_t>>& targets,
+    const std::vector<int32_t>& targetIndices,
+    Model::BatchState& state,
+    real lr,
+    bool backprop) {
+  computeOutput(state);
+
+  DenseMatrix& output = state.output;
+  const int64_t osz = output.cols();
+  for (int64_t b = 0; b < state.size(); b++) {
+    assert(targetIndices[b] >= 0);
+    assert(targetIndices[b] < targets[b].size());
+    int32_t target = targets[b][targetIndices[b]];
+    real* row = output.data() + b * osz;
+    state.losses[b] = -log(row[target]);
+    if (backprop) {
+      for (int32_t i = 0; i < osz; i++) {
+        real label = (i == target) ? 1.0 : 0.0;
+        row[i] = lr * (label - row[i]);
+      }
+    }
+  }
+  if (backprop) {
+    wo_->addRowsToMatrix(output, state.grad, state.size());
+    wo_->addMatrixToRows(output, state.hidden, state.size());
+  }
+}
+
 } // namespace fasttext
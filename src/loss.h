@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "matrix.h"
+#include "mipsindex.h"
 #include "model.h"
 #include "real.h"
 #include "utils.h"
@@ -26,12 +27,14 @@ class Loss {
       int32_t k,
       real threshold,
       Predictions& heap,
-      const Vector& output) const;
+      const real* output,
+      int64_t osz) const;
 
  protected:
   std::vector<real> t_sigmoid_;
   std::vector<real> t_log_;
   std::shared_ptr<Matrix>& wo_;
+  std::shared_ptr<const MipsIndex> index_;
 
   real log(real x) const;
   real sigmoid(real x) const;
@@ -47,12 +50,33 @@ class Loss {
       real lr,
       bool backprop) = 0;
   virtual void computeOutput(Model::State& state) const = 0;
+  // Whether forward reads every target rather than only targetIndex.
+  virtual bool usesAllTargets() const;
+  // An index of the rows of wo, with which the losses that score every
+  // label, softmax and one-vs-all, predict without scoring most of them.
+  void setIndex(std::shared_ptr<const MipsIndex> index);
 
   virtual void predict(
       int32_t /*k*/,
       real /*threshold*/,
       Predictions& /*heap*/,
       Model::State& /*state*/) const;
+
+  // Minibatch entry points, one example per row of the batch state. The
+  // defaults run the per-example versions above row by row; losses that
+  // score every output row override them with matrix-matrix products.
+  virtual void forward(
+      const std::vector<std::vector<int32_t>>& targets,
+      const std::vector<int32_t>& targetIndices,
+      Model::BatchState& state,
+      real lr,
+      bool backprop);
+  virtual void computeOutput(Model::BatchState& state) const;
+  virtual void predict(
+      int32_t k,
+      real threshold,
+      std::vector<Predictions>& heaps,
+      Model::BatchState& state) const;
 };
 
 class BinaryLogisticLoss : public Loss {
@@ -68,18 +92,31 @@ class BinaryLogisticLoss : public Loss {
   explicit BinaryLogisticLoss(std::shared_ptr<Matrix>& wo);
   virtual ~BinaryLogisticLoss() noexcept override = default;
   void computeOutput(Model::State& state) const override;
+  void computeOutput(Model::BatchState& state) const override;
 };
 
 class OneVsAllLoss : public BinaryLogisticLoss {
  public:
   explicit OneVsAllLoss(std::shared_ptr<Matrix>& wo);
   ~OneVsAllLoss() noexcept override = default;
+  bool usesAllTargets() const override;
   real forward(
       const std::vector<int32_t>& targets,
       int32_t targetIndex,
       Model::State& state,
       real lr,
       bool backprop) override;
+  void forward(
+      const std::vector<std::vector<int32_t>>& targets,
+      const std::vector<int32_t>& targetIndices,
+      Model::BatchState& state,
+      real lr,
+      bool backprop) override;
+  void predict(
+      int32_t k,
+      real threshold,
+      Predictions& heap,
+      Model::State& state) const override;
 };
 
 class NegativeSamplingLoss : public BinaryLogisticLoss {
@@ -121,13 +158,6 @@ class HierarchicalSoftmaxLoss : public BinaryLogisticLoss {
   std::vector<Node> tree_;
   int32_t osz_;
   void buildTree(const std::vector<int64_t>& counts);
-  void dfs(
-      int32_t k,
-      real threshold,
-      int32_t node,
-      real score,
-      Predictions& heap,
-      const Vector& hidden) const;
 
  public:
   explicit HierarchicalSoftmaxLoss(
@@ -145,6 +175,11 @@ class HierarchicalSoftmaxLoss : public BinaryLogisticLoss {
       real threshold,
       Predictions& heap,
       Model::State& state) const override;
+  void predict(
+      int32_t k,
+      real threshold,
+      std::vector<Predictions>& heaps,
+      Model::BatchState& state) const override;
 };
 
 class SoftmaxLoss : public Loss {
@@ -157,7 +192,19 @@ class SoftmaxLoss : public Loss {
       Model::State& state,
       real lr,
       bool backprop) override;
+  void forward(
+      const std::vector<std::vector<int32_t>>& targets,
+      const std::vector<int32_t>& targetIndices,
+      Model::BatchState& state,
+      real lr,
+      bool backprop) override;
   void computeOutput(Model::State& state) const override;
+  void computeOutput(Model::BatchState& state) const override;
+  void predict(
+      int32_t k,
+      real threshold,
+      Predictions& heap,
+      Model::State& state) const override;
 };
 
 } // namespace fasttext
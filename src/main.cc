@@ -6,6 +6,8 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <queue>
@@ -38,6 +40,12 @@ void printUsage() {
          "word\n"
       << "  nn                      query for nearest neighbors\n"
       << "  analogies               query for analogies\n"
+      << "  nn-index                build an index for approximate nn and "
+         "analogies queries\n"
+      << "  pq-index                build a compressed index for approximate "
+         "nn and analogies queries\n"
+      << "  label-index             build an index for predictions over many "
+         "labels\n"
       << "  dump                    dump arguments,dictionary,input/output "
          "vectors\n"
       << std::endl;
@@ -49,21 +57,28 @@ void printQuantizeUsage() {
 
 void printTestUsage() {
   std::cerr
-      << "usage: fasttext test <model> <test-data> [<k>] [<th>]\n\n"
+      << "usage: fasttext test <model> <test-data> [<k>] [<th>] "
+         "[-labelIndex <index>]\n\n"
       << "  <model>      model filename\n"
       << "  <test-data>  test data filename (if -, read from stdin)\n"
       << "  <k>          (optional; 1 by default) predict top k labels\n"
-      << "  <th>         (optional; 0.0 by default) probability threshold\n"
+      << "  <th>         (optional; 0.0 by default) probability threshold\n\n"
+      << "  <index>      (optional) index of the labels built by label-index;\n"
+      << "               labels are then searched approximately in it\n"
       << std::endl;
 }
 
 void printPredictUsage() {
   std::cerr
-      << "usage: fasttext predict[-prob] <model> <test-data> [<k>] [<th>]\n\n"
+      << "usage: fasttext predict[-prob] <model> <test-data> [<k>] [<th>] "
+         "[<thread>] [-labelIndex <index>]\n\n"
       << "  <model>      model filename\n"
       << "  <test-data>  test data filename (if -, read from stdin)\n"
       << "  <k>          (optional; 1 by default) predict top k labels\n"
       << "  <th>         (optional; 0.0 by default) probability threshold\n"
+      << "  <thread>     (optional; 1 by default) number of threads\n\n"
+      << "  <index>      (optional) index of the labels built by label-index;\n"
+      << "               labels are then searched approximately in it\n"
       << std::endl;
 }
 
@@ -113,26 +128,80 @@ void quantize(const std::vector<std::string>& args) {
 }
 
 void printNNUsage() {
-  std::cout << "usage: fasttext nn <model> <k>\n\n"
+  std::cout << "usage: fasttext nn <model> <k> [<ef>]\n\n"
             << "  <model>      model filename\n"
             << "  <k>          (optional; 10 by default) predict top k labels\n"
+            << "  <ef>         (optional) search <model>.hnsw, built by "
+               "nn-index, with ef candidates,\n"
+            << "               or else <model>.ivfpq, built by pq-index, "
+               "in ef lists\n"
             << std::endl;
 }
 
 void printAnalogiesUsage() {
-  std::cout << "usage: fasttext analogies <model> <k>\n\n"
+  std::cout << "usage: fasttext analogies <model> <k> [<ef>]\n\n"
             << "  <model>      model filename\n"
             << "  <k>          (optional; 10 by default) predict top k labels\n"
+            << "  <ef>         (optional) search <model>.hnsw, built by "
+               "nn-index, with ef candidates,\n"
+            << "               or else <model>.ivfpq, built by pq-index, "
+               "in ef lists\n"
             << std::endl;
 }
 
+void printNNIndexUsage() {
+  std::cout
+      << "usage: fasttext nn-index <model> [<m>] [<efc>] [<ef>] [<thread>]\n\n"
+      << "  <model>      model filename, the index is saved to <model>.hnsw\n"
+      << "  <m>          (optional; 16 by default) links per word\n"
+      << "  <efc>        (optional; 200 by default) candidates per insertion\n"
+      << "  <ef>         (optional; 64 by default) candidates per query\n"
+      << "  <thread>     (optional; 12 by default) number of threads\n"
+      << std::endl;
+}
+
+void printPQIndexUsage() {
+  std::cout
+      << "usage: fasttext pq-index <model> [<nlist>] [<dsub>] [<nprobe>] "
+         "[<thread>]\n\n"
+      << "  <model>      model filename, the index is saved to <model>.ivfpq\n"
+      << "  <nlist>      (optional; sqrt(nwords) by default) number of lists\n"
+      << "  <dsub>       (optional; 2 by default) size of each sub-vector\n"
+      << "  <nprobe>     (optional; 16 by default) lists searched per query\n"
+      << "  <thread>     (optional; 12 by default) number of threads\n"
+      << std::endl;
+}
+
+void printLabelIndexUsage() {
+  std::cout
+      << "usage: fasttext label-index <model> [<nlist>] [<thread>]\n\n"
+      << "  <model>      model filename, the index is saved to <model>.mips\n"
+      << "  <nlist>      (optional; sqrt(nlabels) by default) number of lists\n"
+      << "  <thread>     (optional; 12 by default) number of threads\n"
+      << std::endl;
+}
+
 void printDumpUsage() {
   std::cout << "usage: fasttext dump <model> <option>\n\n"
             << "  <model>      model filename\n"
             << "  <option>     option from args,dict,input,output" << std::endl;
 }
 
-void test(const std::vector<std::string>& args) {
+// Removes "-labelIndex <index>" from args and returns <index>, or an empty
+// string if it is not given.
+std::string takeLabelIndex(std::vector<std::string>& args) {
+  for (size_t i = 2; i + 1 < args.size(); i++) {
+    if (args[i] == "-labelIndex") {
+      std::string filename = args[i + 1];
+      args.erase(args.begin() + i, args.begin() + i + 2);
+      return filename;
+    }
+  }
+  return std::string();
+}
+
+void test(std::vector<std::string> args) {
+  std::string labelIndex = takeLabelIndex(args);
   bool perLabel = args[1] == "test-label";
 
   if (args.size() < 4 || args.size() > 6) {
@@ -146,7 +215,10 @@ void test(const std::vector<std::string>& args) {
   real threshold = args.size() > 5 ? std::stof(args[5]) : 0.0;
 
   FastText fasttext;
-  fasttext.loadModel(model);
+  fasttext.loadModel(model, true);
+  if (!labelIndex.empty()) {
+    fasttext.loadLabelIndex(labelIndex);
+  }
 
   Meter meter(false);
 
@@ -209,8 +281,9 @@ void printPredictions(
   }
 }
 
-void predict(const std::vector<std::string>& args) {
-  if (args.size() < 4 || args.size() > 6) {
+void predict(std::vector<std::string> args) {
+  std::string labelIndex = takeLabelIndex(args);
+  if (args.size() < 4 || args.size() > 7) {
     printPredictUsage();
     exit(EXIT_FAILURE);
   }
@@ -218,14 +291,18 @@ void predict(const std::vector<std::string>& args) {
   real threshold = 0.0;
   if (args.size() > 4) {
     k = std::stoi(args[4]);
-    if (args.size() == 6) {
+    if (args.size() > 5) {
       threshold = std::stof(args[5]);
     }
   }
+  int32_t thread = args.size() > 6 ? std::stoi(args[6]) : 1;
 
   bool printProb = args[1] == "predict-prob";
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), true);
+  if (!labelIndex.empty()) {
+    fasttext.loadLabelIndex(labelIndex);
+  }
 
   std::ifstream ifs;
   std::string infile(args[3]);
@@ -237,10 +314,33 @@ void predict(const std::vector<std::string>& args) {
       exit(EXIT_FAILURE);
     }
   }
+  if (inputIsStdIn) {
+    // Buffered, std::cin tells how many characters are ready to be read.
+    std::ios::sync_with_stdio(false);
+  }
   std::istream& in = inputIsStdIn ? std::cin : ifs;
-  std::vector<std::pair<real, std::string>> predictions;
-  while (fasttext.predictLine(in, predictions, k, threshold)) {
-    printPredictions(predictions, printProb, false);
+  // The input is predicted in blocks of lines, so that it can be streamed.
+  // A block ends early when no more input is ready, so that the lines of an
+  // interactive session or a slow pipe are answered as they arrive.
+  const size_t blockSize = 1024 * std::max(1, thread);
+  std::vector<std::string> lines;
+  std::vector<std::vector<std::pair<real, std::string>>> predictions;
+  std::string line;
+  while (in.peek() != EOF) {
+    lines.clear();
+    while (lines.size() < blockSize &&
+           (lines.empty() || in.rdbuf()->in_avail() > 0) &&
+           std::getline(in, line)) {
+      // predictLine reads the newline, which ends a line with EOS.
+      if (!in.eof()) {
+        line.push_back('\n');
+      }
+      lines.push_back(line);
+    }
+    fasttext.predictBatch(lines, predictions, k, threshold, thread);
+    for (const auto& linePredictions : predictions) {
+      printPredictions(linePredictions, printProb, false);
+    }
   }
   if (ifs.is_open()) {
     ifs.close();
@@ -255,7 +355,7 @@ void printWordVectors(const std::vector<std::string> args) {
     exit(EXIT_FAILURE);
   }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), true);
   std::string word;
   Vector vec(fasttext.getDimension());
   while (std::cin >> word) {
@@ -271,7 +371,7 @@ void printSentenceVectors(const std::vector<std::string> args) {
     exit(EXIT_FAILURE);
   }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), true);
   Vector svec(fasttext.getDimension());
   while (std::cin.peek() != EOF) {
     fasttext.getSentenceVector(std::cin, svec);
@@ -287,7 +387,7 @@ void printNgrams(const std::vector<std::string> args) {
     exit(EXIT_FAILURE);
   }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), true);
 
   std::string word(args[3]);
   std::vector<std::pair<std::string, Vector>> ngramVectors =
@@ -300,18 +400,36 @@ void printNgrams(const std::vector<std::string> args) {
   exit(0);
 }
 
+// Loads the index of model built by nn-index or, if there is none, the one
+// built by pq-index, and exits when there is neither.
+void loadIndex(FastText& fasttext, const std::string& model, int32_t ef) {
+  if (std::ifstream(model + ".hnsw").is_open()) {
+    fasttext.loadNNIndex(model + ".hnsw", ef);
+  } else if (std::ifstream(model + ".ivfpq").is_open()) {
+    fasttext.loadPQIndex(model + ".ivfpq", ef);
+  } else {
+    std::cerr << "No index for " << model << ": neither " << model
+              << ".hnsw (built by nn-index) nor " << model
+              << ".ivfpq (built by pq-index) could be opened." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
 void nn(const std::vector<std::string> args) {
   int32_t k;
   if (args.size() == 3) {
     k = 10;
-  } else if (args.size() == 4) {
+  } else if (args.size() == 4 || args.size() == 5) {
     k = std::stoi(args[3]);
   } else {
     printNNUsage();
     exit(EXIT_FAILURE);
   }
   FastText fasttext;
-  fasttext.loadModel(std::string(args[2]));
+  fasttext.loadModel(std::string(args[2]), true);
+  if (args.size() == 5) {
+    loadIndex(fasttext, args[2], std::stoi(args[4]));
+  }
   std::string prompt("Query word? ");
   std::cout << prompt;
 
@@ -327,7 +445,7 @@ void analogies(const std::vector<std::string> args) {
   int32_t k;
   if (args.size() == 3) {
     k = 10;
-  } else if (args.size() == 4) {
+  } else if (args.size() == 4 || args.size() == 5) {
     k = std::stoi(args[3]);
   } else {
     printAnalogiesUsage();
@@ -339,7 +457,10 @@ void analogies(const std::vector<std::string> args) {
   FastText fasttext;
   std::string model(args[2]);
   std::cout << "Loading model " << model << std::endl;
-  fasttext.loadModel(model);
+  fasttext.loadModel(model, true);
+  if (args.size() == 5) {
+    loadIndex(fasttext, model, std::stoi(args[4]));
+  }
 
   std::string prompt("Query triplet (A - B + C)? ");
   std::string wordA, wordB, wordC;
@@ -355,6 +476,55 @@ void analogies(const std::vector<std::string> args) {
   exit(0);
 }
 
+void nnIndex(const std::vector<std::string> args) {
+  if (args.size() < 3 || args.size() > 7) {
+    printNNIndexUsage();
+    exit(EXIT_FAILURE);
+  }
+  int32_t m = args.size() > 3 ? std::stoi(args[3]) : 16;
+  int32_t efConstruction = args.size() > 4 ? std::stoi(args[4]) : 200;
+  int32_t efSearch = args.size() > 5 ? std::stoi(args[5]) : 64;
+  int32_t thread = args.size() > 6 ? std::stoi(args[6]) : Args().thread;
+  FastText fasttext;
+  std::string model(args[2]);
+  fasttext.loadModel(model, true);
+  fasttext.buildNNIndex(m, efConstruction, efSearch, thread);
+  fasttext.saveNNIndex(model + ".hnsw");
+  exit(0);
+}
+
+void pqIndex(const std::vector<std::string> args) {
+  if (args.size() < 3 || args.size() > 7) {
+    printPQIndexUsage();
+    exit(EXIT_FAILURE);
+  }
+  int32_t nlist = args.size() > 3 ? std::stoi(args[3]) : 0;
+  int32_t dsub = args.size() > 4 ? std::stoi(args[4]) : 2;
+  int32_t nprobe = args.size() > 5 ? std::stoi(args[5]) : 16;
+  int32_t thread = args.size() > 6 ? std::stoi(args[6]) : Args().thread;
+  FastText fasttext;
+  std::string model(args[2]);
+  fasttext.loadModel(model, true);
+  fasttext.buildPQIndex(nlist, dsub, nprobe, thread);
+  fasttext.savePQIndex(model + ".ivfpq");
+  exit(0);
+}
+
+void labelIndex(const std::vector<std::string> args) {
+  if (args.size() < 3 || args.size() > 5) {
+    printLabelIndexUsage();
+    exit(EXIT_FAILURE);
+  }
+  int32_t nlist = args.size() > 3 ? std::stoi(args[3]) : 0;
+  int32_t thread = args.size() > 4 ? std::stoi(args[4]) : Args().thread;
+  FastText fasttext;
+  std::string model(args[2]);
+  fasttext.loadModel(model, true);
+  fasttext.buildLabelIndex(nlist, thread);
+  fasttext.saveLabelIndex(model + ".mips");
+  exit(0);
+}
+
 void train(const std::vector<std::string> args) {
   Args a = Args();
   a.parseArgs(args);
@@ -442,6 +612,12 @@ int main(int argc, char** argv) {
     nn(args);
   } else if (command == "analogies") {
     analogies(args);
+  } else if (command == "nn-index") {
+    nnIndex(args);
+  } else if (command == "pq-index") {
+    pqIndex(args);
+  } else if (command == "label-index") {
+    labelIndex(args);
   } else if (command == "predict" || command == "predict-prob") {
     predict(args);
   } else if (command == "dump") {
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "mappedfile.h"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define FASTTEXT_USE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fasttext {
+
+MappedFile::MappedFile(const std::string& filename)
+    : data_(nullptr), size_(0) {
+#ifdef FASTTEXT_USE_MMAP
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void* ptr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error(filename + " cannot be memory-mapped!");
+    }
+    data_ = static_cast<const char*>(ptr);
+  }
+  close(fd);
+#else
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened for loading!");
+  }
+  buffer_.assign(
+      std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef FASTTEXT_USE_MMAP
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+#endif
+}
+
+} // namespace fasttext
@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace fasttext {
+
+// Read-only view of a whole file. On POSIX systems the file is mapped with
+// mmap, so that every process opening the same model shares the page cache;
+// elsewhere the content is read into memory once.
+class MappedFile {
+ protected:
+  const char* data_;
+  int64_t size_;
+  std::vector<char> buffer_;
+
+ public:
+  explicit MappedFile(const std::string& filename);
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  inline const char* data() const {
+    return data_;
+  }
+  inline int64_t size() const {
+    return size_;
+  }
+};
+
+} // namespace fasttext
@@ -8,6 +8,11 @@
 
 #include "matrix.h"
 
+#include <algorithm>
+
+#include "densematrix.h"
+#include "vector.h"
+
 namespace fasttext {
 
 Matrix::Matrix() : m_(0), n_(0) {}
@@ -22,4 +27,66 @@ int64_t Matrix::size(int64_t dim) const {
   return n_;
 }
 
+void Matrix::mulVector(const Vector& x, Vector& out) const {
+  assert(x.size() == n_);
+  assert(out.size() == m_);
+  for (int64_t i = 0; i < m_; i++) {
+    out[i] = dotRow(x, i);
+  }
+}
+
+void Matrix::averageRowsToVector(
+    const std::vector<int32_t>& rows,
+    Vector& x) const {
+  x.zero();
+  for (auto it = rows.cbegin(); it != rows.cend(); ++it) {
+    addRowToVector(x, *it);
+  }
+  x.mul(1.0 / rows.size());
+}
+
+void Matrix::dotRows(const DenseMatrix& x, DenseMatrix& out, int64_t n)
+    const {
+  assert(x.cols() == n_);
+  assert(out.cols() == m_);
+  Vector vec(n_);
+  for (int64_t b = 0; b < n; b++) {
+    std::copy(x.data() + b * n_, x.data() + (b + 1) * n_, vec.data());
+    for (int64_t i = 0; i < m_; i++) {
+      out.at(b, i) = dotRow(vec, i);
+    }
+  }
+}
+
+void Matrix::addRowsToMatrix(
+    const DenseMatrix& coeffs,
+    DenseMatrix& x,
+    int64_t n) const {
+  assert(x.cols() == n_);
+  assert(coeffs.cols() == m_);
+  Vector vec(n_);
+  for (int64_t b = 0; b < n; b++) {
+    std::copy(x.data() + b * n_, x.data() + (b + 1) * n_, vec.data());
+    for (int64_t i = 0; i < m_; i++) {
+      addRowToVector(vec, i, coeffs.at(b, i));
+    }
+    std::copy(vec.data(), vec.data() + n_, x.data() + b * n_);
+  }
+}
+
+void Matrix::addMatrixToRows(
+    const DenseMatrix& coeffs,
+    const DenseMatrix& x,
+    int64_t n) {
+  assert(x.cols() == n_);
+  assert(coeffs.cols() == m_);
+  Vector vec(n_);
+  for (int64_t b = 0; b < n; b++) {
+    std::copy(x.data() + b * n_, x.data() + (b + 1) * n_, vec.data());
+    for (int64_t i = 0; i < m_; i++) {
+      addVectorToRow(vec, i, coeffs.at(b, i));
+    }
+  }
+}
+
 } // namespace fasttext
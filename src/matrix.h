@@ -19,6 +19,7 @@
 namespace fasttext {
 
 class Vector;
+class DenseMatrix;
 
 class Matrix {
  protected:
@@ -36,6 +37,24 @@ class Matrix {
   virtual void addVectorToRow(const Vector&, int64_t, real) = 0;
   virtual void addRowToVector(Vector& x, int32_t i) const = 0;
   virtual void addRowToVector(Vector& x, int32_t i, real a) const = 0;
+
+  // out[i] = dotRow(x, i) for every row i.
+  virtual void mulVector(const Vector& x, Vector& out) const;
+  // x = the average of the given rows, which must not be empty.
+  virtual void averageRowsToVector(
+      const std::vector<int32_t>& rows,
+      Vector& x) const;
+
+  // Minibatch variants over the first n rows of x, one row per example.
+  // The defaults fall back to the per-row operations above.
+  virtual void dotRows(const DenseMatrix& x, DenseMatrix& out, int64_t n)
+      const;
+  virtual void addRowsToMatrix(
+      const DenseMatrix& coeffs,
+      DenseMatrix& x,
+      int64_t n) const;
+  virtual void
+  addMatrixToRows(const DenseMatrix& coeffs, const DenseMatrix& x, int64_t n);
   virtual void save(std::ostream&) const = 0;
   virtual void load(std::istream&) = 0;
   virtual void dump(std::ostream&) const = 0;
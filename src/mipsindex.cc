@@ -0,0 +1,408 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "mipsindex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "kernels.h"
+
+namespace fasttext {
+
+namespace {
+
+constexpr int32_t MIPS_MAGIC = 0x7370696d;
+constexpr int32_t MIPS_VERSION = 2;
+constexpr int32_t KMEANS_NITER = 20;
+// The k-means is trained on a sample of at least KMEANS_SAMPLE rows, and at
+// least KMEANS_SAMPLE_PER_LIST rows per list.
+constexpr int32_t KMEANS_SAMPLE = 1 << 16;
+constexpr int32_t KMEANS_SAMPLE_PER_LIST = 64;
+// Rows are assigned to lists by batches of ASSIGN_BATCH.
+constexpr int64_t ASSIGN_BATCH = 256;
+
+bool compareScores(
+    const std::pair<real, int32_t>& l,
+    const std::pair<real, int32_t>& r) {
+  return l.first > r.first;
+}
+
+// Calls fn on nthreads contiguous ranges of [0, n), one per thread.
+void parallelFor(
+    int64_t n,
+    int32_t nthreads,
+    const std::function<void(int64_t, int64_t)>& fn) {
+  nthreads = std::max<int64_t>(1, std::min<int64_t>(nthreads, n));
+  if (nthreads == 1) {
+    fn(0, n);
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < nthreads; t++) {
+    threads.push_back(
+        std::thread(fn, n * t / nthreads, n * (t + 1) / nthreads));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// lists[i] is the centroid closest to row i of x in L2 distance, that is
+// the one maximizing x.c - |c|^2 / 2.
+void assign(
+    const std::vector<real>& centroids,
+    int32_t nlist,
+    int32_t dim,
+    const real* x,
+    int64_t nx,
+    int32_t* lists) {
+  std::vector<real> halfNorms(nlist);
+  for (int32_t l = 0; l < nlist; l++) {
+    const real* c = centroids.data() + int64_t(l) * dim;
+    halfNorms[l] = 0.5 * kernels::dot(c, c, dim);
+  }
+  std::vector<real> dots(ASSIGN_BATCH * nlist);
+  for (int64_t b = 0; b < nx; b += ASSIGN_BATCH) {
+    const int64_t nb = std::min(ASSIGN_BATCH, nx - b);
+    kernels::dotRows(
+        centroids.data(), nlist, dim, x + b * dim, nb, dots.data());
+    for (int64_t i = 0; i < nb; i++) {
+      const real* d = dots.data() + i * nlist;
+      int32_t best = 0;
+      for (int32_t l = 1; l < nlist; l++) {
+        if (d[l] - halfNorms[l] > d[best] - halfNorms[best]) {
+          best = l;
+        }
+      }
+      lists[b + i] = best;
+    }
+  }
+}
+
+uint64_t hashRow(uint64_t h, const real* row, int64_t dim) {
+  for (int64_t j = 0; j < dim; j++) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, row + j, sizeof(real));
+    h = utils::fnv64Step(h, bits);
+  }
+  return h;
+}
+
+} // namespace
+
+MipsIndex::MipsIndex() : n_(0), dim_(0), nlist_(0), fingerprint_(0) {}
+
+uint64_t MipsIndex::fingerprint(const Matrix& rows) {
+  uint64_t h = utils::FNV64_OFFSET_BASIS;
+  Vector row(rows.size(1));
+  for (int64_t i = 0; i < rows.size(0); i++) {
+    row.zero();
+    rows.addRowToVector(row, i);
+    h = hashRow(h, row.data(), row.size());
+  }
+  return h;
+}
+
+bool MipsIndex::matches(const Matrix& rows) const {
+  return rows.size(0) == n_ && rows.size(1) == dim_ &&
+      fingerprint(rows) == fingerprint_;
+}
+
+void MipsIndex::build(
+    const Matrix& rows,
+    int32_t nlist,
+    int32_t nthreads,
+    int32_t seed) {
+  const int64_t n = rows.size(0);
+  if (nlist <= 0) {
+    nlist = std::max(1, int32_t(std::sqrt(double(n))));
+  }
+  if (nlist > n) {
+    throw std::invalid_argument("The index needs 0 < nlist <= rows.");
+  }
+  n_ = n;
+  dim_ = rows.size(1);
+  nlist_ = nlist;
+
+  // Rows are read through addRowToVector, so that quantized matrices are
+  // indexed as they score.
+  std::vector<real> data(int64_t(n_) * dim_);
+  parallelFor(n_, nthreads, [&](int64_t begin, int64_t end) {
+    Vector row(dim_);
+    for (int64_t i = begin; i < end; i++) {
+      row.zero();
+      rows.addRowToVector(row, i);
+      std::copy(row.data(), row.data() + dim_, data.data() + i * dim_);
+    }
+  });
+  fingerprint_ = hashRow(utils::FNV64_OFFSET_BASIS, data.data(), data.size());
+
+  // Lloyd's k-means on a sample of the rows, seeded with its first nlist_
+  // rows. An empty list gets a random row of the sample as its centroid.
+  std::vector<int32_t> perm(n_);
+  std::iota(perm.begin(), perm.end(), 0);
+  std::minstd_rand rng(seed);
+  std::shuffle(perm.begin(), perm.end(), rng);
+  const int32_t nsample = std::min<int64_t>(
+      n_,
+      std::max<int64_t>(
+          KMEANS_SAMPLE, int64_t(KMEANS_SAMPLE_PER_LIST) * nlist_));
+  std::vector<real> sample(int64_t(nsample) * dim_);
+  for (int32_t i = 0; i < nsample; i++) {
+    const real* row = data.data() + int64_t(perm[i]) * dim_;
+    std::copy(row, row + dim_, sample.data() + int64_t(i) * dim_);
+  }
+  std::uniform_int_distribution<int32_t> uniform(0, nsample - 1);
+  centroids_.assign(sample.begin(), sample.begin() + int64_t(nlist_) * dim_);
+  std::vector<int32_t> lists(nsample);
+  std::vector<int32_t> counts(nlist_);
+  for (int32_t iter = 0; iter < KMEANS_NITER; iter++) {
+    parallelFor(nsample, nthreads, [&](int64_t begin, int64_t end) {
+      assign(
+          centroids_,
+          nlist_,
+          dim_,
+          sample.data() + begin * dim_,
+          end - begin,
+          lists.data() + begin);
+    });
+    std::fill(centroids_.begin(), centroids_.end(), 0.0);
+    std::fill(counts.begin(), counts.end(), 0);
+    for (int32_t i = 0; i < nsample; i++) {
+      kernels::axpy(
+          1.0,
+          sample.data() + int64_t(i) * dim_,
+          centroids_.data() + int64_t(lists[i]) * dim_,
+          dim_);
+      counts[lists[i]]++;
+    }
+    for (int32_t l = 0; l < nlist_; l++) {
+      real* c = centroids_.data() + int64_t(l) * dim_;
+      if (counts[l] == 0) {
+        const real* x = sample.data() + int64_t(uniform(rng)) * dim_;
+        std::copy(x, x + dim_, c);
+        continue;
+      }
+      for (int32_t j = 0; j < dim_; j++) {
+        c[j] /= counts[l];
+      }
+    }
+  }
+  sample = std::vector<real>();
+
+  lists.resize(n_);
+  parallelFor(n_, nthreads, [&](int64_t begin, int64_t end) {
+    assign(
+        centroids_,
+        nlist_,
+        dim_,
+        data.data() + begin * dim_,
+        end - begin,
+        lists.data() + begin);
+  });
+  std::vector<real> rowNorms(n_);
+  radii_.assign(nlist_, 0.0);
+  std::vector<real> diff(dim_);
+  for (int32_t i = 0; i < n_; i++) {
+    const real* row = data.data() + int64_t(i) * dim_;
+    const real* c = centroids_.data() + int64_t(lists[i]) * dim_;
+    rowNorms[i] = std::sqrt(kernels::dot(row, row, dim_));
+    for (int32_t j = 0; j < dim_; j++) {
+      diff[j] = row[j] - c[j];
+    }
+    const real dist = kernels::dot(diff.data(), diff.data(), dim_);
+    radii_[lists[i]] = std::max(radii_[lists[i]], std::sqrt(dist));
+  }
+
+  listOffsets_.assign(nlist_ + 1, 0);
+  for (int32_t i = 0; i < n_; i++) {
+    listOffsets_[lists[i] + 1]++;
+  }
+  std::partial_sum(
+      listOffsets_.begin(), listOffsets_.end(), listOffsets_.begin());
+  std::vector<int32_t> next(listOffsets_.begin(), listOffsets_.end());
+  ids_.resize(n_);
+  for (int32_t i = 0; i < n_; i++) {
+    ids_[next[lists[i]]++] = i;
+  }
+  norms_.resize(n_);
+  for (int32_t l = 0; l < nlist_; l++) {
+    std::sort(
+        ids_.begin() + listOffsets_[l],
+        ids_.begin() + listOffsets_[l + 1],
+        [&rowNorms](int32_t a, int32_t b) {
+          return rowNorms[a] > rowNorms[b];
+        });
+  }
+  for (int32_t j = 0; j < n_; j++) {
+    norms_[j] = rowNorms[ids_[j]];
+  }
+}
+
+// best is a min-heap of the k best rows while lists are scanned, and any
+// row scoring below cutoff cannot enter it. For the log-softmax, the
+// normalizer is at least the sum over the rows scanned so far,
+// exp(maxScore) * z, which raises the cutoff of minScore as well. Its
+// lists are scanned whole, since the rows of a list that the norm bound
+// would skip are the ones its centroid represents the worst.
+template <bool logSoftmax>
+void MipsIndex::scan(
+    const Matrix& rows,
+    const Vector& query,
+    int32_t k,
+    real minScore,
+    Predictions& best) const {
+  best.clear();
+  if (n_ == 0 || k <= 0) {
+    return;
+  }
+  // Scratch space of the thread, so that searching does not allocate.
+  static thread_local std::vector<real> centroidScores;
+  static thread_local Predictions bounds;
+  centroidScores.resize(nlist_);
+  kernels::dotRows(
+      centroids_.data(), nlist_, dim_, query.data(), 1, centroidScores.data());
+  const real queryNorm = query.norm();
+  bounds.resize(nlist_);
+  for (int32_t l = 0; l < nlist_; l++) {
+    bounds[l] = std::make_pair(centroidScores[l] + radii_[l] * queryNorm, l);
+  }
+  std::sort(bounds.begin(), bounds.end(), compareScores);
+
+  real maxScore = -std::numeric_limits<real>::infinity();
+  double z = 0.0;
+  real cutoff = minScore;
+  int32_t p = 0;
+  for (; p < nlist_ && bounds[p].first >= cutoff; p++) {
+    const int32_t l = bounds[p].second;
+    for (int32_t j = listOffsets_[l]; j < listOffsets_[l + 1]; j++) {
+      if (!logSoftmax && norms_[j] * queryNorm < cutoff) {
+        break;
+      }
+      const real score = rows.dotRow(query, ids_[j]);
+      if (logSoftmax) {
+        if (score > maxScore) {
+          z = z * std::exp(maxScore - score) + 1.0;
+          maxScore = score;
+        } else {
+          z += std::exp(score - maxScore);
+        }
+        cutoff = minScore + maxScore + std::log(z);
+      }
+      if (score >= cutoff) {
+        best.push_back(std::make_pair(score, ids_[j]));
+        std::push_heap(best.begin(), best.end(), compareScores);
+        if (best.size() > k) {
+          std::pop_heap(best.begin(), best.end(), compareScores);
+          best.pop_back();
+        }
+      }
+      if (best.size() == k) {
+        cutoff = std::max(cutoff, best.front().first);
+      }
+    }
+  }
+  std::sort_heap(best.begin(), best.end(), compareScores);
+
+  if (logSoftmax && !best.empty()) {
+    for (; p < nlist_; p++) {
+      const int32_t l = bounds[p].second;
+      z += (listOffsets_[l + 1] - listOffsets_[l]) *
+          std::exp(centroidScores[l] - maxScore);
+    }
+    const real logZ = maxScore + std::log(z);
+    for (auto& prediction : best) {
+      prediction.first -= logZ;
+    }
+    while (!best.empty() && best.back().first < minScore) {
+      best.pop_back();
+    }
+  }
+}
+
+void MipsIndex::search(
+    const Matrix& rows,
+    const Vector& query,
+    int32_t k,
+    real minScore,
+    Predictions& best) const {
+  scan<false>(rows, query, k, minScore, best);
+}
+
+void MipsIndex::searchLogSoftmax(
+    const Matrix& rows,
+    const Vector& query,
+    int32_t k,
+    real minScore,
+    Predictions& best) const {
+  scan<true>(rows, query, k, minScore, best);
+}
+
+void MipsIndex::save(std::ostream& out) const {
+  out.write((char*)&MIPS_MAGIC, sizeof(int32_t));
+  out.write((char*)&MIPS_VERSION, sizeof(int32_t));
+  out.write((char*)&n_, sizeof(int32_t));
+  out.write((char*)&dim_, sizeof(int32_t));
+  out.write((char*)&nlist_, sizeof(int32_t));
+  out.write((char*)&fingerprint_, sizeof(uint64_t));
+  out.write((char*)centroids_.data(), int64_t(nlist_) * dim_ * sizeof(real));
+  out.write((char*)radii_.data(), nlist_ * sizeof(real));
+  out.write((char*)listOffsets_.data(), (nlist_ + 1) * sizeof(int32_t));
+  out.write((char*)ids_.data(), n_ * sizeof(int32_t));
+  out.write((char*)norms_.data(), n_ * sizeof(real));
+}
+
+void MipsIndex::load(std::istream& in) {
+  int32_t magic, version;
+  in.read((char*)&magic, sizeof(int32_t));
+  in.read((char*)&version, sizeof(int32_t));
+  if (!in || magic != MIPS_MAGIC || version != MIPS_VERSION) {
+    throw std::invalid_argument("Invalid index file: wrong magic or version.");
+  }
+  in.read((char*)&n_, sizeof(int32_t));
+  in.read((char*)&dim_, sizeof(int32_t));
+  in.read((char*)&nlist_, sizeof(int32_t));
+  in.read((char*)&fingerprint_, sizeof(uint64_t));
+  if (!in || n_ <= 0 || dim_ <= 0 || nlist_ <= 0 || nlist_ > n_) {
+    throw std::invalid_argument("Invalid index file: bad header.");
+  }
+  centroids_.resize(int64_t(nlist_) * dim_);
+  in.read((char*)centroids_.data(), int64_t(nlist_) * dim_ * sizeof(real));
+  radii_.resize(nlist_);
+  in.read((char*)radii_.data(), nlist_ * sizeof(real));
+  listOffsets_.resize(nlist_ + 1);
+  in.read((char*)listOffsets_.data(), (nlist_ + 1) * sizeof(int32_t));
+  ids_.resize(n_);
+  in.read((char*)ids_.data(), n_ * sizeof(int32_t));
+  norms_.resize(n_);
+  in.read((char*)norms_.data(), n_ * sizeof(real));
+  if (!in || listOffsets_[0] != 0 || listOffsets_[nlist_] != n_) {
+    throw std::invalid_argument("Invalid index file: bad lists.");
+  }
+  // Searches index the rows with ids_, within the bounds of listOffsets_.
+  for (int32_t l = 0; l < nlist_; l++) {
+    if (listOffsets_[l] > listOffsets_[l + 1]) {
+      throw std::invalid_argument("Invalid index file: bad lists.");
+    }
+  }
+  for (int32_t id : ids_) {
+    if (id < 0 || id >= n_) {
+      throw std::invalid_argument("Invalid index file: bad ids.");
+    }
+  }
+}
+
+} // namespace fasttext
@@ -0,0 +1,105 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "matrix.h"
+#include "real.h"
+#include "utils.h"
+#include "vector.h"
+
+namespace fasttext {
+
+// Exact maximum inner product search over the rows of a matrix, typically
+// the output matrix of a classifier, that scores only the rows that may
+// make the top k. A k-means splits the rows into nlist lists, and the score
+// of any row w of list l with a query q is bounded by both
+//   q.c_l + r_l |q|  and  |w| |q|,
+// where c_l is the centroid of the list and r_l its radius. Lists are
+// scanned by decreasing bound, each one by decreasing row norm, until the
+// bound falls below the k-th best score found so far.
+//
+// The index only holds the structure of the rows: searches score the rows
+// of the matrix it was built on, whatever its type. It keeps a checksum of
+// them, so that it is not used with other rows, e.g. those of a retrained
+// model, which its bounds would not hold for.
+class MipsIndex {
+ protected:
+  int32_t n_;
+  int32_t dim_;
+  int32_t nlist_;
+  uint64_t fingerprint_;
+  std::vector<real> centroids_;
+  std::vector<real> radii_;
+  // The rows of list l are ids_[listOffsets_[l]] to
+  // ids_[listOffsets_[l + 1] - 1], by decreasing norm, which is in norms_.
+  std::vector<int32_t> listOffsets_;
+  std::vector<int32_t> ids_;
+  std::vector<real> norms_;
+
+  template <bool logSoftmax>
+  void scan(
+      const Matrix& rows,
+      const Vector& query,
+      int32_t k,
+      real minScore,
+      Predictions& best) const;
+
+ public:
+  MipsIndex();
+  MipsIndex(const MipsIndex&) = delete;
+  MipsIndex& operator=(const MipsIndex&) = delete;
+
+  int32_t size() const {
+    return n_;
+  }
+
+  int32_t dim() const {
+    return dim_;
+  }
+
+  // Whether rows are those the index was built on.
+  bool matches(const Matrix& rows) const;
+
+  // Checksum of the rows, as read by addRowToVector.
+  static uint64_t fingerprint(const Matrix& rows);
+
+  // Indexes the rows into nlist lists, or about sqrt(rows) if nlist is 0,
+  // with a k-means trained on nthreads threads.
+  void build(const Matrix& rows, int32_t nlist, int32_t nthreads, int32_t seed);
+
+  // Writes to best the k rows of largest inner product with query among
+  // those scoring at least minScore, by decreasing score.
+  void search(
+      const Matrix& rows,
+      const Vector& query,
+      int32_t k,
+      real minScore,
+      Predictions& best) const;
+
+  // Same for the log-softmax of the scores over all the rows. Lists are
+  // scanned whole, and the normalizer counts the rows of the lists that are
+  // not scanned as their centroid: the rows found are exact, and their
+  // log-softmax is close to it.
+  void searchLogSoftmax(
+      const Matrix& rows,
+      const Vector& query,
+      int32_t k,
+      real minScore,
+      Predictions& best) const;
+
+  void save(std::ostream&) const;
+  void load(std::istream&);
+};
+
+} // namespace fasttext
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "mmapmatrix.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <stdexcept>
+
+#include "densematrix.h"
+#include "kernels.h"
+#include "vector.h"
+
+namespace fasttext {
+
+MmapMatrix::MmapMatrix(std::shared_ptr<const MappedFile> file)
+    : Matrix(), file_(file), data_(nullptr) {}
+
+real MmapMatrix::dotRow(const Vector& vec, int64_t i) const {
+  assert(i >= 0);
+  assert(i < m_);
+  assert(vec.size() == n_);
+  real d = kernels::dot(row(i), vec.data(), n_);
+  if (std::isnan(d)) {
+    throw DenseMatrix::EncounteredNaNError();
+  }
+  return d;
+}
+
+void MmapMatrix::addVectorToRow(const Vector&, int64_t, real) {
+  throw std::runtime_error(
+      "Operation not permitted on memory-mapped matrices.");
+}
+
+void MmapMatrix::addRowToVector(Vector& x, int32_t i) const {
+  assert(i >= 0);
+  assert(i < this->size(0));
+  assert(x.size() == this->size(1));
+  kernels::axpy(1.0, row(i), x.data(), n_);
+}
+
+void MmapMatrix::addRowToVector(Vector& x, int32_t i, real a) const {
+  assert(i >= 0);
+  assert(i < this->size(0));
+  assert(x.size() == this->size(1));
+  kernels::axpy(a, row(i), x.data(), n_);
+}
+
+void MmapMatrix::dotRows(const DenseMatrix& x, DenseMatrix& out, int64_t n)
+    const {
+  assert(x.cols() == n_);
+  assert(out.cols() == m_);
+  assert(n <= x.rows() && n <= out.rows());
+  if (!kernels::dotRows(data_, m_, n_, x.data(), n, out.data())) {
+    throw DenseMatrix::EncounteredNaNError();
+  }
+}
+
+void MmapMatrix::save(std::ostream& out) const {
+  out.write((char*)&m_, sizeof(int64_t));
+  out.write((char*)&n_, sizeof(int64_t));
+  out.write((char*)data_, m_ * n_ * sizeof(real));
+}
+
+void MmapMatrix::load(std::istream& in) {
+  in.read((char*)&m_, sizeof(int64_t));
+  in.read((char*)&n_, sizeof(int64_t));
+  int64_t offset = in.tellg();
+  int64_t bytes = m_ * n_ * sizeof(real);
+  if (!in || offset < 0 || offset + bytes > file_->size()) {
+    throw std::invalid_argument("Invalid model file: matrix out of range.");
+  }
+  if (offset % sizeof(real) != 0) {
+    throw std::invalid_argument(
+        "Invalid model file: matrix is not aligned for memory mapping.");
+  }
+  data_ = reinterpret_cast<const real*>(file_->data() + offset);
+  in.seekg(bytes, std::ios_base::cur);
+}
+
+void MmapMatrix::dump(std::ostream& out) const {
+  out << m_ << " " << n_ << std::endl;
+  for (int64_t i = 0; i < m_; i++) {
+    for (int64_t j = 0; j < n_; j++) {
+      if (j > 0) {
+        out << " ";
+      }
+      out << row(i)[j];
+    }
+    out << std::endl;
+  }
+}
+
+} // namespace fasttext
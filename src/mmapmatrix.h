@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+
+#include "mappedfile.h"
+#include "matrix.h"
+#include "real.h"
+
+namespace fasttext {
+
+class Vector;
+class DenseMatrix;
+
+// Dense matrix whose rows live in a MappedFile. It uses the same on-disk
+// format as DenseMatrix, but load() only records where the rows are instead
+// of copying them, so it cannot be modified.
+class MmapMatrix : public Matrix {
+ protected:
+  std::shared_ptr<const MappedFile> file_;
+  const real* data_;
+
+  inline const real* row(int64_t i) const {
+    return data_ + i * n_;
+  }
+
+ public:
+  explicit MmapMatrix(std::shared_ptr<const MappedFile> file);
+  MmapMatrix(const MmapMatrix&) = delete;
+  MmapMatrix& operator=(const MmapMatrix&) = delete;
+  virtual ~MmapMatrix() noexcept override = default;
+
+  real dotRow(const Vector&, int64_t) const override;
+  void addVectorToRow(const Vector&, int64_t, real) override;
+  void addRowToVector(Vector& x, int32_t i) const override;
+  void addRowToVector(Vector& x, int32_t i, real a) const override;
+  void dotRows(const DenseMatrix& x, DenseMatrix& out, int64_t n)
+      const override;
+  void save(std::ostream&) const override;
+  void load(std::istream&) override;
+  void dump(std::ostream&) const override;
+};
+
+} // namespace fasttext
@@ -7,6 +7,7 @@
  */
 
 #include "model.h"
+#include "kernels.h"
 #include "loss.h"
 #include "utils.h"
 
@@ -32,6 +33,118 @@ void Model::State::incrementNExamples(real loss) {
   nexamples_++;
 }
 
+Model::BatchState::BatchState(
+    int32_t batchSize,
+    int32_t hiddenSize,
+    int32_t outputSize,
+    int32_t seed)
+    : lossValue_(0.0),
+      nexamples_(0),
+      size_(0),
+      queued_(0),
+      hidden(batchSize, hiddenSize),
+      output(batchSize, outputSize),
+      grad(batchSize, hiddenSize),
+      losses(batchSize),
+      example(hiddenSize, outputSize, seed),
+      rng(example.rng),
+      inputs(batchSize),
+      targets(batchSize),
+      targetIndices(batchSize) {}
+
+int64_t Model::BatchState::size() const {
+  return size_;
+}
+
+int64_t Model::BatchState::capacity() const {
+  return hidden.rows();
+}
+
+void Model::BatchState::setSize(int64_t size) {
+  assert(size <= capacity());
+  size_ = size;
+}
+
+real Model::BatchState::getLoss() const {
+  return lossValue_ / nexamples_;
+}
+
+void Model::BatchState::incrementNExamples(real loss) {
+  lossValue_ += loss;
+  nexamples_++;
+}
+
+void Model::BatchState::loadExample(int64_t b) {
+  assert(b < size_);
+  const real* row = hidden.data() + b * hidden.cols();
+  std::copy(row, row + hidden.cols(), example.hidden.data());
+  example.grad.zero();
+}
+
+void Model::BatchState::storeExample(int64_t b) {
+  assert(b < size_);
+  std::copy(
+      example.grad.data(),
+      example.grad.data() + grad.cols(),
+      grad.data() + b * grad.cols());
+  std::copy(
+      example.output.data(),
+      example.output.data() + output.cols(),
+      output.data() + b * output.cols());
+}
+
+int64_t Model::BatchState::queued() const {
+  return queued_;
+}
+
+void Model::BatchState::enqueue(
+    const std::vector<int32_t>& input,
+    const std::vector<int32_t>& targets,
+    int32_t targetIndex,
+    bool allTargets) {
+  assert(queued_ < capacity());
+  this->inputs[queued_].assign(input.cbegin(), input.cend());
+  if (allTargets) {
+    this->targets[queued_].assign(targets.cbegin(), targets.cend());
+    this->targetIndices[queued_] = targetIndex;
+  } else {
+    // only the selected target is used, no need to copy the whole line
+    this->targets[queued_].assign(1, targets[targetIndex]);
+    this->targetIndices[queued_] = 0;
+  }
+  queued_++;
+}
+
+void Model::BatchState::clearQueue() {
+  queued_ = 0;
+}
+
+void Model::BatchState::accumulateRow(int32_t row, const Vector& grad) {
+  const int64_t dim = grad.size();
+  auto it = rowIndex_.find(row);
+  if (it == rowIndex_.end()) {
+    it = rowIndex_.emplace(row, rows_.size()).first;
+    rows_.push_back(row);
+    rowGrads_.resize(rowGrads_.size() + dim, 0.0);
+  }
+  kernels::axpy(1.0, grad.data(), rowGrads_.data() + it->second * dim, dim);
+}
+
+void Model::BatchState::flushRows(Matrix& wi) {
+  Vector& rowGrad = example.grad;
+  const int64_t dim = rowGrad.size();
+  for (int64_t k = 0; k < rows_.size(); k++) {
+    std::copy(
+        rowGrads_.data() + k * dim,
+        rowGrads_.data() + (k + 1) * dim,
+        rowGrad.data());
+    wi.addVectorToRow(rowGrad, rows_[k], 1.0);
+  }
+  rows_.clear();
+  rowIndex_.clear();
+  rowGrads_.clear();
+}
+
 Model::Model(
     std::shared_ptr<Matrix> wi,
     std::shared_ptr<Matrix> wo,
@@ -41,12 +154,7 @@ Model::Model(
 
 void Model::computeHidden(const std::vector<int32_t>& input, State& state)
     const {
-  Vector& hidden = state.hidden;
-  hidden.zero();
-  for (auto it = input.cbegin(); it != input.cend(); ++it) {
-    hidden.addRow(*wi_, *it);
-  }
-  hidden.mul(1.0 / input.size());
+  wi_->averageRowsToVector(input, state.hidden);
 }
 
 void Model::predict(
@@ -90,8 +198,127 @@ void Model::update(
   }
 }
 
+void Model::computeHidden(
+    const std::vector<std::vector<int32_t>>& inputs,
+    BatchState& state) const {
+  state.setSize(inputs.size());
+  const int64_t dim = state.hidden.cols();
+  for (int64_t b = 0; b < inputs.size(); b++) {
+    if (inputs[b].empty()) {
+      state.example.hidden.zero();
+    } else {
+      computeHidden(inputs[b], state.example);
+    }
+    std::copy(
+        state.example.hidden.data(),
+        state.example.hidden.data() + dim,
+        state.hidden.data() + b * dim);
+  }
+}
+
+void Model::predict(
+    const std::vector<std::vector<int32_t>>& inputs,
+    int32_t k,
+    real threshold,
+    std::vector<Predictions>& heaps,
+    BatchState& state) const {
+  if (k == Model::kUnlimitedPredictions) {
+    k = wo_->size(0); // output size
+  } else if (k <= 0) {
+    throw std::invalid_argument("k needs to be 1 or higher!");
+  }
+  heaps.resize(inputs.size());
+  for (auto& heap : heaps) {
+    heap.clear();
+    heap.reserve(k + 1);
+  }
+  computeHidden(inputs, state);
+
+  loss_->predict(k, threshold, heaps, state);
+  for (int64_t b = 0; b < inputs.size(); b++) {
+    if (inputs[b].empty()) {
+      heaps[b].clear();
+    }
+  }
+}
+
+void Model::update(
+    const std::vector<std::vector<int32_t>>& inputs,
+    const std::vector<std::vector<int32_t>>& targets,
+    const std::vector<int32_t>& targetIndices,
+    real lr,
+    BatchState& state) {
+  assert(inputs.size() == targets.size());
+  assert(inputs.size() == targetIndices.size());
+  computeHidden(inputs, state);
+
+  state.grad.zero();
+  loss_->forward(targets, targetIndices, state, lr, true);
+
+  Vector& grad = state.example.grad;
+  const int64_t dim = state.grad.cols();
+  for (int64_t b = 0; b < inputs.size(); b++) {
+    const std::vector<int32_t>& input = inputs[b];
+    if (input.size() == 0) {
+      continue;
+    }
+    state.incrementNExamples(state.losses[b]);
+    std::copy(
+        state.grad.data() + b * dim,
+        state.grad.data() + (b + 1) * dim,
+        grad.data());
+    if (normalizeGradient_) {
+      grad.mul(1.0 / input.size());
+    }
+    for (auto it = input.cbegin(); it != input.cend(); ++it) {
+      state.accumulateRow(*it, grad);
+    }
+  }
+  state.flushRows(*wi_);
+}
+
+void Model::update(
+    const std::vector<int32_t>& input,
+    const std::vector<int32_t>& targets,
+    int32_t targetIndex,
+    real lr,
+    BatchState& state) {
+  if (input.size() == 0) {
+    return;
+  }
+  state.enqueue(
+      input,
+      targets,
+      targetIndex,
+      targetIndex == kAllLabelsAsTarget || loss_->usesAllTargets());
+  if (state.queued() == state.capacity()) {
+    update(state.inputs, state.targets, state.targetIndices, lr, state);
+    state.clearQueue();
+  }
+}
+
+void Model::flush(real lr, BatchState& state) {
+  const int64_t n = state.queued();
+  if (n == 0) {
+    return;
+  }
+  const int64_t capacity = state.capacity();
+  state.inputs.resize(n);
+  state.targets.resize(n);
+  state.targetIndices.resize(n);
+  update(state.inputs, state.targets, state.targetIndices, lr, state);
+  state.inputs.resize(capacity);
+  state.targets.resize(capacity);
+  state.targetIndices.resize(capacity);
+  state.clearQueue();
+}
+
 real Model::std_log(real x) const {
   return std::log(x + 1e-5);
 }
 
+void Model::setIndex(std::shared_ptr<const MipsIndex> index) {
+  loss_->setIndex(index);
+}
+
 } // namespace fasttext
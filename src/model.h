@@ -10,9 +10,11 @@
 
 #include <memory>
 #include <random>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "densematrix.h"
 #include "matrix.h"
 #include "real.h"
 #include "utils.h"
@@ -21,6 +23,7 @@
 namespace fasttext {
 
 class Loss;
+class MipsIndex;
 
 class Model {
  protected:
@@ -56,6 +59,56 @@ class Model {
     void incrementNExamples(real loss);
   };
 
+  class BatchState {
+   private:
+    real lossValue_;
+    int64_t nexamples_;
+    int64_t size_;
+    int64_t queued_;
+    std::vector<int32_t> rows_;
+    std::unordered_map<int32_t, int64_t> rowIndex_;
+    std::vector<real> rowGrads_;
+
+   public:
+    DenseMatrix hidden;
+    DenseMatrix output;
+    DenseMatrix grad;
+    std::vector<real> losses;
+    State example;
+    std::minstd_rand& rng;
+
+    // Training examples queued by update() until the batch is full.
+    std::vector<std::vector<int32_t>> inputs;
+    std::vector<std::vector<int32_t>> targets;
+    std::vector<int32_t> targetIndices;
+
+    BatchState(
+        int32_t batchSize,
+        int32_t hiddenSize,
+        int32_t outputSize,
+        int32_t seed);
+    int64_t size() const;
+    int64_t capacity() const;
+    void setSize(int64_t size);
+    real getLoss() const;
+    void incrementNExamples(real loss);
+    void loadExample(int64_t b);
+    void storeExample(int64_t b);
+
+    int64_t queued() const;
+    void enqueue(
+        const std::vector<int32_t>& input,
+        const std::vector<int32_t>& targets,
+        int32_t targetIndex,
+        bool allTargets);
+    void clearQueue();
+
+    // Sums the gradients of the input rows touched by a batch, so that each
+    // row of the shared matrix is written once per batch.
+    void accumulateRow(int32_t row, const Vector& grad);
+    void flushRows(Matrix& wi);
+  };
+
   void predict(
       const std::vector<int32_t>& input,
       int32_t k,
@@ -70,8 +123,37 @@ class Model {
       State& state);
   void computeHidden(const std::vector<int32_t>& input, State& state) const;
 
+  void predict(
+      const std::vector<std::vector<int32_t>>& inputs,
+      int32_t k,
+      real threshold,
+      std::vector<Predictions>& heaps,
+      BatchState& state) const;
+  void update(
+      const std::vector<std::vector<int32_t>>& inputs,
+      const std::vector<std::vector<int32_t>>& targets,
+      const std::vector<int32_t>& targetIndices,
+      real lr,
+      BatchState& state);
+  void computeHidden(
+      const std::vector<std::vector<int32_t>>& inputs,
+      BatchState& state) const;
+
+  // Queues one example and updates the model once the batch is full. flush
+  // updates the model with the examples still queued.
+  void update(
+      const std::vector<int32_t>& input,
+      const std::vector<int32_t>& targets,
+      int32_t targetIndex,
+      real lr,
+      BatchState& state);
+  void flush(real lr, BatchState& state);
+
   real std_log(real) const;
 
+  // Predicts with an index of the rows of wo, see Loss::setIndex.
+  void setIndex(std::shared_ptr<const MipsIndex> index);
+
   static const int32_t kUnlimitedPredictions = -1;
   static const int32_t kAllLabelsAsTarget = -1;
 };
@@ -9,10 +9,14 @@
 #include "productquantizer.h"
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <numeric>
 #include <stdexcept>
 #include <string>
+#include <thread>
+
+#include "kernels.h"
 
 namespace fasttext {
 
@@ -29,8 +33,7 @@ ProductQuantizer::ProductQuantizer(int32_t dim, int32_t dsub)
     : dim_(dim),
       nsubq_(dim / dsub),
       dsub_(dsub),
-      centroids_(dim * ksub_),
-      rng(seed_) {
+      centroids_(dim * ksub_) {
   lastdsub_ = dim_ % dsub;
   if (lastdsub_ == 0) {
     lastdsub_ = dsub_;
@@ -39,6 +42,14 @@ ProductQuantizer::ProductQuantizer(int32_t dim, int32_t dsub)
   }
 }
 
+void ProductQuantizer::transpose(const real* c, real* out, int32_t d) const {
+  for (auto j = 0; j < ksub_; j++) {
+    for (auto k = 0; k < d; k++) {
+      out[k * ksub_ + j] = c[j * d + k];
+    }
+  }
+}
+
 const real* ProductQuantizer::get_centroids(int32_t m, uint8_t i) const {
   if (m == nsubq_ - 1) {
     return &centroids_[m * ksub_ * dsub_ + i * lastdsub_];
@@ -72,14 +83,20 @@ real ProductQuantizer::assign_centroid(
   return dis;
 }
 
+// The centroids are transposed, so that the distances of a point to all of
+// them are computed in parallel by nearestColumn.
 void ProductQuantizer::Estep(
     const real* x,
     const real* centroids,
     uint8_t* codes,
     int32_t d,
     int32_t n) const {
+  std::vector<real> transposed(d * ksub_);
+  transpose(centroids, transposed.data(), d);
+  real dist;
   for (auto i = 0; i < n; i++) {
-    assign_centroid(x + i * d, centroids, codes + i, d);
+    codes[i] =
+        kernels::nearestColumn(x + i * d, transposed.data(), d, ksub_, &dist);
   }
 }
 
@@ -88,7 +105,8 @@ void ProductQuantizer::MStep(
     real* centroids,
     const uint8_t* codes,
     int32_t d,
-    int32_t n) {
+    int32_t n,
+    std::minstd_rand& rng) const {
   std::vector<int32_t> nelts(ksub_, 0);
   memset(centroids, 0, sizeof(real) * d * ksub_);
   const real* x = x0;
@@ -132,7 +150,12 @@ void ProductQuantizer::MStep(
   }
 }
 
-void ProductQuantizer::kmeans(const real* x, real* c, int32_t n, int32_t d) {
+void ProductQuantizer::kmeans(
+    const real* x,
+    real* c,
+    int32_t n,
+    int32_t d,
+    std::minstd_rand& rng) const {
   std::vector<int32_t> perm(n, 0);
   std::iota(perm.begin(), perm.end(), 0);
   std::shuffle(perm.begin(), perm.end(), rng);
@@ -142,35 +165,45 @@ void ProductQuantizer::kmeans(const real* x, real* c, int32_t n, int32_t d) {
   auto codes = std::vector<uint8_t>(n);
   for (auto i = 0; i < niter_; i++) {
     Estep(x, c, codes.data(), d, n);
-    MStep(x, c, codes.data(), d, n);
+    MStep(x, c, codes.data(), d, n, rng);
   }
 }
 
-void ProductQuantizer::train(int32_t n, const real* x) {
+void ProductQuantizer::train(int32_t n, const real* x, int32_t nthreads) {
   if (n < ksub_) {
     throw std::invalid_argument(
         "Matrix too small for quantization, must have at least " +
         std::to_string(ksub_) + " rows");
   }
-  std::vector<int32_t> perm(n, 0);
-  std::iota(perm.begin(), perm.end(), 0);
-  auto d = dsub_;
   auto np = std::min(n, max_points_);
-  auto xslice = std::vector<real>(np * dsub_);
-  for (auto m = 0; m < nsubq_; m++) {
-    if (m == nsubq_ - 1) {
-      d = lastdsub_;
-    }
-    if (np != n) {
-      std::shuffle(perm.begin(), perm.end(), rng);
-    }
-    for (auto j = 0; j < np; j++) {
-      memcpy(
-          xslice.data() + j * d,
-          x + perm[j] * dim_ + m * dsub_,
-          d * sizeof(real));
+  std::atomic<int32_t> next(0);
+  auto trainSubquantizers = [&]() {
+    std::vector<int32_t> perm(n, 0);
+    auto xslice = std::vector<real>(np * dsub_);
+    for (auto m = next++; m < nsubq_; m = next++) {
+      std::minstd_rand rng(seed_ + m);
+      auto d = m == nsubq_ - 1 ? lastdsub_ : dsub_;
+      std::iota(perm.begin(), perm.end(), 0);
+      if (np != n) {
+        std::shuffle(perm.begin(), perm.end(), rng);
+      }
+      for (auto j = 0; j < np; j++) {
+        memcpy(
+            xslice.data() + j * d,
+            x + perm[j] * dim_ + m * dsub_,
+            d * sizeof(real));
+      }
+      kmeans(xslice.data(), get_centroids(m, 0), np, d, rng);
     }
-    kmeans(xslice.data(), get_centroids(m, 0), np, d);
+  };
+  nthreads = std::max(1, std::min(nthreads, nsubq_));
+  std::vector<std::thread> threads;
+  for (auto t = 1; t < nthreads; t++) {
+    threads.push_back(std::thread(trainSubquantizers));
+  }
+  trainSubquantizers();
+  for (auto& thread : threads) {
+    thread.join();
   }
 }
 
@@ -194,6 +227,19 @@ real ProductQuantizer::mulcode(
   return res * alpha;
 }
 
+real ProductQuantizer::mulcode(
+    const real* table,
+    const uint8_t* codes,
+    int32_t t,
+    real alpha) const {
+  real res = 0.0;
+  const uint8_t* code = codes + nsubq_ * t;
+  for (auto m = 0; m < nsubq_; m++) {
+    res += table[m * ksub_ + code[m]];
+  }
+  return res * alpha;
+}
+
 void ProductQuantizer::addcode(
     Vector& x,
     const uint8_t* codes,
@@ -212,6 +258,25 @@ void ProductQuantizer::addcode(
   }
 }
 
+void ProductQuantizer::compute_dot_table(const real* x, real* table) const {
+  auto d = dsub_;
+  for (auto m = 0; m < nsubq_; m++) {
+    if (m == nsubq_ - 1) {
+      d = lastdsub_;
+    }
+    const real* xm = x + m * dsub_;
+    const real* c = get_centroids(m, 0);
+    for (auto j = 0; j < ksub_; j++) {
+      real res = 0.0;
+      for (auto n = 0; n < d; n++) {
+        res += xm[n] * c[n];
+      }
+      table[m * ksub_ + j] = res;
+      c += d;
+    }
+  }
+}
+
 void ProductQuantizer::compute_code(const real* x, uint8_t* code) const {
   auto d = dsub_;
   for (auto m = 0; m < nsubq_; m++) {
@@ -222,10 +287,42 @@ void ProductQuantizer::compute_code(const real* x, uint8_t* code) const {
   }
 }
 
-void ProductQuantizer::compute_codes(const real* x, uint8_t* codes, int32_t n)
-    const {
-  for (auto i = 0; i < n; i++) {
-    compute_code(x + i * dim_, codes + i * nsubq_);
+void ProductQuantizer::compute_codes(
+    const real* x,
+    uint8_t* codes,
+    int32_t n,
+    int32_t nthreads) const {
+  // the centroids of sub-quantizer m, transposed, start at m * dsub_ * ksub_
+  std::vector<real> transposed(dim_ * ksub_);
+  for (auto m = 0; m < nsubq_; m++) {
+    auto d = m == nsubq_ - 1 ? lastdsub_ : dsub_;
+    transpose(get_centroids(m, 0), transposed.data() + m * dsub_ * ksub_, d);
+  }
+  auto encode = [&](int64_t begin, int64_t end) {
+    real dist;
+    for (auto i = begin; i < end; i++) {
+      for (auto m = 0; m < nsubq_; m++) {
+        auto d = m == nsubq_ - 1 ? lastdsub_ : dsub_;
+        codes[i * nsubq_ + m] = kernels::nearestColumn(
+            x + i * dim_ + m * dsub_,
+            transposed.data() + m * dsub_ * ksub_,
+            d,
+            ksub_,
+            &dist);
+      }
+    }
+  };
+  if (nthreads <= 1) {
+    encode(0, n);
+    return;
+  }
+  std::vector<std::thread> threads;
+  for (auto t = 0; t < nthreads; t++) {
+    threads.push_back(std::thread(
+        encode, int64_t(n) * t / nthreads, int64_t(n) * (t + 1) / nthreads));
+  }
+  for (auto& thread : threads) {
+    thread.join();
   }
 }
 
@@ -36,25 +36,52 @@ class ProductQuantizer {
 
   std::vector<real> centroids_;
 
-  std::minstd_rand rng;
+  // Writes the ksub_ centroids of dimension d starting at c as the rows of
+  // a d x ksub_ matrix.
+  void transpose(const real* c, real* out, int32_t d) const;
 
  public:
   ProductQuantizer() {}
   ProductQuantizer(int32_t, int32_t);
 
+  int32_t get_nsubq() const {
+    return nsubq_;
+  }
+
+  int32_t get_ksub() const {
+    return ksub_;
+  }
+
   real* get_centroids(int32_t, uint8_t);
   const real* get_centroids(int32_t, uint8_t) const;
 
   real assign_centroid(const real*, const real*, uint8_t*, int32_t) const;
   void Estep(const real*, const real*, uint8_t*, int32_t, int32_t) const;
-  void MStep(const real*, real*, const uint8_t*, int32_t, int32_t);
-  void kmeans(const real*, real*, int32_t, int32_t);
-  void train(int, const real*);
+  void MStep(
+      const real*,
+      real*,
+      const uint8_t*,
+      int32_t,
+      int32_t,
+      std::minstd_rand& rng) const;
+  void kmeans(const real*, real*, int32_t, int32_t, std::minstd_rand& rng)
+      const;
+  // The sub-quantizers are trained on nthreads threads, each one with its
+  // own random generator, so that the centroids only depend on the seed.
+  void train(int, const real*, int32_t nthreads = 1);
 
   real mulcode(const Vector&, const uint8_t*, int32_t, real) const;
+  // Same as above for the vector x whose compute_dot_table is table, with
+  // nsubq lookups instead of dim multiplications.
+  real mulcode(const real* table, const uint8_t*, int32_t, real) const;
   void addcode(Vector&, const uint8_t*, int32_t, real) const;
+  // table[m * ksub + j] is the inner product of the m-th subvector of x
+  // with centroid j of sub-quantizer m, so that the inner product of x with
+  // the vector of a code is a sum of nsubq table entries.
+  void compute_dot_table(const real* x, real* table) const;
   void compute_code(const real*, uint8_t*) const;
-  void compute_codes(const real*, uint8_t*, int32_t) const;
+  void compute_codes(const real*, uint8_t*, int32_t, int32_t nthreads = 1)
+      const;
 
   void save(std::ostream&) const;
   void load(std::istream&);
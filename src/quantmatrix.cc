@@ -9,24 +9,161 @@
 #include "quantmatrix.h"
 
 #include <assert.h>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <stdexcept>
 
+#include "kernels.h"
+
 namespace fasttext {
 
-QuantMatrix::QuantMatrix() : Matrix(), qnorm_(false), codesize_(0) {}
+namespace {
+
+// Iterations of the alternate optimization of the rotation and the codes.
+constexpr int32_t OPQ_NITER = 8;
+// Rows of the matrix sampled to learn the rotation.
+constexpr int64_t OPQ_MAX_POINTS = 1 << 16;
+constexpr int32_t JACOBI_MAX_SWEEPS = 64;
+
+// Replaces the n x n matrix a = U S V^T by its orthogonal factor U V^T,
+// the rotation R minimizing |X R - Y| when a = X^T Y. The singular value
+// decomposition is computed with one-sided Jacobi rotations of the columns
+// of a, which converge to U S, while the same rotations of the identity
+// give V.
+void orthogonalFactor(std::vector<double>& a, int64_t n) {
+  std::vector<double> v(n * n, 0.0);
+  for (int64_t i = 0; i < n; i++) {
+    v[i * n + i] = 1.0;
+  }
+  for (int32_t sweep = 0; sweep < JACOBI_MAX_SWEEPS; sweep++) {
+    bool rotated = false;
+    for (int64_t p = 0; p < n; p++) {
+      for (int64_t q = p + 1; q < n; q++) {
+        double alpha = 0.0, beta = 0.0, gamma = 0.0;
+        for (int64_t i = 0; i < n; i++) {
+          alpha += a[i * n + p] * a[i * n + p];
+          beta += a[i * n + q] * a[i * n + q];
+          gamma += a[i * n + p] * a[i * n + q];
+        }
+        if (std::abs(gamma) <= 1e-15 * std::sqrt(alpha * beta)) {
+          continue;
+        }
+        rotated = true;
+        double zeta = (beta - alpha) / (2.0 * gamma);
+        double t = (zeta >= 0 ? 1.0 : -1.0) /
+            (std::abs(zeta) + std::sqrt(1.0 + zeta * zeta));
+        double c = 1.0 / std::sqrt(1.0 + t * t);
+        double s = c * t;
+        for (int64_t i = 0; i < n; i++) {
+          double ap = a[i * n + p], aq = a[i * n + q];
+          a[i * n + p] = c * ap - s * aq;
+          a[i * n + q] = s * ap + c * aq;
+          double vp = v[i * n + p], vq = v[i * n + q];
+          v[i * n + p] = c * vp - s * vq;
+          v[i * n + q] = s * vp + c * vq;
+        }
+      }
+    }
+    if (!rotated) {
+      break;
+    }
+  }
+
+  // The columns of U are those of U S, normalized. Columns of null singular
+  // value are completed into an orthonormal basis from the unit vectors.
+  double maxNorm = 0.0;
+  std::vector<double> norms(n, 0.0);
+  for (int64_t p = 0; p < n; p++) {
+    for (int64_t i = 0; i < n; i++) {
+      norms[p] += a[i * n + p] * a[i * n + p];
+    }
+    norms[p] = std::sqrt(norms[p]);
+    maxNorm = std::max(maxNorm, norms[p]);
+  }
+  std::vector<bool> done(n, false);
+  for (int64_t p = 0; p < n; p++) {
+    if (norms[p] > 1e-10 * maxNorm) {
+      for (int64_t i = 0; i < n; i++) {
+        a[i * n + p] /= norms[p];
+      }
+      done[p] = true;
+    }
+  }
+  int64_t unit = 0;
+  for (int64_t p = 0; p < n; p++) {
+    while (!done[p] && unit < n) {
+      std::vector<double> u(n, 0.0);
+      u[unit++] = 1.0;
+      for (int64_t r = 0; r < n; r++) {
+        if (!done[r]) {
+          continue;
+        }
+        double d = 0.0;
+        for (int64_t i = 0; i < n; i++) {
+          d += u[i] * a[i * n + r];
+        }
+        for (int64_t i = 0; i < n; i++) {
+          u[i] -= d * a[i * n + r];
+        }
+      }
+      double norm = 0.0;
+      for (int64_t i = 0; i < n; i++) {
+        norm += u[i] * u[i];
+      }
+      norm = std::sqrt(norm);
+      if (norm > 0.5) {
+        for (int64_t i = 0; i < n; i++) {
+          a[i * n + p] = u[i] / norm;
+        }
+        done[p] = true;
+      }
+    }
+  }
+
+  std::vector<double> r(n * n, 0.0);
+  for (int64_t i = 0; i < n; i++) {
+    for (int64_t j = 0; j < n; j++) {
+      double d = 0.0;
+      for (int64_t p = 0; p < n; p++) {
+        d += a[i * n + p] * v[j * n + p];
+      }
+      r[i * n + j] = d;
+    }
+  }
+  a.swap(r);
+}
+
+} // namespace
+
+QuantMatrix::QuantMatrix()
+    : Matrix(), qnorm_(false), codesize_(0), opq_(false), opqField_(true) {}
 
-QuantMatrix::QuantMatrix(DenseMatrix&& mat, int32_t dsub, bool qnorm)
+QuantMatrix::QuantMatrix(bool opqField)
+    : Matrix(),
+      qnorm_(false),
+      codesize_(0),
+      opq_(false),
+      opqField_(opqField) {}
+
+QuantMatrix::QuantMatrix(
+    DenseMatrix&& mat,
+    int32_t dsub,
+    bool qnorm,
+    bool opq,
+    int32_t nthreads)
     : Matrix(mat.size(0), mat.size(1)),
       qnorm_(qnorm),
-      codesize_(mat.size(0) * ((mat.size(1) + dsub - 1) / dsub)) {
+      codesize_(mat.size(0) * ((mat.size(1) + dsub - 1) / dsub)),
+      opq_(opq),
+      opqField_(true) {
   codes_.resize(codesize_);
   pq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer(n_, dsub));
   if (qnorm_) {
     norm_codes_.resize(m_);
     npq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer(1, 1));
   }
-  quantize(std::forward<DenseMatrix>(mat));
+  quantize(std::forward<DenseMatrix>(mat), nthreads);
 }
 
 void QuantMatrix::quantizeNorm(const Vector& norms) {
@@ -37,27 +174,176 @@ void QuantMatrix::quantizeNorm(const Vector& norms) {
   npq_->compute_codes(dataptr, norm_codes_.data(), m_);
 }
 
-void QuantMatrix::quantize(DenseMatrix&& mat) {
+void QuantMatrix::quantize(DenseMatrix&& mat, int32_t nthreads) {
   if (qnorm_) {
     Vector norms(mat.size(0));
     mat.l2NormRow(norms);
     mat.divideRow(norms);
     quantizeNorm(norms);
   }
+  if (opq_) {
+    learnRotation(mat, nthreads);
+    Vector row(n_);
+    for (int64_t i = 0; i < m_; i++) {
+      real* x = mat.data() + i * n_;
+      rotate(x, row.data());
+      std::copy(row.data(), row.data() + n_, x);
+    }
+  }
   auto dataptr = mat.data();
-  pq_->train(m_, dataptr);
-  pq_->compute_codes(dataptr, codes_.data(), m_);
+  pq_->train(m_, dataptr, nthreads);
+  pq_->compute_codes(dataptr, codes_.data(), m_, nthreads);
+}
+
+void QuantMatrix::rotate(const real* x, real* out) const {
+  std::fill(out, out + n_, 0.0);
+  for (int64_t k = 0; k < n_; k++) {
+    kernels::axpy(x[k], rotation_.data() + k * n_, out, n_);
+  }
+}
+
+void QuantMatrix::unrotate(const real* x, real* out) const {
+  for (int64_t k = 0; k < n_; k++) {
+    out[k] = kernels::dot(rotation_.data() + k * n_, x, n_);
+  }
+}
+
+// Alternates between training the product quantizer on the rotated rows of
+// a sample of mat, and setting the rotation to the one that maps the sample
+// the closest to the reconstruction of its codes.
+void QuantMatrix::learnRotation(const DenseMatrix& mat, int32_t nthreads) {
+  const int64_t np = std::min<int64_t>(m_, OPQ_MAX_POINTS);
+  std::vector<real> sample(np * n_);
+  for (int64_t i = 0; i < np; i++) {
+    const real* x = mat.data() + (i * m_ / np) * n_;
+    std::copy(x, x + n_, sample.data() + i * n_);
+  }
+  rotation_.assign(n_ * n_, 0.0);
+  for (int64_t k = 0; k < n_; k++) {
+    rotation_[k * n_ + k] = 1.0;
+  }
+  const int32_t nsubq = pq_->get_nsubq();
+  std::vector<real> rotated(np * n_);
+  std::vector<uint8_t> codes(np * nsubq);
+  std::vector<double> cross(n_ * n_);
+  Vector y(n_);
+  for (int32_t iter = 0; iter < OPQ_NITER; iter++) {
+    for (int64_t i = 0; i < np; i++) {
+      rotate(sample.data() + i * n_, rotated.data() + i * n_);
+    }
+    pq_->train(np, rotated.data(), nthreads);
+    pq_->compute_codes(rotated.data(), codes.data(), np, nthreads);
+    std::fill(cross.begin(), cross.end(), 0.0);
+    for (int64_t i = 0; i < np; i++) {
+      y.zero();
+      pq_->addcode(y, codes.data(), i, 1.0);
+      const real* x = sample.data() + i * n_;
+      for (int64_t a = 0; a < n_; a++) {
+        for (int64_t b = 0; b < n_; b++) {
+          cross[a * n_ + b] += double(x[a]) * y[b];
+        }
+      }
+    }
+    orthogonalFactor(cross, n_);
+    std::copy(cross.begin(), cross.end(), rotation_.begin());
+  }
 }
 
 real QuantMatrix::dotRow(const Vector& vec, int64_t i) const {
   assert(i >= 0);
   assert(i < m_);
   assert(vec.size() == n_);
-  real norm = 1;
+  if (opq_) {
+    Vector rotated(n_);
+    rotate(vec.data(), rotated.data());
+    return pq_->mulcode(rotated, codes_.data(), i, norm(i));
+  }
+  return pq_->mulcode(vec, codes_.data(), i, norm(i));
+}
+
+real QuantMatrix::norm(int64_t i) const {
   if (qnorm_) {
-    norm = npq_->get_centroids(0, norm_codes_[i])[0];
+    return npq_->get_centroids(0, norm_codes_[i])[0];
+  }
+  return 1;
+}
+
+// Scoring every row through a table of the inner products of x with the
+// centroids pays off when the rows save more multiplications, dim - nsubq
+// each, than the ksub * dim it takes to fill the table.
+bool QuantMatrix::useDotTable() const {
+  const int64_t nsubq = pq_->get_nsubq();
+  return m_ * (n_ - nsubq) > pq_->get_ksub() * n_;
+}
+
+void QuantMatrix::mulTable(const real* table, real* out) const {
+  for (int64_t i = 0; i < m_; i++) {
+    out[i] = pq_->mulcode(table, codes_.data(), i, norm(i));
   }
-  return pq_->mulcode(vec, codes_.data(), i, norm);
+}
+
+void QuantMatrix::mulVector(const Vector& x, Vector& out) const {
+  assert(x.size() == n_);
+  assert(out.size() == m_);
+  if (!opq_ && !useDotTable()) {
+    Matrix::mulVector(x, out);
+    return;
+  }
+  // Scratch space of the thread, so that scoring a vector does not allocate.
+  static thread_local std::vector<real> table;
+  static thread_local std::vector<real> rotated;
+  table.resize(pq_->get_nsubq() * pq_->get_ksub());
+  const real* query = x.data();
+  if (opq_) {
+    rotated.resize(n_);
+    rotate(query, rotated.data());
+    query = rotated.data();
+  }
+  pq_->compute_dot_table(query, table.data());
+  mulTable(table.data(), out.data());
+}
+
+void QuantMatrix::dotRows(const DenseMatrix& x, DenseMatrix& out, int64_t n)
+    const {
+  assert(x.cols() == n_);
+  assert(out.cols() == m_);
+  if (!opq_ && !useDotTable()) {
+    Matrix::dotRows(x, out, n);
+    return;
+  }
+  std::vector<real> table(pq_->get_nsubq() * pq_->get_ksub());
+  Vector rotated(n_);
+  for (int64_t b = 0; b < n; b++) {
+    const real* query = x.data() + b * n_;
+    if (opq_) {
+      rotate(query, rotated.data());
+      query = rotated.data();
+    }
+    pq_->compute_dot_table(query, table.data());
+    mulTable(table.data(), out.data() + b * m_);
+  }
+}
+
+// The rows are averaged in the rotated space, so that the average is
+// rotated back once.
+void QuantMatrix::averageRowsToVector(
+    const std::vector<int32_t>& rows,
+    Vector& x) const {
+  if (!opq_) {
+    Matrix::averageRowsToVector(rows, x);
+    return;
+  }
+  // Scratch space of the thread, so that averaging rows does not allocate.
+  static thread_local Vector rotated(0);
+  if (rotated.size() != n_) {
+    rotated = Vector(n_);
+  }
+  rotated.zero();
+  for (auto it = rows.cbegin(); it != rows.cend(); ++it) {
+    pq_->addcode(rotated, codes_.data(), *it, norm(*it));
+  }
+  rotated.mul(1.0 / rows.size());
+  unrotate(rotated.data(), x.data());
 }
 
 void QuantMatrix::addVectorToRow(const Vector&, int64_t, real) {
@@ -65,23 +351,25 @@ void QuantMatrix::addVectorToRow(const Vector&, int64_t, real) {
 }
 
 void QuantMatrix::addRowToVector(Vector& x, int32_t i, real a) const {
-  real norm = 1;
-  if (qnorm_) {
-    norm = npq_->get_centroids(0, norm_codes_[i])[0];
+  if (opq_) {
+    Vector rotated(n_);
+    Vector row(n_);
+    rotated.zero();
+    pq_->addcode(rotated, codes_.data(), i, a * norm(i));
+    unrotate(rotated.data(), row.data());
+    x.addVector(row);
+    return;
   }
-  pq_->addcode(x, codes_.data(), i, a * norm);
+  pq_->addcode(x, codes_.data(), i, a * norm(i));
 }
 
 void QuantMatrix::addRowToVector(Vector& x, int32_t i) const {
-  real norm = 1;
-  if (qnorm_) {
-    norm = npq_->get_centroids(0, norm_codes_[i])[0];
-  }
-  pq_->addcode(x, codes_.data(), i, norm);
+  addRowToVector(x, i, 1.0);
 }
 
 void QuantMatrix::save(std::ostream& out) const {
   out.write((char*)&qnorm_, sizeof(qnorm_));
+  out.write((char*)&opq_, sizeof(opq_));
   out.write((char*)&m_, sizeof(m_));
   out.write((char*)&n_, sizeof(n_));
   out.write((char*)&codesize_, sizeof(codesize_));
@@ -91,10 +379,17 @@ void QuantMatrix::save(std::ostream& out) const {
     out.write((char*)norm_codes_.data(), m_ * sizeof(uint8_t));
     npq_->save(out);
   }
+  if (opq_) {
+    out.write((char*)rotation_.data(), n_ * n_ * sizeof(real));
+  }
 }
 
 void QuantMatrix::load(std::istream& in) {
   in.read((char*)&qnorm_, sizeof(qnorm_));
+  opq_ = false;
+  if (opqField_) {
+    in.read((char*)&opq_, sizeof(opq_));
+  }
   in.read((char*)&m_, sizeof(m_));
   in.read((char*)&n_, sizeof(n_));
   in.read((char*)&codesize_, sizeof(codesize_));
@@ -108,6 +403,11 @@ void QuantMatrix::load(std::istream& in) {
     npq_ = std::unique_ptr<ProductQuantizer>(new ProductQuantizer());
     npq_->load(in);
   }
+  rotation_.clear();
+  if (opq_) {
+    rotation_.resize(n_ * n_);
+    in.read((char*)rotation_.data(), n_ * n_ * sizeof(real));
+  }
 }
 
 void QuantMatrix::dump(std::ostream&) const {
@@ -36,9 +36,32 @@ class QuantMatrix : public Matrix {
   bool qnorm_;
   int32_t codesize_;
 
+  // With opq_, the codes are those of the rows multiplied by the orthogonal
+  // n_ x n_ matrix rotation_, learned to lower the quantization error
+  // (Ge et al., 2013), and vectors are rotated before scoring the codes.
+  bool opq_;
+  bool opqField_;
+  std::vector<real> rotation_;
+
+  real norm(int64_t i) const;
+  bool useDotTable() const;
+  void mulTable(const real* table, real* out) const;
+  // out = x * rotation_, and out = x * rotation_^T for unrotate.
+  void rotate(const real* x, real* out) const;
+  void unrotate(const real* x, real* out) const;
+  void learnRotation(const DenseMatrix& mat, int32_t nthreads);
+
  public:
   QuantMatrix();
-  QuantMatrix(DenseMatrix&&, int32_t, bool);
+  // A matrix to load from a file in which, if opqField, the rotation flag
+  // follows the norm flag, which is not the case before model version 13.
+  explicit QuantMatrix(bool opqField);
+  QuantMatrix(
+      DenseMatrix&&,
+      int32_t,
+      bool,
+      bool opq = false,
+      int32_t nthreads = 1);
   QuantMatrix(const QuantMatrix&) = delete;
   QuantMatrix(QuantMatrix&&) = delete;
   QuantMatrix& operator=(const QuantMatrix&) = delete;
@@ -46,9 +69,14 @@ class QuantMatrix : public Matrix {
   virtual ~QuantMatrix() noexcept override = default;
 
   void quantizeNorm(const Vector&);
-  void quantize(DenseMatrix&& mat);
+  void quantize(DenseMatrix&& mat, int32_t nthreads = 1);
 
   real dotRow(const Vector&, int64_t) const override;
+  void mulVector(const Vector& x, Vector& out) const override;
+  void averageRowsToVector(const std::vector<int32_t>& rows, Vector& x)
+      const override;
+  void dotRows(const DenseMatrix& x, DenseMatrix& out, int64_t n)
+      const override;
   void addVectorToRow(const Vector&, int64_t, real) override;
   void addRowToVector(Vector& x, int32_t i) const override;
   void addRowToVector(Vector& x, int32_t i, real a) const override;
@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+namespace fasttext {
+
+// Read-only view of a range of characters owned by someone else, like the
+// std::string_view of C++17, of which it has the few members used here.
+// Strings, and C strings, convert to it implicitly, so that functions taking
+// a string_view accept them as they are.
+class string_view {
+ protected:
+  const char* data_;
+  size_t size_;
+
+ public:
+  string_view() : data_(nullptr), size_(0) {}
+  string_view(const char* data, size_t size) : data_(data), size_(size) {}
+  string_view(const char* str) : data_(str), size_(std::strlen(str)) {}
+  string_view(const std::string& str) : data_(str.data()), size_(str.size()) {}
+
+  inline const char* data() const {
+    return data_;
+  }
+  inline size_t size() const {
+    return size_;
+  }
+  inline bool empty() const {
+    return size_ == 0;
+  }
+  inline const char* begin() const {
+    return data_;
+  }
+  inline const char* end() const {
+    return data_ + size_;
+  }
+  inline char operator[](size_t i) const {
+    return data_[i];
+  }
+
+  inline bool starts_with(string_view prefix) const {
+    return size_ >= prefix.size_ &&
+        (prefix.size_ == 0 ||
+         std::memcmp(data_, prefix.data_, prefix.size_) == 0);
+  }
+
+  inline std::string str() const {
+    return std::string(data_, size_);
+  }
+};
+
+inline bool operator==(string_view l, string_view r) {
+  return l.size() == r.size() &&
+      (l.size() == 0 || std::memcmp(l.data(), r.data(), l.size()) == 0);
+}
+
+inline bool operator!=(string_view l, string_view r) {
+  return !(l == r);
+}
+
+inline std::ostream& operator<<(std::ostream& out, string_view str) {
+  return out.write(str.data(), str.size());
+}
+
+} // namespace fasttext
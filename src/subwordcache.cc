@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "subwordcache.h"
+
+namespace fasttext {
+
+SubwordCache::SubwordCache(int64_t capacity)
+    : nsets_(NSHARDS),
+      locks_(NSHARDS),
+      hits_(NSHARDS, 0),
+      misses_(NSHARDS, 0) {
+  while (nsets_ * SET_SIZE < capacity) {
+    nsets_ *= 2;
+  }
+  entries_.resize(nsets_ * SET_SIZE);
+  hands_.assign(nsets_, 0);
+  clear();
+}
+
+bool SubwordCache::find(
+    string_view token,
+    uint32_t h,
+    std::vector<int32_t>& ngrams) {
+  const int64_t s = set(h);
+  std::lock_guard<std::mutex> lock(locks_[s % NSHARDS]);
+  Entry* entries = entries_.data() + s * SET_SIZE;
+  for (int32_t i = 0; i < SET_SIZE; i++) {
+    Entry& entry = entries[i];
+    if (entry.valid && entry.hash == h && string_view(entry.token) == token) {
+      entry.referenced = true;
+      ngrams.insert(ngrams.end(), entry.ngrams.begin(), entry.ngrams.end());
+      hits_[s % NSHARDS]++;
+      return true;
+    }
+  }
+  misses_[s % NSHARDS]++;
+  return false;
+}
+
+void SubwordCache::insert(
+    string_view token,
+    uint32_t h,
+    const int32_t* first,
+    const int32_t* last) {
+  if (token.size() > MAX_TOKEN_SIZE) {
+    return;
+  }
+  const int64_t s = set(h);
+  std::lock_guard<std::mutex> lock(locks_[s % NSHARDS]);
+  Entry* entries = entries_.data() + s * SET_SIZE;
+  for (int32_t i = 0; i < SET_SIZE; i++) {
+    if (entries[i].valid && entries[i].hash == h &&
+        string_view(entries[i].token) == token) {
+      // Inserted by another thread since the lookup.
+      return;
+    }
+  }
+  // The hand skips, and clears, the references until it finds an entry
+  // without one, which takes at most a full turn.
+  uint8_t& hand = hands_[s];
+  while (entries[hand].valid && entries[hand].referenced) {
+    entries[hand].referenced = false;
+    hand = (hand + 1) % SET_SIZE;
+  }
+  Entry& entry = entries[hand];
+  hand = (hand + 1) % SET_SIZE;
+  entry.hash = h;
+  entry.valid = true;
+  entry.referenced = false;
+  entry.token.assign(token.data(), token.size());
+  entry.ngrams.assign(first, last);
+}
+
+void SubwordCache::clear() {
+  for (int32_t i = 0; i < NSHARDS; i++) {
+    std::lock_guard<std::mutex> lock(locks_[i]);
+    for (int64_t s = i; s < nsets_; s += NSHARDS) {
+      for (int32_t j = 0; j < SET_SIZE; j++) {
+        entries_[s * SET_SIZE + j].valid = false;
+      }
+      hands_[s] = 0;
+    }
+    hits_[i] = 0;
+    misses_[i] = 0;
+  }
+}
+
+int64_t SubwordCache::capacity() const {
+  return nsets_ * SET_SIZE;
+}
+
+int64_t SubwordCache::hits() const {
+  int64_t hits = 0;
+  for (int32_t i = 0; i < NSHARDS; i++) {
+    std::lock_guard<std::mutex> lock(locks_[i]);
+    hits += hits_[i];
+  }
+  return hits;
+}
+
+int64_t SubwordCache::misses() const {
+  int64_t misses = 0;
+  for (int32_t i = 0; i < NSHARDS; i++) {
+    std::lock_guard<std::mutex> lock(locks_[i]);
+    misses += misses_[i];
+  }
+  return misses;
+}
+
+} // namespace fasttext
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "stringview.h"
+
+namespace fasttext {
+
+// Bounded cache from out-of-vocabulary tokens to their subword ids, safe to
+// use from several threads. It is set associative: the hash of a token picks
+// a set of SET_SIZE entries, in which the token is looked for and, when it is
+// missing, replaces the entry chosen by the CLOCK policy, i.e. the first one
+// not referenced since the hand of the set last passed it. Sets are split
+// over shards that each have their own lock and hit and miss counters.
+class SubwordCache {
+ public:
+  static constexpr int32_t SET_SIZE = 8;
+  static constexpr int32_t NSHARDS = 16;
+  // Longer tokens are not cached, which bounds the memory of an entry.
+  static constexpr size_t MAX_TOKEN_SIZE = 128;
+
+ protected:
+  struct Entry {
+    uint32_t hash;
+    bool valid;
+    bool referenced;
+    std::string token;
+    std::vector<int32_t> ngrams;
+  };
+
+  // Set s is entries_[s * SET_SIZE] .. entries_[(s + 1) * SET_SIZE - 1], and
+  // belongs to shard s % NSHARDS.
+  std::vector<Entry> entries_;
+  std::vector<uint8_t> hands_;
+  int64_t nsets_;
+  mutable std::vector<std::mutex> locks_;
+  std::vector<int64_t> hits_;
+  std::vector<int64_t> misses_;
+
+  int64_t set(uint32_t h) const {
+    return (uint64_t(h) * 0x9E3779B97F4A7C15ull >> 32) & (nsets_ - 1);
+  }
+
+ public:
+  // Makes a cache of at least capacity entries, rounded up to a power of two
+  // sets per shard.
+  explicit SubwordCache(int64_t capacity);
+  SubwordCache(const SubwordCache&) = delete;
+  SubwordCache& operator=(const SubwordCache&) = delete;
+
+  // Appends the subwords of token, of hash h, to ngrams and returns true if
+  // it is cached; returns false otherwise.
+  bool find(string_view token, uint32_t h, std::vector<int32_t>& ngrams);
+
+  // Caches the subwords first .. last - 1 of token, of hash h.
+  void insert(
+      string_view token,
+      uint32_t h,
+      const int32_t* first,
+      const int32_t* last);
+
+  void clear();
+
+  int64_t capacity() const;
+  int64_t hits() const;
+  int64_t misses() const;
+};
+
+} // namespace fasttext
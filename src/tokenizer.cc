@@ -0,0 +1,139 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "tokenizer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "utils.h"
+
+namespace fasttext {
+
+namespace {
+
+// The block starts this large and grows, for lines that do not fit, up to
+// MAX_BLOCK_SIZE, beyond which long lines are read in pieces. It only grows
+// further for tokens that do not fit.
+constexpr int64_t MIN_BLOCK_SIZE = 1 << 10;
+constexpr int64_t MAX_BLOCK_SIZE = 1 << 16;
+
+inline bool isDelimiter(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r') || c == '\0';
+}
+
+} // namespace
+
+Tokenizer::Tokenizer(string_view eos)
+    : eos_(eos),
+      eosHash_(utils::FNV_OFFSET_BASIS),
+      pos_(0),
+      end_(0),
+      eol_(false),
+      partial_(false),
+      read_(0) {
+  for (char c : eos_) {
+    eosHash_ = utils::fnvStep(eosHash_, c);
+  }
+}
+
+void Tokenizer::clear() {
+  pos_ = 0;
+  end_ = 0;
+  eol_ = false;
+  partial_ = false;
+  read_ = 0;
+}
+
+// Reads the rest of the line, or as much of it as fits, after the
+// characters left in the block, which are moved to its start, and ends them
+// with a '\0'. Returns false if the stream has ended.
+bool Tokenizer::fill(std::istream& in) {
+  const int64_t left = end_ - pos_;
+  if (left > 0 && pos_ > 0) {
+    std::memmove(block_.data(), block_.data() + pos_, left);
+  }
+  pos_ = 0;
+  end_ = left;
+  int64_t capacity = block_.size();
+  if (capacity - left < MIN_BLOCK_SIZE / 2 ||
+      (partial_ && capacity < MAX_BLOCK_SIZE)) {
+    capacity = std::max(MIN_BLOCK_SIZE, 2 * capacity);
+    while (capacity - left < MIN_BLOCK_SIZE / 2) {
+      capacity *= 2;
+    }
+    block_.resize(capacity);
+  }
+  // getline stores at most capacity - left - 1 characters and a '\0'. It
+  // sets failbit, without eofbit, when it stops because the block is full.
+  in.getline(block_.data() + left, capacity - left);
+  const int64_t count = in.gcount();
+  read_ += count;
+  bool more = true;
+  if (in.eof()) {
+    end_ += count;
+    partial_ = false;
+    more = count > 0;
+  } else if (in.fail()) {
+    in.clear();
+    end_ += count;
+    partial_ = count > 0;
+    more = count > 0;
+  } else {
+    end_ += count - 1;
+    eol_ = true;
+    partial_ = false;
+  }
+  block_[end_] = '\0';
+  return more;
+}
+
+// The characters of the block are followed by a '\0', which is a delimiter,
+// so that the end of a token is found without checking the end of the block.
+// Each character is tested and hashed in the same pass: with the short
+// tokens of text, a vectorized search for delimiters costs more than it
+// saves, the hash being the bottleneck.
+bool Tokenizer::next(std::istream& in, string_view& token, uint32_t& h) {
+  while (true) {
+    const char* s = block_.data() + pos_;
+    const char* last = block_.data() + end_;
+    while (s < last && isDelimiter(*s)) {
+      s++;
+    }
+    if (s < last) {
+      const char* start = s;
+      uint32_t hash = utils::FNV_OFFSET_BASIS;
+      while (!isDelimiter(*s)) {
+        hash = utils::fnvStep(hash, *s);
+        s++;
+      }
+      pos_ = start - block_.data();
+      if (s == last && partial_) {
+        // The token goes on in the stream.
+        fill(in);
+        continue;
+      }
+      token = string_view(start, s - start);
+      h = hash;
+      pos_ = s - block_.data();
+      return true;
+    }
+    pos_ = end_;
+    if (eol_) {
+      eol_ = false;
+      token = eos_;
+      h = eosHash_;
+      return true;
+    }
+    if (!fill(in)) {
+      return false;
+    }
+  }
+}
+
+} // namespace fasttext
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <vector>
+
+#include "stringview.h"
+
+namespace fasttext {
+
+// Splits a stream into the tokens of Dictionary::readWord: the words
+// delimited by ' ', '\t', '\n', '\v', '\f', '\r' or '\0', and the
+// end-of-sentence token eos after each line. The stream is read line by
+// line into a block, in pieces when a line is longer than the block, so
+// that it is never read past the line being tokenized. Each token is hashed
+// as it is scanned, with the hash of Dictionary::hash.
+class Tokenizer {
+ protected:
+  string_view eos_;
+  uint32_t eosHash_;
+  // The unread characters of the block are block_[pos_] to block_[end_ - 1].
+  // They are followed by the end of the line if eol_, and by more of the
+  // same line, still in the stream, if partial_.
+  std::vector<char> block_;
+  int64_t pos_;
+  int64_t end_;
+  bool eol_;
+  bool partial_;
+  // Characters extracted from the stream, line ends included.
+  int64_t read_;
+
+  bool fill(std::istream& in);
+
+ public:
+  explicit Tokenizer(string_view eos);
+
+  // Sets token to the next token of in, which stays valid until the next
+  // call, and h to its hash. Returns false at the end of the stream.
+  bool next(std::istream& in, string_view& token, uint32_t& h);
+
+  // Whether no character read from the stream is left to tokenize.
+  bool empty() const {
+    return pos_ == end_ && !eol_ && !partial_;
+  }
+
+  // The number of characters read from the stream, which is the offset of
+  // the next line of the stream, from where the tokenizer started, when
+  // empty().
+  int64_t read() const {
+    return read_;
+  }
+
+  // Drops the characters left, e.g. to read another stream.
+  void clear();
+};
+
+} // namespace fasttext
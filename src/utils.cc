@@ -10,11 +10,20 @@
 
 #include <iomanip>
 #include <ios>
+#include <limits>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include "mappedfile.h"
 
 namespace fasttext {
 
 namespace utils {
 
+constexpr int32_t FILE_ALIGNMENT = 64;
+constexpr int64_t RANGE_BUFFER_SIZE = 1 << 20;
+
 int64_t size(std::ifstream& ifs) {
   ifs.seekg(std::streamoff(0), std::ios::end);
   return ifs.tellg();
@@ -25,6 +34,107 @@ void seek(std::ifstream& ifs, int64_t pos) {
   ifs.seekg(std::streampos(pos));
 }
 
+bool isStream(const std::string& filename) {
+  struct stat st;
+  return stat(filename.c_str(), &st) == 0 && (st.st_mode & S_IFMT) != S_IFREG;
+}
+
+bool fileStat(const std::string& filename, FileStat& st) {
+#ifdef _WIN32
+  // The size of a struct stat is 32 bits there.
+  struct _stat64 buf;
+  if (_stat64(filename.c_str(), &buf) != 0) {
+    return false;
+  }
+#else
+  struct stat buf;
+  if (stat(filename.c_str(), &buf) != 0) {
+    return false;
+  }
+#endif
+  st.size = buf.st_size;
+  st.inode = buf.st_ino;
+  st.mtimeSec = buf.st_mtime;
+#if defined(__APPLE__)
+  st.mtimeNsec = buf.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+  st.mtimeNsec = buf.st_mtim.tv_nsec;
+#else
+  st.mtimeNsec = 0;
+#endif
+  return true;
+}
+
+int64_t countTokens(const std::string& line) {
+  int64_t ntokens = 1;
+  bool inWord = false;
+  for (char c : line) {
+    bool space = c == ' ' || c == '\n' || c == '\r' || c == '\t' ||
+        c == '\v' || c == '\f' || c == '\0';
+    ntokens += !space && !inWord;
+    inWord = !space;
+  }
+  return ntokens;
+}
+
+int64_t nextLine(std::ifstream& ifs, int64_t pos) {
+  if (pos <= 0) {
+    return 0;
+  }
+  seek(ifs, pos - 1);
+  ifs.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  if (ifs.eof()) {
+    return size(ifs);
+  }
+  return ifs.tellg();
+}
+
+std::vector<int64_t> lineShards(std::ifstream& ifs, int32_t n) {
+  int64_t fileSize = size(ifs);
+  std::vector<int64_t> shards(1, 0);
+  for (int32_t i = 1; i < n; i++) {
+    int64_t pos = nextLine(ifs, i * fileSize / n);
+    if (pos > shards.back() && pos < fileSize) {
+      shards.push_back(pos);
+    }
+  }
+  shards.push_back(fileSize);
+  seek(ifs, 0);
+  return shards;
+}
+
+void writePadding(std::ostream& out, int64_t headerSize) {
+  int64_t pos = out.tellp();
+  int32_t padding = 0;
+  if (pos >= 0) {
+    int64_t dataPos = pos + sizeof(int32_t) + headerSize;
+    padding = (FILE_ALIGNMENT - dataPos % FILE_ALIGNMENT) % FILE_ALIGNMENT;
+  }
+  out.write((char*)&(padding), sizeof(int32_t));
+  for (int32_t i = 0; i < padding; i++) {
+    out.put(0);
+  }
+}
+
+void skipPadding(std::istream& in) {
+  int32_t padding;
+  in.read((char*)&(padding), sizeof(int32_t));
+  if (!in || padding < 0 || padding >= FILE_ALIGNMENT) {
+    throw std::invalid_argument("Invalid model file: bad alignment.");
+  }
+  in.ignore(padding);
+}
+
+const char* mapArray(std::istream& in, const MappedFile& file, int64_t bytes) {
+  skipPadding(in);
+  int64_t offset = in.tellg();
+  if (!in || offset < 0 || bytes < 0 || offset + bytes > file.size()) {
+    throw std::invalid_argument("Invalid index file: array out of range.");
+  }
+  in.seekg(bytes, std::ios_base::cur);
+  return file.data() + offset;
+}
+
 double getDuration(
     const std::chrono::steady_clock::time_point& start,
     const std::chrono::steady_clock::time_point& end) {
@@ -48,6 +158,66 @@ bool compareFirstLess(const std::pair<double, double>& l, const double& r) {
   return l.first < r;
 }
 
+FileRangeBuffer::FileRangeBuffer(
+    const std::string& filename,
+    int64_t begin,
+    int64_t end)
+    : file_(filename, std::ifstream::binary),
+      begin_(begin),
+      end_(end),
+      remaining_(end - begin),
+      buffer_(RANGE_BUFFER_SIZE) {
+  if (!file_.is_open()) {
+    throw std::invalid_argument(filename + " cannot be opened!");
+  }
+  file_.seekg(std::streampos(begin));
+}
+
+FileRangeBuffer::int_type FileRangeBuffer::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+  if (remaining_ <= 0) {
+    return traits_type::eof();
+  }
+  file_.read(
+      buffer_.data(),
+      std::min(remaining_, static_cast<int64_t>(buffer_.size())));
+  int64_t n = file_.gcount();
+  if (n <= 0) {
+    return traits_type::eof();
+  }
+  remaining_ -= n;
+  setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+  return traits_type::to_int_type(*gptr());
+}
+
+FileRangeBuffer::pos_type FileRangeBuffer::seekoff(
+    off_type off,
+    std::ios_base::seekdir dir,
+    std::ios_base::openmode which) {
+  int64_t pos = off;
+  if (dir == std::ios_base::cur) {
+    pos += end_ - begin_ - remaining_ - (egptr() - gptr());
+  } else if (dir == std::ios_base::end) {
+    pos += end_ - begin_;
+  }
+  return seekpos(pos_type(pos), which);
+}
+
+FileRangeBuffer::pos_type FileRangeBuffer::seekpos(
+    pos_type pos,
+    std::ios_base::openmode which) {
+  int64_t offset = pos;
+  if (offset < 0 || offset > end_ - begin_ || !(which & std::ios_base::in)) {
+    return pos_type(off_type(-1));
+  }
+  seek(file_, begin_ + offset);
+  remaining_ = end_ - begin_ - offset;
+  setg(buffer_.data(), buffer_.data(), buffer_.data());
+  return pos;
+}
+
 } // namespace utils
 
 } // namespace fasttext
@@ -12,8 +12,11 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <ostream>
+#include <streambuf>
+#include <string>
 #include <vector>
 
 #if defined(__clang__) || defined(__GNUC__)
@@ -26,14 +29,71 @@
 
 namespace fasttext {
 
+class MappedFile;
+
 using Predictions = std::vector<std::pair<real, int32_t>>;
 
 namespace utils {
 
+// FNV-1a over signed chars, the hash of Dictionary::hash, which extends the
+// hash h of a string with its next character c.
+constexpr uint32_t FNV_OFFSET_BASIS = 2166136261;
+
+inline uint32_t fnvStep(uint32_t h, char c) {
+  return (h ^ uint32_t(int8_t(c))) * 16777619;
+}
+
+// FNV-1a over 64-bit values, for the checksums that identify the version of
+// a file or of a matrix.
+constexpr uint64_t FNV64_OFFSET_BASIS = 14695981039346656037ull;
+
+inline uint64_t fnv64Step(uint64_t h, uint64_t x) {
+  return (h ^ x) * 1099511628211ull;
+}
+
 int64_t size(std::ifstream&);
 
 void seek(std::ifstream&, int64_t);
 
+// Whether filename exists and is not a regular file, e.g. a pipe or a device
+// that can only be read once, from start to end.
+bool isStream(const std::string& filename);
+
+// What the file system tells of a version of a file without reading it:
+// its size, inode and modification time, to the nanosecond where the
+// platform keeps it. The inode is 0 on Windows.
+struct FileStat {
+  int64_t size;
+  uint64_t inode;
+  int64_t mtimeSec;
+  int64_t mtimeNsec;
+};
+
+// Whether filename exists and could be stat'ed into st.
+bool fileStat(const std::string& filename, FileStat& st);
+
+// Number of tokens Dictionary::readWord returns for a line, end of line
+// included.
+int64_t countTokens(const std::string& line);
+
+// Offset of the first line of the file that starts at or after pos.
+int64_t nextLine(std::ifstream&, int64_t pos);
+
+// Splits the file into at most n ranges of similar size whose boundaries are
+// line starts. Returns the boundaries, from 0 to the file size.
+std::vector<int64_t> lineShards(std::ifstream&, int32_t n);
+
+// Writes an int32_t padding size followed by that many zero bytes, so that
+// the data starting headerSize bytes later is aligned on a 64 byte boundary
+// of the file. skipPadding reads back what writePadding wrote.
+void writePadding(std::ostream&, int64_t headerSize);
+
+void skipPadding(std::istream&);
+
+// Skips the padding and the array of bytes bytes that follow it in in, a
+// stream over file, and returns the address of the array in file.
+const char* mapArray(std::istream& in, const MappedFile& file, int64_t bytes);
+
 template <typename T>
 bool contains(const std::vector<T>& container, const T& value) {
   return std::find(container.begin(), container.end(), value) !=
@@ -67,6 +127,27 @@ class ClockPrint {
 
 bool compareFirstLess(const std::pair<double, double>& l, const double& r);
 
+// Read-only stream buffer over bytes [begin, end) of a file, so that several
+// threads can each read their own part of a corpus through an std::istream.
+// Positions are relative to begin: seeking to 0 rewinds the range.
+class FileRangeBuffer : public std::streambuf {
+ public:
+  FileRangeBuffer(const std::string& filename, int64_t begin, int64_t end);
+
+ protected:
+  int_type underflow() override;
+  pos_type seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode)
+      override;
+  pos_type seekpos(pos_type, std::ios_base::openmode) override;
+
+ private:
+  std::ifstream file_;
+  int64_t begin_;
+  int64_t end_;
+  int64_t remaining_;
+  std::vector<char> buffer_;
+};
+
 } // namespace utils
 
 } // namespace fasttext
@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "wordtable.h"
+
+#include <stdexcept>
+
+namespace fasttext {
+
+namespace {
+
+constexpr int64_t CACHE_LINE_SIZE = 64;
+
+} // namespace
+
+WordTable::WordTable() : WordTable(0) {}
+
+WordTable::WordTable(int64_t n) {
+  allocate(n);
+}
+
+// Makes an empty table of the smallest number of buckets, at least two, that
+// holds n entries without growing.
+void WordTable::allocate(int64_t n) {
+  int32_t bits = 1;
+  while (3 * (int64_t(BUCKET_SIZE) << bits) < 4 * n) {
+    bits++;
+  }
+  allocateBuckets(bits);
+}
+
+void WordTable::allocateBuckets(int32_t bits) {
+  nbuckets_ = int64_t(1) << bits;
+  shift_ = 64 - bits;
+  size_ = 0;
+  const int64_t lineSlots = CACHE_LINE_SIZE / sizeof(Slot);
+  slots_.assign(nbuckets_ * BUCKET_SIZE + lineSlots - 1, Slot{0, -1});
+  const int64_t misalignment =
+      reinterpret_cast<uintptr_t>(slots_.data()) % CACHE_LINE_SIZE;
+  offset_ = misalignment == 0 ? 0 : lineSlots - misalignment / sizeof(Slot);
+}
+
+void WordTable::place(uint32_t h, int32_t id) {
+  Slot* slots = slots_.data() + offset_;
+  for (int64_t b = bucket(h);; b = (b + 1) & (nbuckets_ - 1)) {
+    Slot* slot = slots + b * BUCKET_SIZE;
+    for (int32_t j = 0; j < BUCKET_SIZE; j++) {
+      if (slot[j].id < 0) {
+        slot[j].hash = h;
+        slot[j].id = id;
+        return;
+      }
+    }
+  }
+}
+
+void WordTable::insert(uint32_t h, int32_t id) {
+  if (4 * (int64_t(size_) + 1) > 3 * nbuckets_ * BUCKET_SIZE) {
+    std::vector<Slot> entries;
+    entries.reserve(size_);
+    for (const Slot& slot : slots_) {
+      if (slot.id >= 0) {
+        entries.push_back(slot);
+      }
+    }
+    allocate(2 * (int64_t(size_) + 1));
+    for (const Slot& entry : entries) {
+      place(entry.hash, entry.id);
+    }
+    size_ = entries.size();
+  }
+  place(h, id);
+  size_++;
+}
+
+void WordTable::clear(int64_t n) {
+  allocate(n);
+}
+
+void WordTable::save(std::ostream& out) const {
+  out.write((char*)&nbuckets_, sizeof(int64_t));
+  out.write((char*)&size_, sizeof(int32_t));
+  out.write((const char*)buckets(), nbuckets_ * BUCKET_SIZE * sizeof(Slot));
+}
+
+void WordTable::load(std::istream& in, int32_t n) {
+  int64_t nbuckets;
+  int32_t size;
+  in.read((char*)&nbuckets, sizeof(int64_t));
+  in.read((char*)&size, sizeof(int32_t));
+  int32_t bits = 1;
+  while (bits < 32 && (int64_t(1) << bits) < nbuckets) {
+    bits++;
+  }
+  // A table more than three quarters full could lack the free slot that
+  // ends the lookups of missing words.
+  if (!in || nbuckets != (int64_t(1) << bits) || size != n ||
+      4 * int64_t(size) > 3 * nbuckets * BUCKET_SIZE) {
+    throw std::invalid_argument("Invalid model file: corrupt word table.");
+  }
+  allocateBuckets(bits);
+  Slot* slots = slots_.data() + offset_;
+  in.read((char*)slots, nbuckets_ * BUCKET_SIZE * sizeof(Slot));
+  int64_t count = 0;
+  for (int64_t i = 0; i < nbuckets_ * BUCKET_SIZE; i++) {
+    if (slots[i].id >= n) {
+      throw std::invalid_argument("Invalid model file: corrupt word table.");
+    }
+    count += slots[i].id >= 0;
+  }
+  if (!in || count != size) {
+    throw std::invalid_argument("Invalid model file: corrupt word table.");
+  }
+  size_ = size;
+}
+
+} // namespace fasttext
@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace fasttext {
+
+// Hash table from words to ids, for a container that stores the words
+// itself. Each slot keeps the hash of its word next to its id, eight slots to
+// a 64-byte bucket, so that a lookup usually reads a single cache line and
+// only compares the words whose hash matches. Buckets are probed linearly
+// from the one picked by the high bits of the hash. Their number is a power
+// of two, and doubles once the table is three quarters full. Entries are
+// never removed one by one: the table is cleared as a whole. It is saved in
+// model files as is, so that loading it does not hash the words again.
+class WordTable {
+ public:
+  static constexpr int32_t BUCKET_SIZE = 8;
+
+ protected:
+  struct Slot {
+    uint32_t hash;
+    int32_t id;
+  };
+
+  // Buckets start at slots_[offset_], the first slot aligned on a cache
+  // line.
+  std::vector<Slot> slots_;
+  int64_t offset_;
+  int32_t shift_;
+  int64_t nbuckets_;
+  int32_t size_;
+
+  const Slot* buckets() const {
+    return slots_.data() + offset_;
+  }
+
+  int64_t bucket(uint32_t h) const {
+    return (uint64_t(h) * 0x9E3779B97F4A7C15ull) >> shift_;
+  }
+
+  void allocate(int64_t n);
+  void allocateBuckets(int32_t bits);
+  void place(uint32_t h, int32_t id);
+
+ public:
+  WordTable();
+  explicit WordTable(int64_t n);
+
+  int32_t size() const {
+    return size_;
+  }
+
+  // Returns the id of the entry of hash h for which equals(id) is true, or
+  // -1 if there is none.
+  template <typename Equals>
+  int32_t find(uint32_t h, Equals equals) const {
+    const Slot* slots = buckets();
+    for (int64_t b = bucket(h);; b = (b + 1) & (nbuckets_ - 1)) {
+      const Slot* slot = slots + b * BUCKET_SIZE;
+      for (int32_t j = 0; j < BUCKET_SIZE; j++) {
+        if (slot[j].id < 0) {
+          return -1;
+        }
+        if (slot[j].hash == h && equals(slot[j].id)) {
+          return slot[j].id;
+        }
+      }
+    }
+  }
+
+  // Adds an entry whose word is not in the table yet.
+  void insert(uint32_t h, int32_t id);
+
+  // Removes all the entries, and makes room for n of them.
+  void clear(int64_t n = 0);
+
+  void save(std::ostream&) const;
+  // Loads a table saved with save, whose ids must be 0 .. n - 1.
+  void load(std::istream&, int32_t n);
+};
+
+} // namespace fasttext
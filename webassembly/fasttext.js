@@ -371,6 +371,28 @@ class FastTextModel {
     return this.f.predict(text, k, threshold);
   }
 
+  /**
+     * predictLines
+     *
+     * Given an array of strings, get the predictions of each of them, as
+     * returned by predict, in minibatches.
+     *
+     * @param {Array.<string>}  texts
+     * @param {int}             k, the number of predictions to be returned
+     * @param {number}          probability threshold
+     *
+     * @return {Array.<Array.<Pair.<number, string>>>}
+     *     labels and their probabilities of every text
+     *
+     */
+  predictLines(texts, k = 1, threshold = 0.0) {
+    const lines = new fastTextModule['std::vector<std::string>']();
+    texts.forEach((text) => lines.push_back(text));
+    const predictions = this.f.predictLines(lines, k, threshold);
+    lines.delete();
+    return predictions;
+  }
+
   /**
      * getInputMatrix
      *
@@ -10,6 +10,7 @@
 #include <emscripten/bind.h>
 #include <fasttext.h>
 #include <functional>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -32,12 +33,49 @@ void fillFloat32ArrayFromVector(
   }
 }
 
+// The buffers of predict, kept from one call to the next while they fit the
+// model it is called on.
+FastText::PredictContext& predictContext(FastText* fasttext) {
+  static std::unique_ptr<FastText::PredictContext> context;
+  static const FastText* model = nullptr;
+  static int32_t dim = 0;
+  static int32_t nlabels = 0;
+  if (!context || model != fasttext || dim != fasttext->getDimension() ||
+      nlabels != fasttext->getDictionary()->nlabels()) {
+    context.reset(new FastText::PredictContext(*fasttext));
+    model = fasttext;
+    dim = fasttext->getDimension();
+    nlabels = fasttext->getDictionary()->nlabels();
+  }
+  return *context;
+}
+
 std::vector<std::pair<float, std::string>>
 predict(FastText* fasttext, std::string text, int k, double threshold) {
-  std::stringstream ioss(text + std::string("\n"));
+  FastText::PredictContext& context = predictContext(fasttext);
+  text += std::string("\n");
+  fasttext->predictLine(text, context, k, threshold);
 
   std::vector<std::pair<float, std::string>> predictions;
-  fasttext->predictLine(ioss, predictions, k, threshold);
+  for (int32_t i = 0; i < context.size(); i++) {
+    predictions.push_back(
+        std::make_pair(context.probability(i), context.label(i)));
+  }
+  return predictions;
+}
+
+// webassembly can't instantiate `std::thread`, so that the lines are
+// predicted in minibatches on a single thread.
+std::vector<std::vector<std::pair<float, std::string>>> predictLines(
+    FastText* fasttext,
+    std::vector<std::string> texts,
+    int k,
+    double threshold) {
+  for (auto& text : texts) {
+    text += std::string("\n");
+  }
+  std::vector<std::vector<std::pair<float, std::string>>> predictions;
+  fasttext->predictBatch(texts, predictions, k, threshold);
 
   return predictions;
 }
@@ -239,6 +277,7 @@ EMSCRIPTEN_BINDINGS(fasttext) {
       .function("getLine", &getLine, allow_raw_pointers())
       .function("test", &test, allow_raw_pointers())
       .function("predict", &predict, allow_raw_pointers())
+      .function("predictLines", &predictLines, allow_raw_pointers())
       .function("getWordVector", &getWordVector, allow_raw_pointers())
       .function("getSentenceVector", &getSentenceVector, allow_raw_pointers())
       .function("getSubwords", &getSubwords, allow_raw_pointers())
@@ -304,6 +343,10 @@ EMSCRIPTEN_BINDINGS(fasttext) {
   emscripten::register_vector<std::pair<float, std::string>>(
       "std::vector<std::pair<float, std::string>>");
 
+  emscripten::register_vector<
+      std::vector<std::pair<float, std::string>>>(
+      "std::vector<std::vector<std::pair<float, std::string>>>");
+
   emscripten::value_array<
       std::pair<std::vector<std::string>, std::vector<int32_t>>>(
       "std::pair<std::vector<std::string>, std::vector<int32_t>>")